@@ -0,0 +1,312 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "bitonic.hpp"
+#include "matmult.hpp"
+#include "merge_sort.hpp"
+#include "parallel_bitonic.hpp"
+#include "radix_sort.hpp"
+#include "runtime.hpp"
+#include "simd_bitonic.hpp"
+#include "thread_pool.hpp"
+#include "type_name.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+// Every repetition sorts or multiplies a few times untimed first, so program builds, buffer pool misses and cold
+// caches don't end up in the statistics
+constexpr unsigned warmup_runs = 2;
+
+enum class distribution { random, sorted, reversed, few_unique };
+
+constexpr std::array distributions = {distribution::random, distribution::sorted, distribution::reversed,
+                                      distribution::few_unique};
+
+const char *distribution_name(distribution dist) {
+  switch (dist) {
+  case distribution::random: return "random";
+  case distribution::sorted: return "sorted";
+  case distribution::reversed: return "reversed";
+  case distribution::few_unique: return "few-unique";
+  }
+  return "unknown";
+}
+
+// Inputs are generated with a fixed seed, so every run and every kernel sorts the same data
+template <typename T> std::vector<T> make_input(std::size_t size, distribution dist) {
+  std::mt19937 engine{42};
+  std::vector<T> input(size);
+
+  if (dist == distribution::few_unique) {
+    std::uniform_int_distribution<int> values{0, 15};
+    std::generate(input.begin(), input.end(), [&]() { return static_cast<T>(values(engine)); });
+    return input;
+  }
+
+  if constexpr (std::is_floating_point_v<T>) {
+    std::uniform_real_distribution<T> values{-1, 1};
+    std::generate(input.begin(), input.end(), [&]() { return values(engine); });
+  } else {
+    std::uniform_int_distribution<T> values{std::numeric_limits<T>::min(), std::numeric_limits<T>::max()};
+    std::generate(input.begin(), input.end(), [&]() { return values(engine); });
+  }
+
+  if (dist == distribution::sorted) std::sort(input.begin(), input.end());
+  else if (dist == distribution::reversed) std::sort(input.begin(), input.end(), std::greater<T>{});
+  return input;
+}
+
+template <typename T> using sorter_factory = std::function<std::unique_ptr<bitonic::i_bitonic_sort<T>>()>;
+
+// Wall time of sort() is reported as the iteration time, device time of the kernels as the pure_s counter
+template <typename T>
+void bench_sort(benchmark::State &state, sorter_factory<T> factory, std::size_t size, distribution dist) {
+  std::unique_ptr<bitonic::i_bitonic_sort<T>> sorter;
+  const auto input = make_input<T>(size, dist);
+  std::vector<T> data;
+
+  try {
+    sorter = factory();
+    for (unsigned i = 0; i < warmup_runs; ++i) {
+      data = input;
+      sorter->sort(data);
+    }
+  } catch (std::exception &e) {
+    state.SkipWithError(e.what());
+    return;
+  }
+
+  std::chrono::nanoseconds pure{};
+  for (auto _ : state) {
+    data = input;
+    clutils::profiling_info info;
+    const auto start = std::chrono::steady_clock::now();
+    sorter->sort(data, &info);
+    state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    pure += info.pure;
+  }
+
+  if (!std::is_sorted(data.begin(), data.end())) {
+    state.SkipWithError("Result is not sorted");
+    return;
+  }
+
+  state.SetItemsProcessed(state.iterations() * size);
+  state.SetBytesProcessed(state.iterations() * size * sizeof(T));
+  state.counters["pure_s"] =
+      benchmark::Counter(std::chrono::duration<double>(pure).count(), benchmark::Counter::kAvgIterations);
+}
+
+template <typename T> using matmult_factory = std::function<std::unique_ptr<matmult::i_matmult<T>>()>;
+
+// Multiply-adds count as two operations, bytes are A, B and C moved once
+template <typename T> void bench_matmult(benchmark::State &state, matmult_factory<T> factory, std::size_t size) {
+  std::unique_ptr<matmult::i_matmult<T>> mult;
+  matmult::matrix_type<T> a{size, size}, b{size, size};
+  std::mt19937 engine{42};
+  std::uniform_int_distribution<int> values{-32, 32};
+  std::generate(a.begin(), a.end(), [&]() { return static_cast<T>(values(engine)); });
+  std::generate(b.begin(), b.end(), [&]() { return static_cast<T>(values(engine)); });
+
+  try {
+    mult = factory();
+    for (unsigned i = 0; i < warmup_runs; ++i)
+      mult->multiply(a, b);
+  } catch (std::exception &e) {
+    state.SkipWithError(e.what());
+    return;
+  }
+
+  std::chrono::nanoseconds pure{};
+  for (auto _ : state) {
+    clutils::profiling_info info;
+    const auto start = std::chrono::steady_clock::now();
+    auto c = mult->multiply(a, b, &info);
+    state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    benchmark::DoNotOptimize(c.data());
+    pure += info.pure;
+  }
+
+  const double flops = 2.0 * size * size * size;
+  state.counters["FLOP/s"] = benchmark::Counter(flops, benchmark::Counter::kIsIterationInvariantRate);
+  state.SetBytesProcessed(state.iterations() * 3 * size * size * sizeof(T));
+  state.counters["pure_s"] =
+      benchmark::Counter(std::chrono::duration<double>(pure).count(), benchmark::Counter::kAvgIterations);
+}
+
+// count products of size x size matrices by one multiply_batched call
+template <typename T>
+void bench_matmult_batched(benchmark::State &state, std::shared_ptr<clutils::runtime> runtime, std::size_t size,
+                           std::size_t count) {
+  std::unique_ptr<matmult::naive_matmult<T>> mult;
+  const auto layout = matmult::batch_layout::packed({size, size, size}, count);
+  std::vector<T> a(layout.extent_a()), b(layout.extent_b()), c(layout.extent_c());
+  std::mt19937 engine{42};
+  std::uniform_int_distribution<int> values{-32, 32};
+  std::generate(a.begin(), a.end(), [&]() { return static_cast<T>(values(engine)); });
+  std::generate(b.begin(), b.end(), [&]() { return static_cast<T>(values(engine)); });
+
+  try {
+    mult = std::make_unique<matmult::naive_matmult<T>>(runtime);
+    for (unsigned i = 0; i < warmup_runs; ++i)
+      mult->multiply_batched(a, b, c, layout);
+  } catch (std::exception &e) {
+    state.SkipWithError(e.what());
+    return;
+  }
+
+  std::chrono::nanoseconds pure{};
+  for (auto _ : state) {
+    clutils::profiling_info info;
+    const auto start = std::chrono::steady_clock::now();
+    mult->multiply_batched(a, b, c, layout, &info);
+    state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    pure += info.pure;
+  }
+
+  const double flops = 2.0 * size * size * size * count;
+  state.counters["FLOP/s"] = benchmark::Counter(flops, benchmark::Counter::kIsIterationInvariantRate);
+  state.SetBytesProcessed(state.iterations() * 3 * size * size * count * sizeof(T));
+  state.counters["pure_s"] =
+      benchmark::Counter(std::chrono::duration<double>(pure).count(), benchmark::Counter::kAvgIterations);
+}
+
+constexpr std::array sort_log_sizes = {16u, 20u, 24u};
+constexpr std::array sort_local_sizes = {256u, 2048u};
+constexpr std::array matmult_sizes = {256u, 512u, 1024u};
+constexpr std::array matmult_tiles = {8u, 16u};
+constexpr std::array batched_sizes = {16u, 64u, 128u};
+constexpr std::size_t batched_count = 1024;
+
+template <typename T> void register_sort(const std::string &kernel, sorter_factory<T> factory) {
+  for (auto log_size : sort_log_sizes)
+    for (auto dist : distributions) {
+      const auto name = "sort/" + kernel + "/" + clutils::type_name<T>::name_str + "/" + distribution_name(dist) +
+                        "/2^" + std::to_string(log_size);
+      benchmark::RegisterBenchmark(name.c_str(), bench_sort<T>, factory, std::size_t{1} << log_size, dist)
+          ->UseManualTime()
+          ->Unit(benchmark::kMillisecond);
+    }
+}
+
+template <typename T> void register_matmult(const std::string &kernel, matmult_factory<T> factory) {
+  for (auto size : matmult_sizes) {
+    const auto name = "matmult/" + kernel + "/" + clutils::type_name<T>::name_str + "/" + std::to_string(size);
+    benchmark::RegisterBenchmark(name.c_str(), bench_matmult<T>, factory, std::size_t{size})
+        ->UseManualTime()
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+// GPU kernels share one runtime, so programs stay cached and the context is created once for the whole run. Without
+// a device only the CPU sorters are registered.
+template <typename T>
+void register_all(std::shared_ptr<clutils::runtime> runtime, std::shared_ptr<clutils::thread_pool> pool) {
+  using ptr = std::unique_ptr<bitonic::i_bitonic_sort<T>>;
+  register_sort<T>("cpu", []() -> ptr { return std::make_unique<bitonic::cpu_bitonic_sort<T>>(); });
+  register_sort<T>("cpu-simd", []() -> ptr { return std::make_unique<bitonic::simd_bitonic_sort<T>>(); });
+  register_sort<T>("cpu-par",
+                   [pool]() -> ptr { return std::make_unique<bitonic::parallel_bitonic_sort<T>>(pool); });
+  if (!runtime) return;
+
+  register_sort<T>("naive", [runtime]() -> ptr { return std::make_unique<bitonic::naive_bitonic<T>>(runtime); });
+  register_sort<T>("naive/direct", [runtime]() -> ptr {
+    auto sorter = std::make_unique<bitonic::naive_bitonic<T>>(runtime);
+    sorter->set_replay(false);
+    return sorter;
+  });
+  for (auto lsz : sort_local_sizes) {
+    const auto suffix = "/lsz:" + std::to_string(lsz);
+    register_sort<T>("local" + suffix,
+                     [=]() -> ptr { return std::make_unique<bitonic::local_bitonic<T>>(lsz, 4, runtime); });
+    register_sort<T>("register" + suffix,
+                     [=]() -> ptr { return std::make_unique<bitonic::register_bitonic<T>>(lsz, 8, 4, runtime); });
+  }
+  register_sort<T>("radix", [runtime]() -> ptr { return std::make_unique<bitonic::radix_sort<T>>(256, 16, runtime); });
+  register_sort<T>("merge",
+                   [runtime]() -> ptr { return std::make_unique<bitonic::merge_sort<T>>(256, 1024, 8, runtime); });
+
+  using mptr = std::unique_ptr<matmult::i_matmult<T>>;
+  register_matmult<T>("naive", [runtime]() -> mptr { return std::make_unique<matmult::naive_matmult<T>>(runtime); });
+  for (auto tile : matmult_tiles) {
+    const auto suffix = "/tile:" + std::to_string(tile);
+    register_matmult<T>("tiled" + suffix,
+                        [=]() -> mptr { return std::make_unique<matmult::tiled_matmult<T>>(tile, runtime); });
+    register_matmult<T>("tiledarb" + suffix, [=]() -> mptr {
+      return std::make_unique<matmult::tiled_arbitrary_matmult<T>>(tile, runtime);
+    });
+  }
+  register_matmult<T>("blocked/tile:64/block:4x4", [runtime]() -> mptr {
+    return std::make_unique<matmult::blocked_matmult<T>>(64, 4, 4, 16, runtime);
+  });
+  if constexpr (std::is_same_v<T, float>) {
+    for (auto precision : {matmult::storage_precision::fp16, matmult::storage_precision::bf16}) {
+      register_matmult<T>("mixed/" + std::string{matmult::precision_name(precision)} + "/tile:16", [=]() -> mptr {
+        return std::make_unique<matmult::mixed_matmult>(16, precision, runtime);
+      });
+    }
+  }
+
+  for (auto size : batched_sizes) {
+    const auto name = "matmult/batched/" + std::string{clutils::type_name<T>::name_str} + "/" + std::to_string(size) +
+                      "/x" + std::to_string(batched_count);
+    benchmark::RegisterBenchmark(name.c_str(), bench_matmult_batched<T>, runtime, std::size_t{size}, batched_count)
+        ->UseManualTime()
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+} // namespace
+
+// Five repetitions with aggregates only by default, both can be overridden with the usual --benchmark_* flags since
+// later flags win. Pick subsets with --benchmark_filter, e.g. --benchmark_filter='^sort/local.*/float/'.
+int main(int argc, char *argv[]) {
+  std::vector<char *> args = {argv[0]};
+  std::string repetitions = "--benchmark_repetitions=5", aggregates = "--benchmark_report_aggregates_only=true";
+  args.push_back(repetitions.data());
+  args.push_back(aggregates.data());
+  args.insert(args.end(), argv + 1, argv + argc);
+  int args_count = args.size();
+
+  benchmark::Initialize(&args_count, args.data());
+  if (benchmark::ReportUnrecognizedArguments(args_count, args.data())) return 1;
+
+  std::shared_ptr<clutils::runtime> runtime;
+  try {
+    runtime = bitonic::gpu_bitonic<int>::default_runtime();
+  } catch (std::exception &e) {
+    std::cerr << "Warning: " << e.what() << ", only CPU sorters are benchmarked\n";
+  }
+
+  auto pool = std::make_shared<clutils::thread_pool>();
+  register_all<int>(runtime, pool);
+  register_all<float>(runtime, pool);
+  register_all<double>(runtime, pool);
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
@@ -16,14 +16,33 @@
 #endif
 
 #include "bitonic.hpp"
+#include "bitonic_autotune.hpp"
+#include "hybrid_bitonic.hpp"
+#include "mapped_file.hpp"
+#include "merge_sort.hpp"
+#include "multi_gpu_bitonic.hpp"
+#include "out_of_core_bitonic.hpp"
+#include "parallel_bitonic.hpp"
+#include "profiling_report.hpp"
+#include "radix_sort.hpp"
+#include "simd_bitonic.hpp"
+#include "topk_bitonic.hpp"
+#include "type_name.hpp"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <numeric>
+#include <optional>
 #include <random>
+#include <span>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 #include "popl.hpp"
@@ -41,8 +60,6 @@
 
 #endif
 
-using vector_type = std::vector<TYPE__>;
-
 void vprint(const std::string title, const auto &vec) {
   std::cout << title << ": { ";
   for (auto &elem : vec) {
@@ -68,99 +85,572 @@ int validate_results(const auto &origin, const auto &res, const auto &check, boo
   return EXIT_FAILURE;
 }
 
-template <typename T> struct type_name {};
-template <> struct type_name<TYPE__> {
-  static constexpr const char *name_str = STRINGIFY(TYPE__);
+// Command line values that don't depend on the element type
+struct sort_options {
+  std::string kernel_name;
+  std::optional<std::string> lower, upper, input, output, report;
+  std::size_t size;
+  bool length_set;
+  std::optional<unsigned> batches, seglen, runs;
+  std::optional<std::size_t> top_k;
+  unsigned lsz, threads, devices, fuse, ept, depth;
+  std::size_t chunk;
+  double gpu_share;
+  bool skip_std_sort, print_on_failure, zero_copy, descending;
+  bool tunable, autotune, lsz_set, fuse_set, ept_set; // Tuned parameters only replace options that weren't given
 };
 
-int main(int argc, char **argv) try {
-  const auto maximum = std::numeric_limits<TYPE__>::max(), minimum = std::numeric_limits<TYPE__>::min();
+// Bounds default to the whole range of T
+template <typename T> std::optional<std::pair<T, T>> parse_bounds(const sort_options &opts) {
+  const T lower = (opts.lower ? clutils::from_string<T>(*opts.lower) : std::numeric_limits<T>::min()),
+          upper = (opts.upper ? clutils::from_string<T>(*opts.upper) : std::numeric_limits<T>::max());
 
-  popl::OptionParser op("Avaliable options");
-  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
-  auto print_option = op.add<popl::Switch>("p", "print", "Print on failure");
-  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip comparing with std::sort");
+  if (lower >= upper) {
+    std::cout << "Error: lower bound can't be greater than the upper bound\n";
+    return std::nullopt;
+  }
 
-  auto lower_option = op.add<popl::Implicit<TYPE__>>("", "lower", "Lower bound", minimum);
-  auto upper_option = op.add<popl::Implicit<TYPE__>>("", "upper", "Upper bound", maximum);
+  return std::make_pair(lower, upper);
+}
 
-  auto num_option = op.add<popl::Implicit<unsigned>>("", "num", "Length of the array to sort = 2^n", 24);
-  auto kernel_option =
-      op.add<popl::Implicit<std::string>>("", "kernel", "Which kernel to use: naive, cpu, local", "naive");
-  auto lsz_option = op.add<popl::Implicit<unsigned>>("", "lsz", "Local memory size", 256);
+template <typename T> int run_argsort(const sort_options &opts) {
+  const auto bounds = parse_bounds<T>(opts);
+  if (!bounds) return EXIT_FAILURE;
 
-  op.parse(argc, argv);
+  const auto size = opts.size;
+  std::unique_ptr<bitonic::gpu_bitonic_kv<T, unsigned>> sorter;
 
-  if (help_option->is_set()) {
-    std::cout << op << "\n ";
-    return EXIT_SUCCESS;
+  if (opts.kernel_name == "naive") {
+    sorter = std::make_unique<bitonic::naive_bitonic_kv<T, unsigned>>();
+  } else if (opts.kernel_name == "local") {
+    sorter = std::make_unique<bitonic::local_bitonic_kv<T, unsigned>>(opts.lsz);
+  } else {
+    std::cout << "Error: argsort is only implemented for naive and local kernels\n";
+    return EXIT_FAILURE;
   }
 
-  const bool skip_std_sort = skip_option->is_set(), print_on_failure = print_option->is_set();
-  const auto lower = lower_option->value(), upper = upper_option->value();
-  const auto num = num_option->value();
-  const auto kernel_name = kernel_option->value();
-  const auto lsz = lsz_option->value();
+  std::cout << "Computing sorting permutation of size = " << size << "\n";
+  std::cout << " -------- \n";
 
-  if (lower >= upper) {
-    std::cout << "Error: lower bound can't be greater than the upper bound\n";
-    return EXIT_FAILURE;
+  std::vector<T> keys(size);
+  auto rand_gen = clutils::create_random_number_generator<T>(bounds->first, bounds->second);
+  rand_gen(keys);
+
+  clutils::profiling_info prof_info;
+  const auto permutation = sorter->argsort(keys, &prof_info);
+
+  std::cout << "argsort wall time: " << clutils::to_milliseconds(prof_info.wall) << " ms\n";
+  std::cout << "argsort pure time: " << clutils::to_milliseconds(prof_info.pure) << " ms\n";
+  std::cout << " -------- \n";
+
+  if (opts.report) {
+    clutils::profiling_report report;
+    report.field("kernel", opts.kernel_name + "-argsort").field("type", clutils::type_name<T>::name_str);
+    report.field("length", size).add(prof_info).save(*opts.report);
   }
 
-  const unsigned size = (1 << num);
+  if (opts.skip_std_sort) return EXIT_SUCCESS;
+
+  std::vector<unsigned> check(size);
+  std::iota(check.begin(), check.end(), 0);
+  std::stable_sort(check.begin(), check.end(), [&keys](auto a, auto b) { return keys[a] < keys[b]; });
+
+  return validate_results(keys, permutation, check, opts.print_on_failure);
+}
+
+template <typename T> int run_topk(const sort_options &opts) {
+  const auto bounds = parse_bounds<T>(opts);
+  if (!bounds) return EXIT_FAILURE;
+
+  const auto size = opts.size;
+  const auto k = std::min(*opts.top_k, size);
+  bitonic::topk_bitonic<T> sorter{opts.lsz, opts.fuse};
 
-  std::unique_ptr<bitonic::i_bitonic_sort<TYPE__>> sorter;
+  std::cout << "Selecting " << k << " smallest of size = " << size << "\n";
+  if (k > sorter.max_select_size()) std::cout << "Warning: k is larger than the local size, sorting the whole array\n";
+  std::cout << " -------- \n";
+
+  std::vector<T> data(size);
+  auto rand_gen = clutils::create_random_number_generator<T>(bounds->first, bounds->second);
+  rand_gen(data);
+
+  clutils::profiling_info prof_info;
+  const auto selected = sorter.smallest(data, k, &prof_info);
+
+  std::cout << "top-k wall time: " << clutils::to_milliseconds(prof_info.wall) << " ms\n";
+  std::cout << "top-k pure time: " << clutils::to_milliseconds(prof_info.pure) << " ms\n";
+  std::cout << " -------- \n";
+
+  if (opts.report) {
+    clutils::profiling_report report;
+    report.field("kernel", opts.kernel_name + "-topk").field("type", clutils::type_name<T>::name_str);
+    report.field("length", size).field("k", k).add(prof_info).save(*opts.report);
+  }
+
+  if (opts.skip_std_sort) return EXIT_SUCCESS;
+
+  std::vector<T> check(k);
+  const auto wall_start = std::chrono::high_resolution_clock::now();
+  std::partial_sort_copy(data.begin(), data.end(), check.begin(), check.end());
+  const auto wall_end = std::chrono::high_resolution_clock::now();
+  std::cout << "std::partial_sort_copy wall time: " << clutils::to_milliseconds(wall_end - wall_start) << " ms\n";
+
+  return validate_results(data, selected, check, opts.print_on_failure);
+}
+
+template <typename T> int run_sort(const sort_options &opts) {
+  const auto bounds = parse_bounds<T>(opts);
+  if (!bounds) return EXIT_FAILURE;
+
+  const auto &kernel_name = opts.kernel_name;
+  unsigned lsz = opts.lsz, fuse = opts.fuse, ept = opts.ept;
+  std::shared_ptr<clutils::runtime> runtime; // Keeps the runtime shared by the tuner and the sorter alive
+
+  if (opts.tunable) {
+    const bool register_kernel = (kernel_name == "register");
+    runtime = bitonic::gpu_bitonic<T>::default_runtime();
+    clutils::tuning_store store;
+    std::optional<bitonic::local_config> config;
+
+    if (opts.autotune) {
+      std::cout << "Autotuning " << bitonic::local_kernel_name(register_kernel) << " for "
+                << clutils::type_name<T>::name_str << "\n";
+      config = bitonic::autotune_local<T>(runtime, register_kernel, {1 << 18, 1 << 21, 1 << 24}, 5, &std::cout).config;
+      bitonic::store_local_config<T>(store, runtime->device(), register_kernel, *config);
+      store.save();
+      if (store.path()) std::cout << "Info: Tuned configuration saved to " << store.path()->string() << "\n";
+    } else {
+      config = bitonic::load_local_config<T>(store, runtime->device(), register_kernel);
+    }
+
+    if (config) {
+      if (!opts.lsz_set) lsz = config->segment_size;
+      if (!opts.fuse_set) fuse = config->max_fused_steps;
+      if (!opts.ept_set && config->elems_per_thread) ept = config->elems_per_thread;
+      std::cout << "Info: Using tuned configuration: " << config->params().str() << "\n";
+    }
+  }
+
+  const unsigned batch_count = opts.batches.value_or(1);
+  std::size_t size = opts.size;
+
+  // The input file is mapped copy-on-write, the array is sorted in the mapped pages without touching the file
+  std::optional<clutils::mapped_file> input_file, output_file;
+  if (opts.input) {
+    input_file.emplace(*opts.input, clutils::mapped_file::mode::read);
+    const auto length = input_file->as<T>().size();
+    if (length % batch_count) {
+      std::cout << "Error: input length " << length << " is not divisible by the number of batches\n";
+      return EXIT_FAILURE;
+    }
+    size = length / batch_count;
+    if (opts.length_set)
+      std::cout << "Warning: length is taken from the input file, ignoring --len and --num options\n";
+  }
+
+  const auto threads = (opts.threads ? opts.threads : std::thread::hardware_concurrency());
+  std::unique_ptr<bitonic::i_bitonic_sort<T>> sorter;
+  bitonic::sort_order order;
+  order.descending = opts.descending;
 
   if (kernel_name == "naive") {
-    sorter = std::make_unique<bitonic::naive_bitonic<TYPE__, type_name<TYPE__>>>();
+    sorter = std::make_unique<bitonic::naive_bitonic<T>>(bitonic::gpu_bitonic<T>::default_runtime(), order);
+  } else if (kernel_name == "cpu" && opts.descending) {
+    sorter = std::make_unique<bitonic::cpu_bitonic_sort<T, std::greater<T>>>();
   } else if (kernel_name == "cpu") {
-    sorter = std::make_unique<bitonic::cpu_bitonic_sort<TYPE__>>();
+    sorter = std::make_unique<bitonic::cpu_bitonic_sort<T>>();
+  } else if (kernel_name == "cpu-simd") {
+    if (!BITONIC_SIMD_AVAILABLE) std::cout << "Warning: std::experimental::simd is unavailable, using scalar code\n";
+    sorter = std::make_unique<bitonic::simd_bitonic_sort<T>>();
+  } else if (kernel_name == "cpu-par") {
+    sorter = std::make_unique<bitonic::parallel_bitonic_sort<T>>(std::make_shared<clutils::thread_pool>(threads));
+  } else if (kernel_name == "hybrid") {
+    auto pool = std::make_shared<clutils::thread_pool>(threads);
+    sorter = std::make_unique<bitonic::hybrid_bitonic_sort<T>>(
+        std::make_unique<bitonic::local_bitonic<T>>(lsz, fuse),
+        std::make_unique<bitonic::parallel_bitonic_sort<T>>(pool), pool, opts.gpu_share);
+  } else if (kernel_name == "multi") {
+    auto devices = clutils::select_devices(bitonic::multi_gpu_bitonic<T>::cl_api_version);
+    if (opts.devices > devices.size()) {
+      std::cout << "Error: requested " << opts.devices << " devices, found " << devices.size() << "\n";
+      return EXIT_FAILURE;
+    }
+    if (opts.devices) devices.resize(opts.devices);
+    sorter = std::make_unique<bitonic::multi_gpu_bitonic<T>>(lsz, fuse, devices,
+                                                             std::make_shared<clutils::thread_pool>(threads));
+  } else if (kernel_name == "out-of-core") {
+    sorter = std::make_unique<bitonic::out_of_core_bitonic<T>>(lsz, opts.chunk, opts.depth, fuse,
+                                                               std::make_shared<clutils::thread_pool>(threads));
   } else if (kernel_name == "local") {
-    sorter = std::make_unique<bitonic::local_bitonic<TYPE__, type_name<TYPE__>>>(lsz);
+    sorter = std::make_unique<bitonic::local_bitonic<T>>(lsz, fuse, bitonic::gpu_bitonic<T>::default_runtime(), order);
+  } else if (kernel_name == "register") {
+    sorter = std::make_unique<bitonic::register_bitonic<T>>(lsz, ept, fuse, bitonic::gpu_bitonic<T>::default_runtime(),
+                                                            order);
+  } else if (kernel_name == "segmented") {
+    sorter = std::make_unique<bitonic::segmented_bitonic<T>>(lsz, bitonic::gpu_bitonic<T>::default_runtime(), order);
+  } else if (kernel_name == "radix") {
+    sorter = std::make_unique<bitonic::radix_sort<T>>();
+  } else if (kernel_name == "merge") {
+    sorter = std::make_unique<bitonic::merge_sort<T>>(lsz);
   } else {
     std::cout << "Unknown type of kernel: " << kernel_name << "\n ";
     return EXIT_FAILURE;
   }
 
-  if (kernel_name != "local" && lsz_option->is_set()) {
-    std::cout << "Warning: local size provided but kernel used is not \"local\", ignoring --lsz option\n";
+  auto *segmented_sorter = dynamic_cast<bitonic::segmented_bitonic<T> *>(sorter.get());
+  const unsigned seglen = opts.seglen.value_or(lsz);
+
+  if (segmented_sorter && (!seglen || seglen > lsz)) {
+    std::cout << "Error: segment length must be positive and can't exceed the local size\n";
+    return EXIT_FAILURE;
+  }
+
+  if (segmented_sorter && opts.batches) {
+    std::cout << "Error: segmented kernel sorts its segments in one launch, --batches can't be used with it\n";
+    return EXIT_FAILURE;
+  }
+
+  auto *merge_sorter = dynamic_cast<bitonic::merge_sort<T> *>(sorter.get());
+  if (opts.runs && (!merge_sorter || opts.batches || !*opts.runs)) {
+    std::cout << "Error: a positive number of runs is merged by the merge kernel, without --batches\n";
+    return EXIT_FAILURE;
+  }
+
+  auto *hybrid_sorter = dynamic_cast<bitonic::hybrid_bitonic_sort<T> *>(sorter.get());
+  auto *gpu_sorter = dynamic_cast<bitonic::gpu_bitonic<T> *>(sorter.get());
+  const bool zero_copy = opts.zero_copy && gpu_sorter;
+
+  if (zero_copy) {
+    gpu_sorter->set_host_memory_mode(clutils::host_memory_mode::zero_copy);
+  } else if (opts.zero_copy) {
+    std::cout << "Warning: kernel used does not run on the GPU, ignoring --zero-copy option\n";
+  }
+
+  if (opts.batches && !gpu_sorter) {
+    std::cout << "Error: batch pipeline requires a kernel running on the GPU\n";
+    return EXIT_FAILURE;
   }
 
   const auto print_sep = []() { std::cout << " -------- \n"; };
 
-  std::cout << "Sorting vector of size = " << size << "\n";
+  std::cout << "Sorting vector of " << clutils::type_name<T>::name_str << " of size = " << size;
+  if (opts.batches) std::cout << " in " << batch_count << " batches";
+  std::cout << "\n";
   print_sep();
 
-  vector_type origin;
-  origin.resize(size);
+  // Files are sorted in the mapped pages, which go to the device transfers without staging copies
+  std::vector<T> vec;
+  std::optional<clutils::pinned_vector<T>> pinned_vec;
+  std::span<T> data;
+
+  if (opts.output) {
+    const auto bin_size = size * batch_count * sizeof(T);
+    output_file.emplace(*opts.output, clutils::mapped_file::mode::create, bin_size);
+    data = output_file->as<T>();
+  } else if (input_file) {
+    data = input_file->as<T>();
+  } else if (zero_copy) {
+    data = pinned_vec.emplace(size * batch_count, gpu_sorter->get_pinned_allocator());
+  } else {
+    vec.resize(size * batch_count);
+    data = vec;
+  }
+
+  if (input_file && output_file) {
+    const auto input = input_file->as<T>();
+    std::copy(input.begin(), input.end(), data.begin());
+  } else if (!input_file) {
+    auto rand_gen = clutils::create_random_number_generator<T>(bounds->first, bounds->second);
+    rand_gen(data);
+  }
 
-  auto rand_gen = clutils::create_random_number_generator<TYPE__>(lower, upper);
-  rand_gen(origin);
+  std::vector<T> origin; // Unsorted copy to validate against
+  if (!opts.skip_std_sort) origin.assign(data.begin(), data.end());
+
+  std::vector<unsigned> offsets = {0};
+  if (segmented_sorter) {
+    std::mt19937 engine{std::random_device{}()};
+    std::uniform_int_distribution<unsigned> length_dist{1, seglen};
+    while (offsets.back() < size)
+      offsets.push_back(std::min<std::size_t>(size, offsets.back() + length_dist(engine)));
+    std::cout << "Split into " << offsets.size() - 1 << " segments of up to " << seglen << " elements\n";
+  } else if (opts.runs) {
+    // Runs of random lengths, sorted before the clock starts like data coming from sorted shards
+    std::mt19937 engine{std::random_device{}()};
+    std::uniform_int_distribution<std::size_t> cut_dist{0, size};
+    for (unsigned i = 1; i < *opts.runs; ++i)
+      offsets.push_back(cut_dist(engine));
+    offsets.push_back(size);
+    std::sort(offsets.begin(), offsets.end());
+
+    for (std::size_t i = 0; i + 1 < offsets.size(); ++i)
+      std::sort(data.begin() + offsets[i], data.begin() + offsets[i + 1]);
+    if (!opts.skip_std_sort) origin.assign(data.begin(), data.end());
+    std::cout << "Split into " << *opts.runs << " sorted runs\n";
+  }
 
-  std::chrono::milliseconds wall;
+  std::chrono::nanoseconds wall{};
   auto check = origin;
+  const auto cpu_less = [descending = opts.descending](const T &a, const T &b) { return (descending ? b < a : a < b); };
 
-  if (!skip_std_sort) {
+  if (!opts.skip_std_sort) {
     auto wall_start = std::chrono::high_resolution_clock::now();
-    CPU_SORT(check.begin(), check.end());
+    if (segmented_sorter) {
+      for (std::size_t i = 0; i + 1 < offsets.size(); ++i)
+        CPU_SORT(check.begin() + offsets[i], check.begin() + offsets[i + 1], cpu_less);
+    } else {
+      for (auto first = check.begin(); first != check.end(); first += size)
+        CPU_SORT(first, first + size, cpu_less);
+    }
     auto wall_end = std::chrono::high_resolution_clock::now();
-    wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    wall = wall_end - wall_start;
   }
 
   clutils::profiling_info prof_info;
-  auto vec = origin;
+  clutils::profiling_report report;
+  report.field("kernel", kernel_name).field("type", clutils::type_name<T>::name_str).field("length", size);
+  if (opts.batches) report.field("batches", batch_count);
+  if (!opts.skip_std_sort) report.field("cpu_sort", CPU_SORT_NAME).total("cpu_sort", wall);
+
+  if (opts.batches) {
+    std::vector<std::span<T>> batches;
+    for (unsigned i = 0; i < batch_count; ++i)
+      batches.push_back(data.subspan(i * size, size));
+
+    clutils::batch_profiling_info batch_info;
+    gpu_sorter->sort_many(batches, &batch_info, opts.depth);
+
+    if (!opts.skip_std_sort) std::cout << CPU_SORT_NAME << " wall time: " << clutils::to_milliseconds(wall) << " ms\n";
+
+    std::cout << "bitonic wall time: " << clutils::to_milliseconds(batch_info.wall) << " ms\n";
+    std::cout << "bitonic pure time: " << clutils::to_milliseconds(batch_info.pure) << " ms\n";
+    std::cout << "upload: " << clutils::to_milliseconds(batch_info.upload)
+              << " ms, kernels: " << clutils::to_milliseconds(batch_info.kernels)
+              << " ms, download: " << clutils::to_milliseconds(batch_info.download) << " ms\n";
+    std::cout << "overlap: " << batch_info.overlap * 100 << "%\n";
+    report.add(batch_info);
+  } else {
+    if (segmented_sorter) {
+      segmented_sorter->sort_segments(data, offsets, &prof_info);
+    } else if (opts.runs) {
+      merge_sorter->merge_runs(data, offsets, &prof_info);
+    } else {
+      sorter->sort(data, &prof_info);
+    }
+
+    if (!opts.skip_std_sort) std::cout << CPU_SORT_NAME << " wall time: " << clutils::to_milliseconds(wall) << " ms\n";
+
+    std::cout << "bitonic wall time: " << clutils::to_milliseconds(prof_info.wall) << " ms\n";
+    std::cout << "bitonic pure time: " << clutils::to_milliseconds(prof_info.pure) << " ms\n";
+    if (!prof_info.commands.empty()) {
+      using clutils::command_kind;
+      std::cout << "upload: " << clutils::to_milliseconds(prof_info.total(command_kind::upload))
+                << " ms, kernels: " << clutils::to_milliseconds(prof_info.total(command_kind::kernel))
+                << " ms, download: " << clutils::to_milliseconds(prof_info.total(command_kind::download))
+                << " ms, gaps: " << clutils::to_milliseconds(prof_info.gaps()) << " ms\n";
+    }
+    report.add(prof_info);
+    if (hybrid_sorter) std::cout << "GPU share for the next run: " << hybrid_sorter->gpu_share() * 100 << "%\n";
+  }
 
-  sorter->sort(vec, &prof_info);
+  print_sep();
 
-  if (!skip_std_sort) std::cout << CPU_SORT_NAME << " wall time: " << wall.count() << " ms\n";
+  if (opts.report) report.save(*opts.report);
 
-  std::cout << "bitonic wall time: " << prof_info.wall.count() << " ms\n";
-  std::cout << "bitonic pure time: " << prof_info.pure.count() << " ms\n";
+  if (opts.skip_std_sort) return EXIT_SUCCESS;
+  return validate_results(origin, data, check, opts.print_on_failure);
+}
 
-  print_sep();
+int main(int argc, char **argv) try {
+  popl::OptionParser op("Avaliable options");
+  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
+  auto print_option = op.add<popl::Switch>("p", "print", "Print on failure");
+  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip comparing with std::sort");
+  auto zero_copy_option = op.add<popl::Switch>("z", "zero-copy", "Sort pinned host memory without staging copies");
+  auto argsort_option = op.add<popl::Switch>("a", "argsort", "Compute the sorting permutation with key-value kernels");
+  auto descending_option = op.add<popl::Switch>(
+      "d", "descending", "Sort in descending order with the cpu, naive, local, register or segmented kernel");
+  auto autotune_option = op.add<popl::Switch>(
+      "", "autotune", "Benchmark local/register kernel configurations and store the best one as the default");
+
+  auto type_option = op.add<popl::Implicit<std::string>>(
+      "t", "type", std::string{"Element type: "} + clutils::supported_type_names, STRINGIFY(TYPE__));
+  auto input_option =
+      op.add<popl::Value<std::string>>("i", "input", "Sort a raw little-endian binary file of the element type");
+  auto output_option = op.add<popl::Value<std::string>>("o", "output", "Write the sorted array to a raw binary file");
+  auto report_option = op.add<popl::Value<std::string>>(
+      "", "report", "Write timings of every device command to a JSON file, CSV if the name ends with .csv");
+
+  auto lower_option = op.add<popl::Value<std::string>>("", "lower", "Lower bound, the minimum of the type by default");
+  auto upper_option = op.add<popl::Value<std::string>>("", "upper", "Upper bound, the maximum of the type by default");
+
+  auto num_option = op.add<popl::Implicit<unsigned>>("", "num", "Length of the array to sort = 2^n", 24);
+  auto len_option =
+      op.add<popl::Value<std::size_t>>("", "len", "Arbitrary length of the array to sort, overrides --num");
+  auto kernel_option = op.add<popl::Implicit<std::string>>(
+      "", "kernel",
+      "Which kernel to use: naive, cpu, cpu-simd, cpu-par, hybrid, multi, out-of-core, local, register, segmented, "
+      "radix, merge",
+      "naive");
+  auto lsz_option = op.add<popl::Implicit<unsigned>>("", "lsz", "Local memory size", 256);
+  auto threads_option =
+      op.add<popl::Implicit<unsigned>>("", "threads", "Worker threads of the CPU kernels, 0 = hardware concurrency", 0);
+  auto gpu_share_option =
+      op.add<popl::Implicit<double>>("", "gpu-share", "Initial share of the array sorted on the GPU by hybrid", 0.5);
+  auto devices_option =
+      op.add<popl::Implicit<unsigned>>("", "devices", "Number of GPUs used by the multi kernel, 0 = all", 0);
+  auto chunk_option = op.add<popl::Implicit<std::size_t>>(
+      "", "chunk", "Elements per device chunk of the out-of-core kernel, 0 = as many as fit", 0);
+  auto fuse_option =
+      op.add<popl::Implicit<unsigned>>("", "fuse", "Maximum number of global steps fused into one launch", 4);
+  auto ept_option =
+      op.add<popl::Implicit<unsigned>>("", "ept", "Elements per thread kept in registers by the register kernel", 8);
+  auto seglen_option = op.add<popl::Value<unsigned>>(
+      "", "seglen", "Split the array into random segments of up to this length for the segmented kernel (= lsz)");
+  auto runs_option = op.add<popl::Value<unsigned>>(
+      "", "runs", "Split the array into this many sorted runs of random lengths and merge them with the merge kernel");
+  auto topk_option = op.add<popl::Value<std::size_t>>(
+      "", "top-k", "Select this many smallest elements of random keys with the local kernel instead of sorting");
+  auto batches_option =
+      op.add<popl::Value<unsigned>>("b", "batches", "Sort this many independent arrays through the batch pipeline");
+  auto depth_option = op.add<popl::Implicit<unsigned>>("", "depth", "Number of buffers in the batch pipeline", 3);
+
+  op.parse(argc, argv);
+
+  if (help_option->is_set()) {
+    std::cout << op << "\n ";
+    return EXIT_SUCCESS;
+  }
+
+  sort_options opts;
+  if (lower_option->is_set()) opts.lower = lower_option->value();
+  if (upper_option->is_set()) opts.upper = upper_option->value();
+  if (input_option->is_set()) opts.input = input_option->value();
+  if (output_option->is_set()) opts.output = output_option->value();
+  if (report_option->is_set()) opts.report = report_option->value();
+  if (batches_option->is_set()) opts.batches = batches_option->value();
+  if (seglen_option->is_set()) opts.seglen = seglen_option->value();
+  if (runs_option->is_set()) opts.runs = runs_option->value();
+  if (topk_option->is_set()) opts.top_k = topk_option->value();
+
+  opts.kernel_name = kernel_option->value();
+  opts.size = (len_option->is_set() ? len_option->value() : (std::size_t{1} << num_option->value()));
+  opts.length_set = len_option->is_set() || num_option->is_set();
+  opts.lsz = lsz_option->value();
+  opts.threads = threads_option->value();
+  opts.devices = devices_option->value();
+  opts.fuse = fuse_option->value();
+  opts.ept = ept_option->value();
+  opts.depth = depth_option->value();
+  opts.chunk = chunk_option->value();
+  opts.gpu_share = gpu_share_option->value();
+  opts.skip_std_sort = skip_option->is_set();
+  opts.print_on_failure = print_option->is_set();
+  opts.zero_copy = zero_copy_option->is_set();
+  opts.descending = descending_option->is_set();
+  opts.autotune = autotune_option->is_set();
+  opts.lsz_set = lsz_option->is_set();
+  opts.fuse_set = fuse_option->is_set();
+  opts.ept_set = ept_option->is_set();
+
+  const auto &kernel_name = opts.kernel_name;
+
+  if (opts.batches && !*opts.batches) {
+    std::cout << "Error: number of batches must be positive\n";
+    return EXIT_FAILURE;
+  }
+
+  // The output is truncated before the input is copied into it, so the same file would lose its data
+  std::error_code same_file_error;
+  if (opts.input && opts.output && std::filesystem::equivalent(*opts.input, *opts.output, same_file_error)) {
+    std::cout << "Error: --input and --output name the same file, write the result to a different one\n";
+    return EXIT_FAILURE;
+  }
+
+  const bool ordered = (kernel_name == "cpu" || kernel_name == "naive" || kernel_name == "local" ||
+                        kernel_name == "register" || kernel_name == "segmented");
+  if (opts.descending && (!ordered || opts.top_k || argsort_option->is_set())) {
+    std::cout << "Error: descending order is supported by the cpu, naive, local, register and segmented kernels, "
+                 "without --top-k and --argsort\n";
+    return EXIT_FAILURE;
+  }
+
+  if (opts.top_k) {
+    if (kernel_name != "local" || argsort_option->is_set() || opts.batches || opts.input || opts.output) {
+      std::cout << "Error: top-k selects from random keys with the local kernel, without --argsort, --batches, "
+                   "--input and --output\n";
+      return EXIT_FAILURE;
+    }
+
+    if (opts.size > bitonic::max_network_size) {
+      std::cout << "Error: top-k is limited to 2^31 elements\n";
+      return EXIT_FAILURE;
+    }
+
+    return clutils::dispatch_type(type_option->value(), [&opts](auto type) {
+      return run_topk<typename decltype(type)::type>(opts);
+    });
+  }
+
+  if (argsort_option->is_set()) {
+    if (opts.input || opts.output) {
+      std::cout << "Error: argsort works on random keys, --input and --output can't be used with it\n";
+      return EXIT_FAILURE;
+    }
+
+    if (opts.size > bitonic::max_network_size) {
+      std::cout << "Error: argsort is limited to 2^31 elements\n";
+      return EXIT_FAILURE;
+    }
+
+    return clutils::dispatch_type(type_option->value(), [&opts](auto type) {
+      return run_argsort<typename decltype(type)::type>(opts);
+    });
+  }
+
+  const bool local_based = (kernel_name == "local" || kernel_name == "register" || kernel_name == "segmented" ||
+                            kernel_name == "hybrid" || kernel_name == "multi" || kernel_name == "out-of-core" ||
+                            kernel_name == "merge");
+  // Local size of "segmented" is its maximum segment length and "multi" runs on several devices, neither is tuned
+  opts.tunable = (kernel_name == "local" || kernel_name == "register" || kernel_name == "hybrid" ||
+                  kernel_name == "out-of-core");
+  if (!opts.tunable && opts.autotune) {
+    std::cout << "Warning: kernel used has no tuned parameters, ignoring --autotune option\n";
+  }
+
+  if (!local_based && lsz_option->is_set()) {
+    std::cout << "Warning: local size provided but kernel used is not \"local\", ignoring --lsz option\n";
+  }
+
+  if ((!local_based || kernel_name == "segmented" || kernel_name == "merge") && fuse_option->is_set()) {
+    std::cout << "Warning: kernel used does not have fused global steps, ignoring --fuse option\n";
+  }
+
+  const bool uses_pool = (kernel_name == "cpu-par" || kernel_name == "hybrid" || kernel_name == "multi" ||
+                          kernel_name == "out-of-core");
+  if (!uses_pool && threads_option->is_set()) {
+    std::cout << "Warning: kernel used does not run on the thread pool, ignoring --threads option\n";
+  }
+
+  if (kernel_name != "out-of-core" && chunk_option->is_set()) {
+    std::cout << "Warning: kernel used is not \"out-of-core\", ignoring --chunk option\n";
+  }
+
+  if (kernel_name != "multi" && devices_option->is_set()) {
+    std::cout << "Warning: kernel used is not \"multi\", ignoring --devices option\n";
+  }
+
+  if (kernel_name != "hybrid" && gpu_share_option->is_set()) {
+    std::cout << "Warning: kernel used is not \"hybrid\", ignoring --gpu-share option\n";
+  }
+
+  if (kernel_name != "register" && ept_option->is_set()) {
+    std::cout << "Warning: elements per thread provided but kernel used is not \"register\", ignoring --ept option\n";
+  }
 
-  if (skip_std_sort) return EXIT_SUCCESS;
-  return validate_results(origin, vec, check, print_on_failure);
+  // Kernels are built for the chosen type at runtime, the TYPE build option only sets the default
+  return clutils::dispatch_type(type_option->value(),
+                                [&opts](auto type) { return run_sort<typename decltype(type)::type>(opts); });
 
 } catch (cl::BuildError &e) {
   std::cerr << "Compilation failed:\n";
@@ -0,0 +1,128 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace clutils {
+
+struct pool_stats {
+  unsigned hits = 0, misses = 0;
+};
+
+// Grow-only cache of device buffers. Requests are rounded up to a size class (4 classes per power of two, so at most
+// 25% of the allocation is wasted) and buffers return to the pool when their lease is destroyed. Memory is only given
+// back to the driver on trim(). The pool must outlive all of its leases.
+class buffer_pool {
+public:
+  using size_type = std::size_t;
+  static constexpr size_type min_class_size = 4096;
+
+private:
+  using key_type = std::pair<cl_mem_flags, size_type>;
+
+  cl::Context m_ctx;
+  std::map<key_type, std::vector<cl::Buffer>> m_free;
+  pool_stats m_stats;
+  mutable std::mutex m_mutex;
+
+  void put_back(key_type key, cl::Buffer buf) {
+    std::lock_guard lock{m_mutex};
+    m_free[key].push_back(std::move(buf));
+  }
+
+public:
+  class lease {
+    buffer_pool *m_pool = nullptr;
+    key_type m_key;
+    cl::Buffer m_buf;
+
+  public:
+    lease() = default;
+    lease(buffer_pool &pool, key_type key, cl::Buffer buf) : m_pool{&pool}, m_key{key}, m_buf{std::move(buf)} {}
+
+    lease(const lease &) = delete;
+    lease &operator=(const lease &) = delete;
+
+    lease(lease &&rhs) noexcept
+        : m_pool{std::exchange(rhs.m_pool, nullptr)}, m_key{rhs.m_key}, m_buf{std::move(rhs.m_buf)} {}
+
+    lease &operator=(lease &&rhs) noexcept {
+      std::swap(m_pool, rhs.m_pool);
+      std::swap(m_key, rhs.m_key);
+      std::swap(m_buf, rhs.m_buf);
+      return *this;
+    }
+
+    ~lease() {
+      if (m_pool) m_pool->put_back(m_key, std::move(m_buf));
+    }
+
+    cl::Buffer &buffer() { return m_buf; }
+    const cl::Buffer &buffer() const { return m_buf; }
+    size_type capacity() const { return m_key.second; }
+  };
+
+  buffer_pool(cl::Context ctx) : m_ctx{ctx} {}
+
+  static size_type size_class(size_type size) {
+    if (size <= min_class_size) return min_class_size;
+    const size_type granularity = std::bit_floor(size - 1) / 4;
+    return (size + granularity - 1) / granularity * granularity;
+  }
+
+  lease acquire(size_type size, cl_mem_flags flags = CL_MEM_READ_WRITE) {
+    const key_type key = {flags, size_class(size)};
+
+    {
+      std::lock_guard lock{m_mutex};
+      auto found = m_free.find(key);
+      if (found != m_free.end() && !found->second.empty()) {
+        auto buf = std::move(found->second.back());
+        found->second.pop_back();
+        ++m_stats.hits;
+        return lease{*this, key, std::move(buf)};
+      }
+      ++m_stats.misses;
+    }
+
+    return lease{*this, key, cl::Buffer{m_ctx, flags, key.second}};
+  }
+
+  // Release all cached buffers that are not currently leased. Buffers still referenced elsewhere, e.g. as arguments
+  // of kernel objects, are only freed with the last reference.
+  void trim() {
+    std::lock_guard lock{m_mutex};
+    m_free.clear();
+  }
+
+  size_type cached_bytes() const {
+    std::lock_guard lock{m_mutex};
+    size_type total = 0;
+    for (const auto &[key, buffers] : m_free)
+      total += key.second * buffers.size();
+    return total;
+  }
+
+  pool_stats stats() const {
+    std::lock_guard lock{m_mutex};
+    return m_stats;
+  }
+};
+
+} // namespace clutils
@@ -0,0 +1,154 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+#include "selector.hpp"
+#include "utils.hpp"
+
+#include <array>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace clutils {
+
+// Chain of kernel launches recorded once and submitted again as a whole. Every launch keeps its own cl::Kernel with
+// the arguments already set, so a replay skips setting arguments and building launch configurations. On devices with
+// cl_khr_command_buffer the chain is also finalized into a command-buffer, which is submitted with a single call.
+// Kernel arguments are captured when the launch is added: buffers must stay the same for every replay.
+class launch_recording {
+  struct launch {
+    std::string name;
+    cl::Kernel kernel;
+    cl::NDRange global, local;
+  };
+
+  cl::CommandQueue m_queue;
+  std::vector<launch> m_launches;
+  bool m_in_order = true;
+
+#ifdef cl_khr_command_buffer
+  struct command_buffer_api {
+    clCreateCommandBufferKHR_fn create = nullptr;
+    clCommandNDRangeKernelKHR_fn ndrange = nullptr;
+    clFinalizeCommandBufferKHR_fn finalize = nullptr;
+    clEnqueueCommandBufferKHR_fn enqueue = nullptr;
+    clReleaseCommandBufferKHR_fn release = nullptr;
+  };
+
+  std::shared_ptr<std::remove_pointer_t<cl_command_buffer_khr>> m_command_buffer;
+  command_buffer_api m_api;
+  cl::Event m_last_replay; // A command-buffer can't be enqueued again while it is pending
+
+  template <typename F> static F load(cl_platform_id platform, const char *name) {
+    return reinterpret_cast<F>(clGetExtensionFunctionAddressForPlatform(platform, name));
+  }
+
+  // Record the chain into a command-buffer, leave m_command_buffer empty if the driver can't do it for this queue
+  void build_command_buffer() {
+    const auto device = m_queue.getInfo<CL_QUEUE_DEVICE>();
+    const std::array<std::string, 1> required = {"cl_khr_command_buffer"};
+    if (!device_supports_extensions(device, required.begin(), required.end()).first) return;
+
+    const auto platform = device.getInfo<CL_DEVICE_PLATFORM>();
+    m_api = {load<clCreateCommandBufferKHR_fn>(platform, "clCreateCommandBufferKHR"),
+             load<clCommandNDRangeKernelKHR_fn>(platform, "clCommandNDRangeKernelKHR"),
+             load<clFinalizeCommandBufferKHR_fn>(platform, "clFinalizeCommandBufferKHR"),
+             load<clEnqueueCommandBufferKHR_fn>(platform, "clEnqueueCommandBufferKHR"),
+             load<clReleaseCommandBufferKHR_fn>(platform, "clReleaseCommandBufferKHR")};
+    if (!m_api.create || !m_api.ndrange || !m_api.finalize || !m_api.enqueue || !m_api.release) return;
+
+    // Some drivers don't support every queue property, e.g. profiling, in command-buffers
+    cl_int err = CL_SUCCESS;
+    cl_command_queue queue = m_queue();
+    cl_command_buffer_khr raw = m_api.create(1, &queue, nullptr, &err);
+    if (err != CL_SUCCESS || !raw) return;
+    std::shared_ptr<std::remove_pointer_t<cl_command_buffer_khr>> command_buffer{
+        raw, [release = m_api.release](cl_command_buffer_khr buffer) { release(buffer); }};
+
+    // Sync points order the commands, a command-buffer is not in-order by itself
+    cl_sync_point_khr prev = 0;
+    for (std::size_t i = 0; i < m_launches.size(); ++i) {
+      const auto &l = m_launches[i];
+      const auto *local = (l.local.dimensions() ? static_cast<const std::size_t *>(l.local) : nullptr);
+      cl_sync_point_khr sync_point = 0;
+      err = m_api.ndrange(raw, nullptr, nullptr, l.kernel(), l.global.dimensions(), nullptr,
+                          static_cast<const std::size_t *>(l.global), local, (i ? 1 : 0), (i ? &prev : nullptr),
+                          &sync_point, nullptr);
+      if (err != CL_SUCCESS) return;
+      prev = sync_point;
+    }
+
+    if (m_api.finalize(raw) != CL_SUCCESS) return;
+    m_command_buffer = std::move(command_buffer);
+  }
+
+  bool replay_command_buffer(std::vector<profiled_event> &events) {
+    if (!m_command_buffer) return false;
+    if (m_last_replay() && m_last_replay.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) return false;
+
+    cl_event raw = nullptr;
+    if (m_api.enqueue(0, nullptr, m_command_buffer.get(), 0, nullptr, &raw) != CL_SUCCESS) return false;
+    m_last_replay = cl::Event{raw};
+    events.push_back({"command buffer", command_kind::kernel, m_last_replay});
+    return true;
+  }
+#else
+  void build_command_buffer() {}
+  bool replay_command_buffer(std::vector<profiled_event> &) { return false; }
+#endif
+
+public:
+  launch_recording(cl::CommandQueue queue)
+      : m_queue{std::move(queue)},
+        m_in_order{!(m_queue.getInfo<CL_QUEUE_PROPERTIES>() & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)} {}
+
+  // Append a launch, it runs after all launches added before it
+  void add(std::string name, cl::Kernel kernel, cl::NDRange global, cl::NDRange local = cl::NullRange) {
+    m_launches.push_back({std::move(name), std::move(kernel), global, local});
+  }
+
+  // Call once after the last add()
+  void finalize() { build_command_buffer(); }
+
+  bool empty() const { return m_launches.empty(); }
+  std::size_t size() const { return m_launches.size(); }
+
+#ifdef cl_khr_command_buffer
+  bool uses_command_buffer() const { return static_cast<bool>(m_command_buffer); }
+#else
+  bool uses_command_buffer() const { return false; }
+#endif
+
+  // Submit the whole chain, returns the events of the submitted commands in order
+  std::vector<profiled_event> enqueue() {
+    std::vector<profiled_event> events;
+    if (replay_command_buffer(events)) return events;
+
+    // In-order queues already serialize the launches, out-of-order ones wait for the previous launch
+    events.reserve(m_launches.size());
+    std::vector<cl::Event> prev;
+    for (auto &l : m_launches) {
+      cl::Event event;
+      m_queue.enqueueNDRangeKernel(l.kernel, cl::NullRange, l.global, l.local, (prev.empty() ? nullptr : &prev),
+                                   &event);
+      if (!m_in_order) prev.assign(1, event);
+      events.push_back({l.name, command_kind::kernel, std::move(event)});
+    }
+
+    return events;
+  }
+};
+
+} // namespace clutils
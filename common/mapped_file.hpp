@@ -0,0 +1,175 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace clutils {
+
+// File mapped into the address space, so its pages can be handed to the device transfers (or wrapped with
+// CL_MEM_USE_HOST_PTR in zero-copy mode) without reading the file into a separate buffer first.
+// read: the file is mapped copy-on-write, the contents can be modified in memory but the file stays untouched.
+// read_write: modifications are written back to the file.
+// create: the file is created or truncated to the requested size and mapped like read_write.
+class mapped_file {
+public:
+  enum class mode { read, read_write, create };
+
+private:
+  std::byte *m_data = nullptr;
+  std::size_t m_size = 0;
+
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE, m_mapping = nullptr;
+
+  [[noreturn]] static void fail(const std::string &what) {
+    throw std::system_error{static_cast<int>(GetLastError()), std::system_category(), what};
+  }
+
+  void open(const std::string &path, mode open_mode, std::size_t size) {
+    const bool writable = (open_mode != mode::read);
+    m_file = CreateFileA(path.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr,
+                         (open_mode == mode::create ? CREATE_ALWAYS : OPEN_EXISTING), FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) fail("Can't open " + path);
+
+    if (open_mode == mode::create) {
+      m_size = size;
+    } else {
+      LARGE_INTEGER file_size;
+      if (!GetFileSizeEx(m_file, &file_size)) fail("Can't get the size of " + path);
+      m_size = static_cast<std::size_t>(file_size.QuadPart);
+    }
+    if (!m_size) return; // Empty files can't be mapped
+
+    const auto size_high = static_cast<DWORD>(static_cast<unsigned long long>(m_size) >> 32),
+               size_low = static_cast<DWORD>(m_size & 0xffffffffu);
+    m_mapping = CreateFileMappingA(m_file, nullptr, (writable ? PAGE_READWRITE : PAGE_WRITECOPY), size_high, size_low,
+                                   nullptr);
+    if (!m_mapping) fail("Can't map " + path);
+
+    m_data = static_cast<std::byte *>(MapViewOfFile(m_mapping, (writable ? FILE_MAP_WRITE : FILE_MAP_COPY), 0, 0, 0));
+    if (!m_data) fail("Can't map " + path);
+  }
+
+  void close() noexcept {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+  }
+
+  void swap_handles(mapped_file &rhs) noexcept {
+    std::swap(m_file, rhs.m_file);
+    std::swap(m_mapping, rhs.m_mapping);
+  }
+
+#else
+  int m_fd = -1;
+
+  [[noreturn]] static void fail(const std::string &what) {
+    throw std::system_error{errno, std::generic_category(), what};
+  }
+
+  void open(const std::string &path, mode open_mode, std::size_t size) {
+    const bool writable = (open_mode != mode::read);
+    const int flags = (writable ? O_RDWR : O_RDONLY) | (open_mode == mode::create ? O_CREAT | O_TRUNC : 0);
+    m_fd = ::open(path.c_str(), flags, 0644);
+    if (m_fd < 0) fail("Can't open " + path);
+
+    if (open_mode == mode::create) {
+      if (::ftruncate(m_fd, static_cast<off_t>(size))) fail("Can't resize " + path);
+      m_size = size;
+    } else {
+      struct stat file_stat;
+      if (::fstat(m_fd, &file_stat)) fail("Can't get the size of " + path);
+      m_size = static_cast<std::size_t>(file_stat.st_size);
+    }
+    if (!m_size) return; // Empty files can't be mapped
+
+    void *data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, (writable ? MAP_SHARED : MAP_PRIVATE), m_fd, 0);
+    if (data == MAP_FAILED) fail("Can't map " + path);
+    m_data = static_cast<std::byte *>(data);
+
+    // The file is streamed front to back by the transfers
+    ::madvise(m_data, m_size, MADV_SEQUENTIAL);
+  }
+
+  void close() noexcept {
+    if (m_data) ::munmap(m_data, m_size);
+    if (m_fd >= 0) ::close(m_fd);
+    m_data = nullptr;
+    m_fd = -1;
+  }
+
+  void swap_handles(mapped_file &rhs) noexcept { std::swap(m_fd, rhs.m_fd); }
+#endif
+
+public:
+  mapped_file() = default;
+
+  // size is only used by mode::create
+  mapped_file(const std::string &path, mode open_mode, std::size_t size = 0) {
+    try {
+      open(path, open_mode, size);
+    } catch (...) {
+      close();
+      throw;
+    }
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  mapped_file(mapped_file &&rhs) noexcept { swap(rhs); }
+  mapped_file &operator=(mapped_file &&rhs) noexcept {
+    swap(rhs);
+    return *this;
+  }
+
+  ~mapped_file() { close(); }
+
+  void swap(mapped_file &rhs) noexcept {
+    std::swap(m_data, rhs.m_data);
+    std::swap(m_size, rhs.m_size);
+    swap_handles(rhs);
+  }
+
+  std::size_t size() const { return m_size; }
+  std::span<std::byte> bytes() const { return {m_data, m_size}; }
+
+  // Contents as an array of T, the file must hold a whole number of elements
+  template <typename T> std::span<T> as() const {
+    if (m_size % sizeof(T)) throw std::invalid_argument{"File size is not a multiple of the element size"};
+    return {reinterpret_cast<T *>(m_data), m_size / sizeof(T)};
+  }
+};
+
+} // namespace clutils
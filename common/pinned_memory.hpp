@@ -0,0 +1,141 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace clutils {
+
+// copy: device buffers are filled with an ordinary host->device copy (default).
+// zero_copy: host memory is handed to the driver directly. Memory from pinned_allocator on a discrete device is
+// transferred with DMA, anything else is wrapped with CL_MEM_USE_HOST_PTR and synchronised through map/unmap.
+enum class host_memory_mode { copy, zero_copy };
+
+// Host allocations the device can access without an intermediate staging copy. On devices sharing memory with the host
+// these are page aligned host pages (suitable for zero-copy CL_MEM_USE_HOST_PTR buffers), on discrete devices they are
+// CL_MEM_ALLOC_HOST_PTR buffers that stay mapped for as long as the host owns them, i.e. pinned memory.
+class pinned_memory_resource {
+public:
+  static constexpr std::size_t page_size = 4096;
+
+private:
+  struct allocation {
+    cl::Buffer buffer; // Empty for page aligned host allocations
+    std::size_t size;
+  };
+
+  cl::Context m_ctx;
+  cl::CommandQueue m_queue;
+  bool m_unified_memory;
+
+  std::map<std::uintptr_t, allocation> m_allocations;
+  mutable std::mutex m_mutex;
+
+public:
+  pinned_memory_resource(cl::Context ctx, cl::CommandQueue queue, bool unified_memory)
+      : m_ctx{ctx}, m_queue{queue}, m_unified_memory{unified_memory} {}
+
+  pinned_memory_resource(const pinned_memory_resource &) = delete;
+  pinned_memory_resource &operator=(const pinned_memory_resource &) = delete;
+
+  ~pinned_memory_resource() {
+    for (auto &[address, alloc] : m_allocations)
+      release(reinterpret_cast<void *>(address), alloc);
+  }
+
+  void *allocate(std::size_t size) {
+    void *ptr;
+    allocation alloc = {{}, size};
+
+    if (m_unified_memory) {
+      alloc.size = (size + page_size - 1) / page_size * page_size;
+      ptr = ::operator new(alloc.size, std::align_val_t{page_size});
+    } else {
+      alloc.buffer = cl::Buffer{m_ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size};
+      ptr = m_queue.enqueueMapBuffer(alloc.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+    }
+
+    std::lock_guard lock{m_mutex};
+    m_allocations.emplace(reinterpret_cast<std::uintptr_t>(ptr), std::move(alloc));
+    return ptr;
+  }
+
+  void deallocate(void *ptr) {
+    allocation alloc;
+
+    {
+      std::lock_guard lock{m_mutex};
+      auto found = m_allocations.find(reinterpret_cast<std::uintptr_t>(ptr));
+      if (found == m_allocations.end()) throw std::invalid_argument{"Pointer was not allocated by this resource"};
+      alloc = std::move(found->second);
+      m_allocations.erase(found);
+    }
+
+    release(ptr, alloc);
+  }
+
+  // Whether [ptr, ptr + size) lies entirely inside one of the allocations
+  bool contains(const void *ptr, std::size_t size) const {
+    const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+    std::lock_guard lock{m_mutex};
+
+    auto found = m_allocations.upper_bound(address);
+    if (found == m_allocations.begin()) return false;
+    --found;
+    return address + size <= found->first + found->second.size;
+  }
+
+  bool unified_memory() const { return m_unified_memory; }
+
+private:
+  void release(void *ptr, allocation &alloc) {
+    if (alloc.buffer()) {
+      m_queue.enqueueUnmapMemObject(alloc.buffer, ptr);
+      return;
+    }
+
+    ::operator delete(ptr, std::align_val_t{page_size});
+  }
+};
+
+template <typename T> class pinned_allocator {
+  template <typename U> friend class pinned_allocator;
+  std::shared_ptr<pinned_memory_resource> m_resource;
+
+public:
+  using value_type = T;
+
+  pinned_allocator(std::shared_ptr<pinned_memory_resource> resource) : m_resource{std::move(resource)} {}
+  template <typename U> pinned_allocator(const pinned_allocator<U> &rhs) : m_resource{rhs.m_resource} {}
+
+  T *allocate(std::size_t n) { return static_cast<T *>(m_resource->allocate(n * sizeof(T))); }
+  void deallocate(T *ptr, std::size_t) { m_resource->deallocate(ptr); }
+
+  template <typename U> bool operator==(const pinned_allocator<U> &rhs) const {
+    return m_resource == rhs.m_resource;
+  }
+
+  const std::shared_ptr<pinned_memory_resource> &resource() const { return m_resource; }
+};
+
+template <typename T> using pinned_vector = std::vector<T, pinned_allocator<T>>;
+
+} // namespace clutils
@@ -0,0 +1,147 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "utils.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace clutils {
+
+// Description of a run and its timings in nanoseconds, written as JSON or as CSV with one row per total and command.
+// CSV rows repeat the description fields, so reports of several runs can simply be concatenated.
+class profiling_report {
+  struct value {
+    std::string json, csv;
+  };
+
+  std::vector<std::pair<std::string, value>> m_fields;
+  std::vector<std::pair<std::string, std::chrono::nanoseconds>> m_totals;
+  std::vector<command_timing> m_commands;
+
+  static std::string json_string(const std::string &str) {
+    std::string result = "\"";
+    for (char c : str) {
+      if (c == '"' || c == '\\') {
+        result += '\\';
+        result += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char escaped[8];
+        std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+        result += escaped;
+      } else {
+        result += c;
+      }
+    }
+    return result + '"';
+  }
+
+  static std::string csv_string(const std::string &str) {
+    if (str.find_first_of(",\"\n") == std::string::npos) return str;
+    std::string result = "\"";
+    for (char c : str)
+      result += (c == '"' ? std::string{"\"\""} : std::string{c});
+    return result + '"';
+  }
+
+public:
+  profiling_report &field(const std::string &name, const std::string &str) {
+    m_fields.push_back({name, {json_string(str), csv_string(str)}});
+    return *this;
+  }
+
+  profiling_report &field(const std::string &name, const char *str) { return field(name, std::string{str}); }
+
+  template <typename T>
+    requires std::is_arithmetic_v<T>
+  profiling_report &field(const std::string &name, T number) {
+    std::stringstream ss;
+    ss << number;
+    m_fields.push_back({name, {ss.str(), ss.str()}});
+    return *this;
+  }
+
+  profiling_report &total(const std::string &name, std::chrono::nanoseconds duration) {
+    m_totals.push_back({name, duration});
+    return *this;
+  }
+
+  profiling_report &add(const profiling_info &info) {
+    total("wall", info.wall).total("pure", info.pure);
+    if (info.commands.empty()) return *this;
+
+    total("upload", info.total(command_kind::upload)).total("kernels", info.total(command_kind::kernel));
+    total("download", info.total(command_kind::download)).total("gaps", info.gaps());
+    m_commands.insert(m_commands.end(), info.commands.begin(), info.commands.end());
+    return *this;
+  }
+
+  profiling_report &add(const batch_profiling_info &info) {
+    total("wall", info.wall).total("pure", info.pure).total("upload", info.upload);
+    total("kernels", info.kernels).total("download", info.download);
+    return field("overlap", info.overlap);
+  }
+
+  void write_json(std::ostream &os) const {
+    os << "{\n";
+    for (const auto &[name, val] : m_fields)
+      os << "  " << json_string(name) << ": " << val.json << ",\n";
+
+    os << "  \"totals_ns\": {";
+    for (std::size_t i = 0; i < m_totals.size(); ++i)
+      os << (i ? ", " : "") << json_string(m_totals[i].first) << ": " << m_totals[i].second.count();
+    os << "},\n";
+
+    os << "  \"commands\": [";
+    for (std::size_t i = 0; i < m_commands.size(); ++i) {
+      const auto &c = m_commands[i];
+      os << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(c.name) << ", \"kind\": \""
+         << command_kind_name(c.kind) << "\", \"start_ns\": " << c.start.count() << ", \"end_ns\": " << c.end.count()
+         << "}";
+    }
+    os << (m_commands.empty() ? "]\n" : "\n  ]\n") << "}\n";
+  }
+
+  void write_csv(std::ostream &os, bool header = true) const {
+    std::string prefix;
+    for (const auto &[name, val] : m_fields) {
+      if (header) os << csv_string(name) << ",";
+      prefix += val.csv + ",";
+    }
+    if (header) os << "name,kind,start_ns,end_ns,duration_ns\n";
+
+    for (const auto &[name, duration] : m_totals)
+      os << prefix << csv_string(name) << ",total,,," << duration.count() << "\n";
+    for (const auto &c : m_commands)
+      os << prefix << csv_string(c.name) << "," << command_kind_name(c.kind) << "," << c.start.count() << ","
+         << c.end.count() << "," << c.duration().count() << "\n";
+  }
+
+  // CSV for paths ending with .csv, JSON otherwise
+  void save(const std::filesystem::path &path) const {
+    std::ofstream os{path, std::ios::trunc};
+    if (path.extension() == ".csv") write_csv(os);
+    else write_json(os);
+    if (!os) throw std::runtime_error{"Can't write the profiling report to " + path.string()};
+  }
+};
+
+} // namespace clutils
@@ -0,0 +1,184 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace clutils {
+
+struct program_cache_stats {
+  std::size_t memory_hits = 0, disk_hits = 0, builds = 0;
+};
+
+inline std::optional<std::filesystem::path> default_program_cache_directory() {
+  if (auto base = default_cache_directory()) return *base / "programs";
+  return std::nullopt;
+}
+
+// Programs of one device of a context built on first use and kept by their full source, macro definitions included.
+// Kernels specialised for the same type and parameters share the build, e.g. the last global steps of local and
+// register sorters, so JIT compilation for a type picked at runtime is paid once per context.
+// With a cache directory the device binaries (CL_PROGRAM_BINARIES) are also stored on disk, keyed by the device name,
+// the driver version and the source. Later runs create the program from the binary and skip the compiler. Binaries
+// rejected by the driver, e.g. after an update that kept the version string, are rebuilt from source and replaced.
+class program_cache {
+  cl::Context m_ctx;
+  cl::Device m_device;
+  std::optional<std::filesystem::path> m_directory;
+  std::string m_device_key; // Device name and driver version
+
+  std::map<std::string, cl::Program> m_programs;
+  program_cache_stats m_stats;
+  mutable std::mutex m_mutex;
+
+  static constexpr std::uint64_t file_magic = 0x31656863616370; // "pcache1"
+
+  // 64-bit FNV-1a, only used to name the files, the full key is stored and compared on load
+  static std::uint64_t hash(const std::string &str) {
+    std::uint64_t value = 0xcbf29ce484222325;
+    for (unsigned char c : str)
+      value = (value ^ c) * 0x100000001b3;
+    return value;
+  }
+
+  std::filesystem::path file_path(const std::string &key) const {
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash(key) << ".bin";
+    return *m_directory / ss.str();
+  }
+
+  static void write_block(std::ostream &os, const void *data, std::uint64_t size) {
+    os.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    os.write(static_cast<const char *>(data), size);
+  }
+
+  static bool read_block(std::istream &is, auto &block) {
+    std::uint64_t size;
+    if (!is.read(reinterpret_cast<char *>(&size), sizeof(size)) || size > (std::uint64_t{1} << 32)) return false;
+    block.resize(size);
+    return static_cast<bool>(is.read(reinterpret_cast<char *>(block.data()), size));
+  }
+
+  std::optional<cl::Program> load(const std::string &key) const {
+    std::ifstream is{file_path(key), std::ios::binary};
+    if (!is) return std::nullopt;
+
+    std::uint64_t magic;
+    std::string stored_key;
+    std::vector<unsigned char> binary;
+    if (!is.read(reinterpret_cast<char *>(&magic), sizeof(magic)) || magic != file_magic) return std::nullopt;
+    if (!read_block(is, stored_key) || stored_key != key || !read_block(is, binary)) return std::nullopt;
+
+    try {
+      cl::Program program{m_ctx, {m_device}, cl::Program::Binaries{binary}};
+      program.build({m_device});
+      return program;
+    } catch (cl::Error &) {
+      return std::nullopt;
+    }
+  }
+
+  // Written to a temporary file and renamed, so concurrent processes never read a partial binary. Failures only
+  // cost the next run a rebuild.
+  void store(const std::string &key, const cl::Program &program) const {
+    // Binaries come in the order of the program devices, only the one of m_device is built
+    const auto devices = program.getInfo<CL_PROGRAM_DEVICES>();
+    const auto binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+    const auto found = std::find_if(devices.begin(), devices.end(), [&](auto &d) { return d() == m_device(); });
+    if (found == devices.end() || binaries.size() != devices.size()) return;
+    const auto &binary = binaries[found - devices.begin()];
+    if (binary.empty()) return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(*m_directory, ec);
+    if (ec) return;
+
+    const auto path = file_path(key);
+    auto temp_path = path;
+    temp_path += ".tmp" + std::to_string(std::random_device{}());
+
+    {
+      std::ofstream os{temp_path, std::ios::binary | std::ios::trunc};
+      os.write(reinterpret_cast<const char *>(&file_magic), sizeof(file_magic));
+      write_block(os, key.data(), key.size());
+      write_block(os, binary.data(), binary.size());
+      if (!os) {
+        os.close();
+        std::filesystem::remove(temp_path, ec);
+        return;
+      }
+    }
+
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) std::filesystem::remove(temp_path, ec);
+  }
+
+public:
+  // Programs are built for device only, which has to belong to ctx
+  program_cache(cl::Context ctx, cl::Device device,
+                std::optional<std::filesystem::path> directory = default_program_cache_directory())
+      : m_ctx{std::move(ctx)}, m_device{std::move(device)}, m_directory{std::move(directory)} {
+    m_device_key = m_device.getInfo<CL_DEVICE_NAME>() + '\n' + m_device.getInfo<CL_DRIVER_VERSION>() + '\n';
+  }
+
+  cl::Program get(const std::string &source) {
+    std::lock_guard lock{m_mutex};
+    if (auto found = m_programs.find(source); found != m_programs.end()) {
+      ++m_stats.memory_hits;
+      return found->second;
+    }
+
+    const auto key = m_device_key + source;
+    std::optional<cl::Program> program;
+    if (m_directory && (program = load(key))) {
+      ++m_stats.disk_hits;
+    } else {
+      program.emplace(m_ctx, source);
+      program->build({m_device});
+      ++m_stats.builds;
+      if (m_directory) store(key, *program);
+    }
+
+    m_programs.emplace(source, *program);
+    return *program;
+  }
+
+  std::size_t size() const {
+    std::lock_guard lock{m_mutex};
+    return m_programs.size();
+  }
+
+  program_cache_stats stats() const {
+    std::lock_guard lock{m_mutex};
+    return m_stats;
+  }
+
+  const std::optional<std::filesystem::path> &directory() const { return m_directory; }
+};
+
+} // namespace clutils
@@ -0,0 +1,67 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+namespace clutils {
+
+// Conversions between fp32 and the 16-bit formats, rounding to nearest even like the device does
+
+inline cl_half float_to_half(float value) {
+  const auto bits = std::bit_cast<std::uint32_t>(value);
+  const std::uint32_t sign = (bits >> 16) & 0x8000, abs = bits & 0x7fffffff;
+
+  if (abs > 0x7f800000) return sign | 0x7e00;  // NaN
+  if (abs >= 0x477ff000) return sign | 0x7c00; // Rounds beyond 65504
+
+  // Normal halves: rebias the exponent, carries of the rounding move into it
+  if (abs >= 0x38800000) {
+    const std::uint32_t rebiased = abs - 0x38000000;
+    return sign | ((rebiased + 0x0fff + ((rebiased >> 13) & 1)) >> 13);
+  }
+
+  // Subnormal halves count units of 2^-24, anything below half of one is zero
+  const std::uint32_t exponent = abs >> 23;
+  if (exponent < 102) return sign;
+
+  const std::uint32_t mantissa = (abs & 0x7fffff) | 0x800000, shift = 126 - exponent;
+  const std::uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+  std::uint32_t result = mantissa >> shift;
+  if (rest > halfway || (rest == halfway && (result & 1))) ++result;
+  return sign | result;
+}
+
+inline float half_to_float(cl_half value) {
+  const std::uint32_t sign = std::uint32_t{value & 0x8000u} << 16, exponent = (value >> 10) & 0x1f,
+                      mantissa = value & 0x3ff;
+
+  if (exponent == 0x1f) return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+  if (exponent) return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+
+  const float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+  return (sign ? -magnitude : magnitude);
+}
+
+// bfloat16 is the upper half of an fp32
+inline cl_ushort float_to_bfloat16(float value) {
+  const auto bits = std::bit_cast<std::uint32_t>(value);
+  if ((bits & 0x7fffffff) > 0x7f800000) return (bits >> 16) | 0x40; // Keep NaNs quiet
+  return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+inline float bfloat16_to_float(cl_ushort value) { return std::bit_cast<float>(std::uint32_t{value} << 16); }
+
+} // namespace clutils
@@ -0,0 +1,76 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+#include "program_cache.hpp"
+#include "selector.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+namespace clutils {
+
+// Device, context, profiling queue and program cache shared by the sorters and multipliers constructed from it, so
+// creating several of them doesn't repeat device selection, context creation and kernel builds. A context and queue
+// owned by the application can be injected to run the kernels inside its own pipeline.
+class runtime {
+  cl::Device m_device;
+  cl::Context m_ctx;
+  cl::CommandQueue m_queue;
+  std::shared_ptr<program_cache> m_programs;
+
+public:
+  explicit runtime(const platform_selector &selector)
+      : m_device{selector.device()}, m_ctx{m_device}, m_queue{m_ctx, cl::QueueProperties::Profiling},
+        m_programs{std::make_shared<program_cache>(m_ctx, m_device)} {}
+
+  explicit runtime(cl::Device device) : runtime{platform_selector{std::move(device)}} {}
+
+  // The queue has to belong to ctx and have profiling enabled, the timings are taken from its events. It also has to be
+  // in-order: the kernels and transfers enqueued on it rely on the queue ordering instead of events.
+  runtime(cl::Context ctx, cl::CommandQueue queue)
+      : m_device{queue.getInfo<CL_QUEUE_DEVICE>()}, m_ctx{std::move(ctx)}, m_queue{std::move(queue)} {
+    if (m_queue.getInfo<CL_QUEUE_CONTEXT>()() != m_ctx())
+      throw std::invalid_argument{"Command queue must belong to the given context"};
+    const auto properties = m_queue.getInfo<CL_QUEUE_PROPERTIES>();
+    if (!(properties & CL_QUEUE_PROFILING_ENABLE))
+      throw std::invalid_argument{"Command queue must be created with profiling enabled"};
+    if (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+      throw std::invalid_argument{"Command queue must execute commands in order"};
+    m_programs = std::make_shared<program_cache>(m_ctx, m_device);
+  }
+
+  const cl::Device &device() const { return m_device; }
+  const cl::Context &context() const { return m_ctx; }
+  const cl::CommandQueue &queue() const { return m_queue; }
+  const std::shared_ptr<program_cache> &programs() const { return m_programs; }
+};
+
+// Runtime on the first device fitting min_ver, shared by everyone asking for the same version while any of them is
+// alive. Default constructed sorters and multipliers use it, so the platforms are enumerated once.
+inline std::shared_ptr<runtime> shared_runtime(platform_version min_ver) {
+  static std::mutex mutex;
+  static std::map<std::pair<int, int>, std::weak_ptr<runtime>> runtimes;
+
+  std::lock_guard lock{mutex};
+  auto &cached = runtimes[{min_ver.major, min_ver.minor}];
+  if (auto existing = cached.lock()) return existing;
+
+  auto created = std::make_shared<runtime>(platform_selector{min_ver});
+  cached = created;
+  return created;
+}
+
+} // namespace clutils
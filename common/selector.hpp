@@ -21,6 +21,7 @@
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <vector>
 
 namespace clutils {
 
@@ -88,6 +89,38 @@ inline support_result device_supports_extensions(cl::Device device, auto ext_sta
   return std::make_pair(missing_extensions.empty(), missing_extensions);
 }
 
+// CL_DEVICE_HOST_UNIFIED_MEMORY is deprecated since OpenCL 2.0, but it is still the only portable way to tell an
+// integrated GPU from a discrete one, so query it without the C++ bindings' typed getInfo
+inline bool device_has_unified_memory(const cl::Device &device) {
+  cl_bool unified = CL_FALSE;
+  device.getInfo(CL_DEVICE_HOST_UNIFIED_MEMORY, &unified);
+  return unified == CL_TRUE;
+}
+
+inline bool platform_fits(const cl::Platform &platform, platform_version min_ver) {
+  return decode_platform_version(platform.getInfo<CL_PLATFORM_VERSION>()).ver >= min_ver;
+}
+
+// All GPUs of all platforms fitting the requirements, unlike platform_selector which stops at the first one
+inline std::vector<cl::Device> select_devices(
+    platform_version min_ver, std::function<bool(cl::Platform)> platform_pred = [](auto) { return true; },
+    std::function<bool(cl::Device)> device_pred = [](auto) { return true; }) {
+  std::vector<cl::Platform> platforms;
+  cl::Platform::get(&platforms);
+
+  std::vector<cl::Device> selected;
+  for (const auto &platform : platforms) {
+    if (!platform_fits(platform, min_ver) || !platform_pred(platform)) continue;
+
+    std::vector<cl::Device> devices;
+    platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+    std::copy_if(devices.begin(), devices.end(), std::back_inserter(selected), device_pred);
+  }
+
+  if (selected.empty()) throw std::runtime_error{"No suitable OpenCL device found"};
+  return selected;
+}
+
 class platform_selector {
 protected:
   cl::Platform m_platform;
@@ -133,6 +166,15 @@ public:
     if (chosen_platform == suitable_platforms.end()) throw std::runtime_error{"No suitable OpenCL device found"};
     m_platform = *chosen_platform;
   }
+
+  // Use a device that was already chosen, e.g. one of select_devices()
+  explicit platform_selector(cl::Device device)
+      : m_platform{device.getInfo<CL_DEVICE_PLATFORM>()}, m_device{std::move(device)} {
+    std::cout << "Info: Using device: " << m_device.getInfo<CL_DEVICE_NAME>() << "\n";
+  }
+
+  const cl::Platform &platform() const { return m_platform; }
+  const cl::Device &device() const { return m_device; }
 };
 
 }; // namespace clutils
\ No newline at end of file
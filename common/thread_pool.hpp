@@ -0,0 +1,181 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace clutils {
+
+// Persistent pool of worker threads. Every worker owns a task deque: it pops its own tasks from the back and steals
+// from the front of the other deques when it runs dry. Threads blocked in parallel_for() execute tasks as well, so
+// nested parallel_for() calls don't deadlock.
+class thread_pool {
+  using task_type = std::function<void()>;
+
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<task_type> tasks;
+  };
+
+  std::vector<std::unique_ptr<worker_queue>> m_queues;
+  std::vector<std::thread> m_threads;
+
+  // Queued tasks, guarded by m_sleep_mutex. Counted before a task becomes visible and uncounted after it is taken,
+  // so it never drops below the number of queued tasks.
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_wake_up;
+  std::size_t m_pending = 0;
+  bool m_stop = false;
+
+  std::atomic<std::size_t> m_next_queue = 0;
+
+  static inline thread_local const thread_pool *t_owner = nullptr;
+  static inline thread_local std::size_t t_index = 0;
+
+  void push(task_type task) {
+    const auto index = (t_owner == this ? t_index : m_next_queue++ % m_queues.size());
+
+    {
+      std::lock_guard lock{m_sleep_mutex};
+      ++m_pending;
+    }
+
+    {
+      std::lock_guard lock{m_queues[index]->mutex};
+      m_queues[index]->tasks.push_back(std::move(task));
+    }
+
+    m_wake_up.notify_one();
+  }
+
+  // Called with a queue mutex held, push() never holds m_sleep_mutex while taking a queue mutex
+  void task_taken() {
+    std::lock_guard lock{m_sleep_mutex};
+    --m_pending;
+  }
+
+  bool try_pop(std::size_t index, task_type &task) {
+    {
+      auto &own = *m_queues[index];
+      std::lock_guard lock{own.mutex};
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        task_taken();
+        return true;
+      }
+    }
+
+    for (std::size_t i = 1; i < m_queues.size(); ++i) {
+      auto &victim = *m_queues[(index + i) % m_queues.size()];
+      std::lock_guard lock{victim.mutex};
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        task_taken();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void worker_loop(std::size_t index) {
+    t_owner = this;
+    t_index = index;
+
+    task_type task;
+    while (true) {
+      if (try_pop(index, task)) {
+        task();
+        continue;
+      }
+
+      std::unique_lock lock{m_sleep_mutex};
+      m_wake_up.wait(lock, [this] { return m_stop || m_pending > 0; });
+      if (m_stop) return;
+    }
+  }
+
+public:
+  explicit thread_pool(unsigned threads = std::thread::hardware_concurrency()) {
+    threads = std::max(threads, 1u);
+    for (unsigned i = 0; i < threads; ++i)
+      m_queues.push_back(std::make_unique<worker_queue>());
+    for (unsigned i = 0; i < threads; ++i)
+      m_threads.emplace_back([this, i] { worker_loop(i); });
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  ~thread_pool() {
+    {
+      std::lock_guard lock{m_sleep_mutex};
+      m_stop = true;
+    }
+
+    m_wake_up.notify_all();
+    for (auto &thread : m_threads)
+      thread.join();
+  }
+
+  unsigned size() const { return m_threads.size(); }
+
+  // Call func(chunk_begin, chunk_end) for consecutive chunks of at most grain indices covering [begin, end) and wait
+  // for all of them. The first exception thrown by a chunk is rethrown here.
+  template <typename F> void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F func) {
+    if (begin >= end) return;
+    grain = std::max<std::size_t>(grain, 1);
+
+    const std::size_t chunks = (end - begin + grain - 1) / grain;
+    std::atomic<std::size_t> remaining = chunks;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    const auto run_chunk = [&](std::size_t chunk) {
+      const auto chunk_begin = begin + chunk * grain, chunk_end = std::min(end, chunk_begin + grain);
+      try {
+        func(chunk_begin, chunk_end);
+      } catch (...) {
+        std::lock_guard lock{error_mutex};
+        if (!error) error = std::current_exception();
+      }
+      --remaining;
+    };
+
+    for (std::size_t chunk = 1; chunk < chunks; ++chunk)
+      push([&run_chunk, chunk] { run_chunk(chunk); });
+    run_chunk(0);
+
+    // Help with the queued work instead of blocking
+    const auto index = (t_owner == this ? t_index : 0);
+    task_type task;
+    while (remaining > 0) {
+      if (try_pop(index, task)) task();
+      else std::this_thread::yield();
+    }
+
+    if (error) std::rethrow_exception(error);
+  }
+};
+
+} // namespace clutils
@@ -0,0 +1,141 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+#include "utils.hpp"
+
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace clutils {
+
+inline std::optional<std::filesystem::path> default_tuning_file() {
+  if (auto base = default_cache_directory()) return *base / "tuning.txt";
+  return std::nullopt;
+}
+
+// Space separated name=value pairs of unsigned parameters, e.g. "lsz=2048 fuse=4"
+class tuning_params {
+  std::map<std::string, unsigned> m_values;
+
+public:
+  tuning_params() = default;
+
+  explicit tuning_params(std::string_view str) {
+    std::istringstream is{std::string{str}};
+    for (std::string pair; is >> pair;) {
+      const auto eq = pair.find('=');
+      unsigned value;
+      if (eq == std::string::npos) continue;
+      if (std::from_chars(pair.data() + eq + 1, pair.data() + pair.size(), value).ec != std::errc{}) continue;
+      m_values[pair.substr(0, eq)] = value;
+    }
+  }
+
+  tuning_params &set(const std::string &name, unsigned value) {
+    m_values[name] = value;
+    return *this;
+  }
+
+  std::optional<unsigned> get(const std::string &name) const {
+    if (auto found = m_values.find(name); found != m_values.end()) return found->second;
+    return std::nullopt;
+  }
+
+  std::string str() const {
+    std::string result;
+    for (const auto &[name, value] : m_values)
+      result += (result.empty() ? "" : " ") + name + "=" + std::to_string(value);
+    return result;
+  }
+};
+
+// Best parameters found by the autotuners, one line per device, kernel and element type. The file is plain text so it
+// can be inspected and edited by hand.
+class tuning_store {
+  std::optional<std::filesystem::path> m_path;
+  std::map<std::string, std::string> m_entries, m_updated;
+
+  static std::map<std::string, std::string> read(const std::filesystem::path &path) {
+    std::map<std::string, std::string> entries;
+    std::ifstream is{path};
+    for (std::string line; std::getline(is, line);) {
+      const auto tab = line.find('\t');
+      if (tab != std::string::npos) entries[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+    return entries;
+  }
+
+public:
+  explicit tuning_store(std::optional<std::filesystem::path> path = default_tuning_file()) : m_path{std::move(path)} {
+    if (m_path) m_entries = read(*m_path);
+  }
+
+  // Tuned parameters depend on the device, its driver, the kernel and the element type
+  static std::string key(const cl::Device &device, const std::string &kernel, const std::string &type) {
+    return device.getInfo<CL_DEVICE_NAME>() + " / " + device.getInfo<CL_DRIVER_VERSION>() + " / " + kernel + " / " +
+           type;
+  }
+
+  std::optional<tuning_params> find(const std::string &key) const {
+    if (auto found = m_entries.find(key); found != m_entries.end()) return tuning_params{found->second};
+    return std::nullopt;
+  }
+
+  void set(const std::string &key, const tuning_params &params) { m_entries[key] = m_updated[key] = params.str(); }
+
+  // Entries set here are merged into the current contents of the file, so tuning runs for other kernels in the
+  // meantime are kept. The file is written to a temporary name and renamed, readers see the old or the new contents.
+  void save() {
+    if (!m_path) return;
+
+    m_entries = read(*m_path);
+    for (const auto &[key, value] : m_updated)
+      m_entries[key] = value;
+
+    std::error_code ec;
+    if (m_path->has_parent_path()) std::filesystem::create_directories(m_path->parent_path(), ec);
+
+    auto temp_path = *m_path;
+    temp_path += ".tmp" + std::to_string(std::random_device{}());
+    {
+      std::ofstream os{temp_path, std::ios::trunc};
+      for (const auto &[key, value] : m_entries)
+        os << key << '\t' << value << '\n';
+      if (!os) {
+        os.close();
+        std::filesystem::remove(temp_path, ec);
+        throw std::runtime_error{"Can't write tuning results to " + m_path->string()};
+      }
+    }
+
+    std::filesystem::rename(temp_path, *m_path, ec);
+    if (ec) {
+      std::filesystem::remove(temp_path, ec);
+      throw std::runtime_error{"Can't write tuning results to " + m_path->string()};
+    }
+  }
+
+  const std::optional<std::filesystem::path> &path() const { return m_path; }
+};
+
+} // namespace clutils
@@ -0,0 +1,56 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "opencl_include.hpp"
+
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+namespace clutils {
+
+// OpenCL C spelling of a host element type, substituted for the TYPE macro of the kernels
+template <typename T> struct type_name {};
+template <> struct type_name<cl_int> { static constexpr const char *name_str = "int"; };
+template <> struct type_name<cl_uint> { static constexpr const char *name_str = "uint"; };
+template <> struct type_name<cl_long> { static constexpr const char *name_str = "long"; };
+template <> struct type_name<cl_ulong> { static constexpr const char *name_str = "ulong"; };
+template <> struct type_name<cl_float> { static constexpr const char *name_str = "float"; };
+template <> struct type_name<cl_double> { static constexpr const char *name_str = "double"; };
+
+inline constexpr const char *supported_type_names = "int, uint, long, ulong, float, double";
+
+// Call func with std::type_identity<T>{} for the element type spelled as name, so a single template instantiated for
+// every supported type can be picked at runtime. Double requires cl_khr_fp64 on the device.
+template <typename F> decltype(auto) dispatch_type(std::string_view name, F &&func) {
+  if (name == type_name<cl_int>::name_str) return func(std::type_identity<cl_int>{});
+  if (name == type_name<cl_uint>::name_str) return func(std::type_identity<cl_uint>{});
+  if (name == type_name<cl_long>::name_str) return func(std::type_identity<cl_long>{});
+  if (name == type_name<cl_ulong>::name_str) return func(std::type_identity<cl_ulong>{});
+  if (name == type_name<cl_float>::name_str) return func(std::type_identity<cl_float>{});
+  if (name == type_name<cl_double>::name_str) return func(std::type_identity<cl_double>{});
+  throw std::invalid_argument{"Unknown element type " + std::string{name} + ", supported: " + supported_type_names};
+}
+
+// Parse a command line value of a type only known after dispatch_type
+template <typename T> T from_string(std::string_view str) {
+  T value;
+  const auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (ec != std::errc{} || end != str.data() + str.size())
+    throw std::invalid_argument{"Can't parse " + std::string{str} + " as " + type_name<T>::name_str};
+  return value;
+}
+
+} // namespace clutils
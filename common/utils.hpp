@@ -12,7 +12,12 @@
 
 #include "opencl_include.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <optional>
 #include <random>
 #include <sstream>
 #include <string>
@@ -49,8 +54,102 @@ template <class T> inline std::size_t sizeof_container(const T &container) {
   return sizeof(typename T::value_type) * container.size();
 }
 
+enum class command_kind { upload, kernel, download };
+
+inline const char *command_kind_name(command_kind kind) {
+  switch (kind) {
+  case command_kind::upload: return "upload";
+  case command_kind::kernel: return "kernel";
+  case command_kind::download: return "download";
+  }
+  return "unknown";
+}
+
+// Device command of a profiled call, kept until the call is done and its timestamps are available
+struct profiled_event {
+  std::string name;
+  command_kind kind;
+  cl::Event event;
+};
+
+// Device time of one command relative to the start of the first command of the call
+struct command_timing {
+  std::string name;
+  command_kind kind;
+  std::chrono::nanoseconds start, end;
+
+  std::chrono::nanoseconds duration() const { return end - start; }
+};
+
 struct profiling_info {
-  std::chrono::milliseconds pure, wall;
+  std::chrono::nanoseconds pure{}, wall{}; // Device time from the first to the last kernel, host time of the call
+  unsigned pool_hits = 0, pool_misses = 0; // Device buffer pool statistics for this call
+  std::vector<command_timing> commands;    // Device commands in submission order, empty for sorters on the host
+
+  std::chrono::nanoseconds total(command_kind kind) const {
+    std::chrono::nanoseconds sum{};
+    for (const auto &command : commands)
+      if (command.kind == kind) sum += command.duration();
+    return sum;
+  }
+
+  // Time the device spent between commands, e.g. on launch overhead and host synchronisation
+  std::chrono::nanoseconds gaps() const {
+    std::chrono::nanoseconds sum{}, last_end = std::chrono::nanoseconds::min();
+    for (const auto &command : commands) {
+      if (last_end != std::chrono::nanoseconds::min() && command.start > last_end) sum += command.start - last_end;
+      last_end = std::max(last_end, command.end);
+    }
+    return sum;
+  }
 };
 
+// Timestamps of finished commands, empty events are skipped. All events have to come from profiling queues.
+inline std::vector<command_timing> collect_timings(const std::vector<profiled_event> &events) {
+  using ns = std::chrono::nanoseconds;
+  std::vector<command_timing> timings;
+  ns origin = ns::max();
+
+  for (const auto &e : events) {
+    if (!e.event()) continue;
+    const ns start{e.event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        end{e.event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+    timings.push_back({e.name, e.kind, start, end});
+    origin = std::min(origin, start);
+  }
+
+  for (auto &timing : timings) {
+    timing.start -= origin;
+    timing.end -= origin;
+  }
+  return timings;
+}
+
+struct batch_profiling_info {
+  std::chrono::nanoseconds upload{}, kernels{}, download{}; // Device time spent in each stage, summed over all batches
+  std::chrono::nanoseconds pure{}, wall{}; // Device time from the first upload to the last download, host time
+  double overlap = 0; // Share of the serialised stage time hidden by running stages concurrently
+};
+
+// Durations are kept in nanoseconds and printed in fractional milliseconds
+inline double to_milliseconds(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double, std::milli>{duration}.count();
+}
+
+// Base directory of files kept between runs (program binaries, tuned parameters): $CLUTILS_CACHE_DIR if set, an empty
+// value disables them, otherwise the user's cache directory
+inline std::optional<std::filesystem::path> default_cache_directory() {
+  if (const char *dir = std::getenv("CLUTILS_CACHE_DIR")) {
+    if (!*dir) return std::nullopt;
+    return std::filesystem::path{dir};
+  }
+#ifdef _WIN32
+  if (const char *local = std::getenv("LOCALAPPDATA")) return std::filesystem::path{local} / "clutils";
+#else
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) return std::filesystem::path{xdg} / "clutils";
+  if (const char *home = std::getenv("HOME")) return std::filesystem::path{home} / ".cache" / "clutils";
+#endif
+  return std::nullopt;
+}
+
 } // namespace clutils
\ No newline at end of file
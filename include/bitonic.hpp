@@ -10,57 +10,104 @@
 
 #pragma once
 
+#include "buffer_pool.hpp"
+#include "launch_recording.hpp"
 #include "opencl_include.hpp"
+#include "pinned_memory.hpp"
+#include "program_cache.hpp"
+#include "runtime.hpp"
 #include "selector.hpp"
+#include "type_name.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <bit>
 #include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
+#include <numeric>
+#include <optional>
 #include <span>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "kernelhpp/bitonic_fused_kernel.hpp"
 #include "kernelhpp/bitonic_local_initial_kernel.hpp"
+#include "kernelhpp/bitonic_local_initial_kv_kernel.hpp"
+#include "kernelhpp/bitonic_local_register_kernel.hpp"
 #include "kernelhpp/bitonic_naive_kernel.hpp"
+#include "kernelhpp/bitonic_naive_kv_kernel.hpp"
+#include "kernelhpp/bitonic_segmented_kernel.hpp"
 
 namespace bitonic {
 
 template <typename T> struct i_bitonic_sort {
-  using size_type = unsigned;
+  using size_type = std::size_t;
   void sort(std::span<T> container, clutils::profiling_info *time = nullptr) { return operator()(container, time); }
   virtual void operator()(std::span<T>, clutils::profiling_info *) = 0;
   virtual ~i_bitonic_sort() {}
 };
 
-template <typename T> struct cpu_bitonic_sort : public i_bitonic_sort<T> {
+// Value used to pad sequences up to a power of two in host memory. Ties with real elements don't matter, the padding
+// always ends up behind them.
+template <typename T> constexpr T padding_value() {
+  if constexpr (std::numeric_limits<T>::has_infinity) return std::numeric_limits<T>::infinity();
+  else return std::numeric_limits<T>::max();
+}
+
+// Order the network kernels are built for. less is an OpenCL C expression of two elements a and b that defines a
+// strict weak order, e.g. "fabs(a) < fabs(b)". descending reverses it without any runtime branches in the kernels.
+struct sort_order {
+  std::string less = "a < b";
+  bool descending = false;
+};
+
+template <typename T, typename Compare = std::less<T>> struct cpu_bitonic_sort : public i_bitonic_sort<T> {
   using typename i_bitonic_sort<T>::size_type;
 
+  Compare compare;
+
+  cpu_bitonic_sort(Compare comp = {}) : compare{std::move(comp)} {}
+
   void operator()(std::span<T> container, clutils::profiling_info *info) override {
-    size_type size = container.size();
-    if (std::popcount(size) != 1 || size < 2) throw std::runtime_error{"Only power-of-two sequences are supported"};
+    const size_type size = container.size();
+    if (size < 2) {
+      if (info) *info = {};
+      return;
+    }
 
-    const auto execute_step = [container, size](size_type stage, size_type step) {
-      const size_type part_length = 1 << (step + 1);
+    // Sort as if the sequence was padded up to the next power of two with elements that compare after every real
+    // element. Padding elements never move, so comparisons against them are simply skipped.
+    const size_type padded_size = std::bit_ceil(size);
+
+    const auto execute_step = [this, container, size, padded_size](size_type stage, size_type step) {
+      const size_type part_length = size_type{1} << (step + 1);
 
       const auto calc_j = [stage, step, part_length](auto i) -> size_type {
         if (stage == step) return part_length - i - 1;
         return i + part_length / 2;
       };
 
-      for (size_type k = 0; k < size / part_length; ++k) {
+      for (size_type k = 0; k < padded_size / part_length; ++k) {
         for (size_type i = 0; i < part_length / 2; ++i) {
-          const auto j = calc_j(i);
+          const auto second_index = k * part_length + calc_j(i);
+          if (second_index >= size) continue;
           auto &first = container[k * part_length + i];
-          auto &second = container[k * part_length + j];
-          if (first > second) std::swap(first, second);
+          auto &second = container[second_index];
+          if (compare(second, first)) std::swap(first, second);
         }
       }
     };
 
     const auto wall_start = std::chrono::high_resolution_clock::now();
 
-    size_type stages = std::countr_zero(size);
+    size_type stages = std::countr_zero(padded_size);
     for (size_type stage = 0; stage < stages; ++stage) {
       for (size_type temp = 0, step = stage; temp <= stage; step = stage - (++temp)) {
         execute_step(stage, step);
@@ -69,95 +116,597 @@ template <typename T> struct cpu_bitonic_sort : public i_bitonic_sort<T> {
 
     const auto wall_end = std::chrono::high_resolution_clock::now();
 
-    if (info) info->wall = info->pure = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    if (info) {
+      *info = {};
+      info->wall = info->pure = wall_end - wall_start;
+    }
   }
 };
 
-template <typename T> class gpu_bitonic : public i_bitonic_sort<T>, protected clutils::platform_selector {
+struct kernel_events {
+  cl::Event first, last;
+  std::vector<clutils::profiled_event> all; // Every launch in submission order, for the profiling breakdown
+
+  cl::Event record(std::string name, cl::Event event) {
+    all.push_back({std::move(name), clutils::command_kind::kernel, event});
+    return event;
+  }
+};
+
+inline std::string step_name(const char *kernel, unsigned stage, unsigned step) {
+  return std::string{kernel} + " " + std::to_string(stage) + "/" + std::to_string(step);
+}
+
+// Longest sequence the network can sort: it is padded to bit_ceil(size) and the kernels index it with 32-bit uint
+inline constexpr std::size_t max_network_size = std::size_t{1} << 31;
+
+// Number of compare-exchange pairs of a step that touch at least one real element when the sequence is padded up to
+// the next power of two with elements ordered after every real one. Work-item gid handles the pair starting at
+// (gid / half) * part + gid % half, which grows monotonically with gid, so the trailing work-items that only see
+// padding are not launched at all.
+inline unsigned active_pairs(unsigned size, unsigned step) {
+  const unsigned half_length = 1u << step, part_length = half_length * 2;
+  return (size / part_length) * half_length + std::min(size % part_length, half_length);
+}
+
+// Same for fused launches: every work-item handles a group of 2^steps elements spaced by 2^step_lo.
+inline unsigned active_groups(unsigned size, unsigned step_lo, unsigned steps) {
+  const unsigned stride = 1u << step_lo, span = stride << steps;
+  return (size / span) * stride + std::min(size % span, stride);
+}
+
+// Local kernels work on whole segments, so only segments containing real elements are launched.
+inline unsigned active_segments(unsigned size, unsigned segment_size) {
+  return (size + segment_size - 1) / segment_size;
+}
+
+// Enqueue every step of the network as a separate global memory kernel. launch_step(args, stage, step) enqueues one
+// step with the given launch configuration and returns its event.
+template <typename F> kernel_events enqueue_naive_network(cl::CommandQueue &queue, unsigned size, F launch_step) {
+  const unsigned stages = std::countr_zero(std::bit_ceil(size));
+  kernel_events events;
+  cl::Event prev_event, first_event;
+
+  auto submit = [&, first_iter = true](auto stage, auto step) mutable {
+    const auto global_size = active_pairs(size, step);
+
+    if (first_iter) {
+      const auto args = cl::EnqueueArgs{queue, global_size};
+      first_event = prev_event = events.record(step_name("global step", stage, step), launch_step(args, stage, step));
+      first_iter = false;
+      return;
+    }
+
+    const auto args = cl::EnqueueArgs{queue, prev_event, global_size};
+    prev_event = events.record(step_name("global step", stage, step), launch_step(args, stage, step));
+  };
+
+  for (unsigned stage = 0; stage < stages; ++stage) {
+    for (int step = stage; step >= 0; --step) {
+      submit(stage, step);
+    }
+  }
+
+  events.first = first_event;
+  events.last = prev_event;
+  return events;
+}
+
+// Enqueue the network with local memory kernels doing all steps that fit into a segment of local_size elements.
+// launch_local(args, stage_start, stage_end, step_offset) runs the local kernel, launch_step(args, stage, step) runs a
+// single global memory step for strides that exceed the segment. Up to max_fused_steps consecutive non-flip global
+// steps are merged into one launch_fused(args, step_lo, steps) call. Every work-item of the local kernel owns
+// elems_per_item elements of its segment.
+template <typename F, typename G, typename H>
+kernel_events enqueue_local_network(cl::CommandQueue &queue, unsigned size, unsigned local_size, F launch_local,
+                                    G launch_step, H launch_fused, unsigned max_fused_steps,
+                                    unsigned elems_per_item = 2) {
+  const unsigned stages = std::countr_zero(std::bit_ceil(size)), initial_stages = std::countr_zero(local_size);
+  const unsigned group_size = local_size / elems_per_item;
+  // Sequences shorter than the segment are handled by a single partially filled work-group
+  const unsigned local_global_size = active_segments(size, local_size) * group_size;
+
+  kernel_events events;
+  cl::Event prev_event, first_event;
+  const auto initial_end_stage = std::min(initial_stages, stages);
+
+  auto enqueue_initial = [&]() {
+    auto args = cl::EnqueueArgs{queue, local_global_size, group_size};
+    first_event = prev_event = events.record("local initial", launch_local(args, 0, initial_end_stage, 0));
+  };
+
+  // Split the remaining global steps into launches, avoiding a lone unfused step at the end where possible
+  const auto fused_chunk = [max_fused_steps](unsigned remaining) {
+    if (remaining <= max_fused_steps) return remaining;
+    if (remaining == max_fused_steps + 1 && max_fused_steps > 2) return max_fused_steps - 1;
+    return max_fused_steps;
+  };
+
+  auto enqueue_last = [&]() {
+    for (unsigned stage = initial_end_stage; stage < stages; ++stage) {
+      // The first step of these stages is a flip and always exceeds the segment
+      const auto flip_args = cl::EnqueueArgs{queue, prev_event, active_pairs(size, stage)};
+      prev_event = events.record(step_name("global step", stage, stage), launch_step(flip_args, stage, stage));
+
+      int step = stage - 1;
+      while ((1u << (step + 1)) > local_size) {
+        const unsigned steps = fused_chunk(step - initial_stages + 1), step_lo = step - steps + 1;
+
+        if (steps == 1) {
+          const auto args = cl::EnqueueArgs{queue, prev_event, active_pairs(size, step)};
+          prev_event = events.record(step_name("global step", stage, step), launch_step(args, stage, step));
+        } else {
+          const auto args = cl::EnqueueArgs{queue, prev_event, active_groups(size, step_lo, steps)};
+          prev_event = events.record(step_name("fused steps", stage, step), launch_fused(args, step_lo, steps));
+        }
+
+        step = step_lo - 1;
+      }
+
+      const auto args = cl::EnqueueArgs{queue, local_global_size, group_size};
+      prev_event =
+          events.record(step_name("local merge", stage, step), launch_local(args, stage, stage + 1, stage - step));
+    }
+  };
+
+  enqueue_initial();
+  enqueue_last();
+  events.first = first_event;
+  events.last = prev_event;
+  return events;
+}
+
+template <typename F, typename G>
+kernel_events enqueue_local_network(cl::CommandQueue &queue, unsigned size, unsigned local_size, F launch_local,
+                                    G launch_step, unsigned elems_per_item = 2) {
+  const auto no_fused = [](const cl::EnqueueArgs &, unsigned, unsigned) { return cl::Event{}; };
+  return enqueue_local_network(queue, size, local_size, launch_local, launch_step, no_fused, 1, elems_per_item);
+}
+
+template <typename T> class gpu_bitonic;
+
+// Handle to a sort submitted with gpu_bitonic::sort_async. The container must not be touched by the host until wait()
+// returns. The handle keeps the device buffer alive and waits for completion on destruction, it must not outlive the
+// sorter that created it.
+template <typename T> class sort_handle {
+  friend class gpu_bitonic<T>;
+
+  std::span<T> m_container;
+  cl::CommandQueue m_queue;
+  clutils::buffer_pool::lease m_lease;
+  cl::Buffer m_host_buf; // Wraps host memory in zero_copy mode
+  void *m_mapped = nullptr;
+
+  cl::Event m_upload, m_first, m_last, m_done;
+  std::vector<clutils::profiled_event> m_events; // Transfers and launches for the profiling breakdown
+  std::chrono::high_resolution_clock::time_point m_wall_start, m_wall_end;
+  clutils::pool_stats m_pool_stats;
+  bool m_finished = true;
+
+  void finish() {
+    if (m_finished) return;
+    m_done.wait();
+    if (m_mapped) m_queue.enqueueUnmapMemObject(m_host_buf, m_mapped);
+    m_mapped = nullptr;
+    m_wall_end = std::chrono::high_resolution_clock::now();
+    m_finished = true;
+  }
+
+public:
+  sort_handle() = default;
+
+  sort_handle(const sort_handle &) = delete;
+  sort_handle &operator=(const sort_handle &) = delete;
+
+  sort_handle(sort_handle &&rhs) noexcept { swap(rhs); }
+  sort_handle &operator=(sort_handle &&rhs) noexcept {
+    swap(rhs);
+    return *this;
+  }
+
+  ~sort_handle() {
+    try {
+      finish();
+    } catch (...) {
+    }
+  }
+
+  void swap(sort_handle &rhs) noexcept {
+    std::swap(m_container, rhs.m_container);
+    std::swap(m_queue, rhs.m_queue);
+    std::swap(m_lease, rhs.m_lease);
+    std::swap(m_host_buf, rhs.m_host_buf);
+    std::swap(m_mapped, rhs.m_mapped);
+    std::swap(m_upload, rhs.m_upload);
+    std::swap(m_first, rhs.m_first);
+    std::swap(m_last, rhs.m_last);
+    std::swap(m_done, rhs.m_done);
+    std::swap(m_events, rhs.m_events);
+    std::swap(m_wall_start, rhs.m_wall_start);
+    std::swap(m_wall_end, rhs.m_wall_end);
+    std::swap(m_pool_stats, rhs.m_pool_stats);
+    std::swap(m_finished, rhs.m_finished);
+  }
+
+  // Event of the last command of the sort, pass it in a wait list to chain further work after the sort
+  const cl::Event &event() const { return m_done; }
+
+  bool ready() const { return m_finished || m_done.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE; }
+
+  // Block until the sorted data is back in the container. Wall time is measured from submission to the first wait().
+  void wait(clutils::profiling_info *time = nullptr) {
+    finish();
+    if (!time) return;
+
+    *time = {};
+    time->wall = m_wall_end - m_wall_start;
+    time->pool_hits = m_pool_stats.hits;
+    time->pool_misses = m_pool_stats.misses;
+    time->commands = clutils::collect_timings(m_events);
+    if (!m_first()) return;
+
+    const std::chrono::nanoseconds pure_start{m_first.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        pure_end{m_last.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+    time->pure = pure_end - pure_start;
+  }
+
+  // Device time from the start of the upload to the end of the read-back, which unlike the wall time does not depend
+  // on when the host got around to wait(). Only valid after wait().
+  std::chrono::nanoseconds device_time() const {
+    if (!m_upload()) return {};
+    const std::chrono::nanoseconds start{m_upload.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        end{m_done.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+    return end - start;
+  }
+};
+
+template <typename T> class gpu_bitonic : public i_bitonic_sort<T> {
 protected:
+  std::shared_ptr<clutils::runtime> m_runtime;
+  cl::Device m_device;
   cl::Context m_ctx;
-  cl::CommandQueue m_queue;
+  cl::CommandQueue m_queue, m_transfer_queue; // Kernels and host<->device copies of the batch pipeline
+  clutils::buffer_pool m_pool;
+  std::shared_ptr<clutils::program_cache> m_programs;
 
-  using typename i_bitonic_sort<T>::size_type;
+  std::shared_ptr<clutils::pinned_memory_resource> m_pinned;
+  clutils::host_memory_mode m_host_memory_mode = clutils::host_memory_mode::copy;
+
+  using size_type = unsigned; // Kernels index with 32-bit uint, longer sequences go through out_of_core_bitonic
+
+  // Kernels run on the queue of the runtime, the batch pipeline adds its own transfer queue in the same context
+  gpu_bitonic(std::shared_ptr<clutils::runtime> runtime = default_runtime())
+      : m_runtime{std::move(runtime)}, m_device{m_runtime->device()}, m_ctx{m_runtime->context()},
+        m_queue{m_runtime->queue()}, m_transfer_queue{m_ctx, m_device, cl::QueueProperties::Profiling}, m_pool{m_ctx},
+        m_programs{m_runtime->programs()},
+        m_pinned{std::make_shared<clutils::pinned_memory_resource>(m_ctx, m_queue,
+                                                                   clutils::device_has_unified_memory(m_device))} {}
+
+  // Enqueue the sorting network for the first size elements of buf on m_queue
+  virtual kernel_events enqueue_sort(cl::Buffer &buf, size_type size) = 0;
+
+  void check_fits(std::size_t length) const {
+    if (length > max_sort_size())
+      throw std::length_error{"Sequence does not fit into one device buffer, sort it with out_of_core_bitonic"};
+  }
+
+public:
   static constexpr clutils::platform_version cl_api_version = {2, 2};
 
-  gpu_bitonic()
-      : clutils::platform_selector{cl_api_version}, m_ctx{m_device}, m_queue{m_ctx, cl::QueueProperties::Profiling} {}
+  static std::shared_ptr<clutils::runtime> default_runtime() { return clutils::shared_runtime(cl_api_version); }
+
+  const std::shared_ptr<clutils::runtime> &get_runtime() const { return m_runtime; }
+  const cl::Device &device() const { return m_device; }
+
+  // Longest sequence that fits into a single device buffer and can be indexed by the kernels
+  std::size_t max_sort_size() const {
+    const std::size_t max_alloc = m_device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / sizeof(T);
+    return std::min(max_alloc, max_network_size);
+  }
+
+  // Submit the sort and return immediately. Upload, kernels and read-back are enqueued without blocking, so the host
+  // is free to prepare the next batch. Commands start after the events in wait_for, if any.
+  sort_handle<T> sort_async(std::span<T> container, const std::vector<cl::Event> *wait_for = nullptr) {
+    sort_handle<T> handle;
+    handle.m_container = container;
+    handle.m_queue = m_queue;
+    handle.m_finished = false;
+    handle.m_wall_start = std::chrono::high_resolution_clock::now();
+
+    check_fits(container.size());
+    if (wait_for && !wait_for->empty()) m_queue.enqueueBarrierWithWaitList(wait_for);
+
+    const size_type size = container.size();
+    if (size < 2) {
+      m_queue.enqueueMarkerWithWaitList(nullptr, &handle.m_done);
+      return handle;
+    }
+
+    const auto stats_before = m_pool.stats();
+    const auto bin_size = clutils::sizeof_container(container);
+    const bool zero_copy = (m_host_memory_mode == clutils::host_memory_mode::zero_copy),
+               pinned = zero_copy && m_pinned->contains(container.data(), bin_size);
+
+    if (zero_copy && (!pinned || m_pinned->unified_memory())) {
+      // Let the driver use host memory directly. Mapping afterwards makes the results visible to the host, which is
+      // free on devices that share memory with the host.
+      handle.m_host_buf = cl::Buffer{m_ctx, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, bin_size, container.data()};
+      auto events = enqueue_sort(handle.m_host_buf, size);
+      handle.m_mapped =
+          m_queue.enqueueMapBuffer(handle.m_host_buf, CL_FALSE, CL_MAP_READ, 0, bin_size, nullptr, &handle.m_done);
+      handle.m_upload = handle.m_first = events.first;
+      handle.m_last = events.last;
+      handle.m_events = std::move(events.all);
+      handle.m_events.push_back({"map", clutils::command_kind::download, handle.m_done});
+    } else {
+      // Pinned pages are transferred with DMA straight away, ordinary memory goes through the driver's staging copy
+      handle.m_lease = m_pool.acquire(bin_size);
+      auto &buf = handle.m_lease.buffer();
+      m_queue.enqueueWriteBuffer(buf, CL_FALSE, 0, bin_size, container.data(), nullptr, &handle.m_upload);
+      auto events = enqueue_sort(buf, size);
+      m_queue.enqueueReadBuffer(buf, CL_FALSE, 0, bin_size, container.data(), nullptr, &handle.m_done);
+      handle.m_first = events.first;
+      handle.m_last = events.last;
+      handle.m_events.push_back({"upload", clutils::command_kind::upload, handle.m_upload});
+      handle.m_events.insert(handle.m_events.end(), events.all.begin(), events.all.end());
+      handle.m_events.push_back({"download", clutils::command_kind::download, handle.m_done});
+    }
+
+    m_queue.flush();
+
+    const auto stats_after = m_pool.stats();
+    handle.m_pool_stats = {stats_after.hits - stats_before.hits, stats_after.misses - stats_before.misses};
+    return handle;
+  }
+
+  void operator()(std::span<T> container, clutils::profiling_info *time = nullptr) override {
+    sort_async(container).wait(time);
+  }
+
+  // Sort independent sequences as a pipeline: while batch i is sorted on the compute queue, batch i + depth - 1 is
+  // uploaded and batch i - 1 is downloaded on the transfer queue. depth device buffers sized for the longest batch are
+  // cycled, a buffer is only refilled after its previous download, which the in-order transfer queue guarantees.
+  // The host memory mode does not apply here, containers from get_pinned_allocator() are still transferred with DMA.
+  void sort_many(std::span<const std::span<T>> batches, clutils::batch_profiling_info *time = nullptr,
+                 unsigned depth = 3) {
+    if (depth < 2) throw std::invalid_argument{"Pipeline depth must be at least 2"};
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    std::size_t max_bin_size = 0;
+    for (const auto &batch : batches) {
+      check_fits(batch.size());
+      max_bin_size = std::max(max_bin_size, clutils::sizeof_container(batch));
+    }
+
+    struct batch_events {
+      cl::Event upload, first, last, download;
+    };
+
+    std::vector<batch_events> events(batches.size());
+    std::vector<clutils::buffer_pool::lease> slots;
+    if (max_bin_size) {
+      const auto slots_count = std::min<std::size_t>(depth, batches.size());
+      for (std::size_t i = 0; i < slots_count; ++i)
+        slots.push_back(m_pool.acquire(max_bin_size));
+    }
+
+    // Sequences shorter than 2 are already sorted and never leave the host
+    const auto skip = [&](std::size_t i) { return batches[i].size() < 2; };
+    const auto slot_buffer = [&](std::size_t i) -> cl::Buffer & { return slots[i % slots.size()].buffer(); };
+
+    const auto upload = [&](std::size_t i) {
+      if (skip(i)) return;
+      m_transfer_queue.enqueueWriteBuffer(slot_buffer(i), CL_FALSE, 0, clutils::sizeof_container(batches[i]),
+                                          batches[i].data(), nullptr, &events[i].upload);
+    };
+
+    const auto sort = [&](std::size_t i) {
+      if (skip(i)) return;
+      const std::vector<cl::Event> uploaded = {events[i].upload};
+      m_queue.enqueueBarrierWithWaitList(&uploaded);
+      const auto kernels = enqueue_sort(slot_buffer(i), batches[i].size());
+      events[i].first = kernels.first;
+      events[i].last = kernels.last;
+    };
 
-  using func_signature = cl::Event(cl::Buffer);
+    const auto download = [&](std::size_t i) {
+      if (skip(i)) return;
+      const std::vector<cl::Event> sorted = {events[i].last};
+      m_transfer_queue.enqueueReadBuffer(slot_buffer(i), CL_FALSE, 0, clutils::sizeof_container(batches[i]),
+                                         batches[i].data(), &sorted, &events[i].download);
+    };
+
+    const std::size_t prefetch = slots.empty() ? 0 : slots.size() - 1;
+    for (std::size_t i = 0; i < std::min(prefetch, batches.size()); ++i)
+      upload(i);
+
+    for (std::size_t i = 0; i < batches.size(); ++i) {
+      if (i + prefetch < batches.size()) upload(i + prefetch);
+      sort(i);
+      download(i);
+      m_transfer_queue.flush();
+      m_queue.flush();
+    }
 
-  void run_boilerplate(std::span<T> container, std::function<func_signature> func) {
-    cl::Buffer buf = {m_ctx, CL_MEM_READ_WRITE, clutils::sizeof_container(container)};
-    cl::copy(m_queue, container.begin(), container.end(), buf);
+    m_transfer_queue.finish();
+    m_queue.finish();
+
+    if (!time) return;
+    *time = {};
+    time->wall = std::chrono::high_resolution_clock::now() - wall_start;
+
+    using ns = std::chrono::nanoseconds;
+    const auto start_of = [](const cl::Event &e) { return ns{e.getProfilingInfo<CL_PROFILING_COMMAND_START>()}; };
+    const auto end_of = [](const cl::Event &e) { return ns{e.getProfilingInfo<CL_PROFILING_COMMAND_END>()}; };
+
+    ns upload_time{}, kernels_time{}, download_time{}, pipeline_start = ns::max(), pipeline_end = ns::min();
+    for (std::size_t i = 0; i < batches.size(); ++i) {
+      if (skip(i)) continue;
+      const auto &e = events[i];
+      upload_time += end_of(e.upload) - start_of(e.upload);
+      kernels_time += end_of(e.last) - start_of(e.first);
+      download_time += end_of(e.download) - start_of(e.download);
+      pipeline_start = std::min(pipeline_start, start_of(e.upload));
+      pipeline_end = std::max(pipeline_end, end_of(e.download));
+    }
 
-    auto event = func(buf);
-    event.wait();
+    if (pipeline_start > pipeline_end) return;
+    const auto serial = upload_time + kernels_time + download_time, pure = pipeline_end - pipeline_start;
 
-    cl::copy(m_queue, buf, container.begin(), container.end());
+    time->upload = upload_time;
+    time->kernels = kernels_time;
+    time->download = download_time;
+    time->pure = pure;
+    if (serial.count() > 0) time->overlap = std::max(0.0, 1.0 - static_cast<double>(pure.count()) / serial.count());
   }
+
+  // Give cached device buffers back to the driver
+  virtual void trim() { m_pool.trim(); }
+  clutils::pool_stats pool_stats() const { return m_pool.stats(); }
+
+  void set_host_memory_mode(clutils::host_memory_mode mode) { m_host_memory_mode = mode; }
+  clutils::host_memory_mode host_memory_mode() const { return m_host_memory_mode; }
+
+  // Allocator for host containers that the device can read and write without staging copies. Fill the container in
+  // place and sort it in zero_copy mode.
+  clutils::pinned_allocator<T> get_pinned_allocator() const { return {m_pinned}; }
 };
 
-template <typename T, typename t_name> class naive_bitonic : public gpu_bitonic<T> {
+// Every step of the network is a separate launch, ~300 of them for 2^24 elements. Sorting the same buffer and size
+// again replays the chain recorded the previous time with clutils::launch_recording, a single command-buffer
+// submission where cl_khr_command_buffer is available. Up to max_recordings chains are kept, each holding on to its
+// buffer, trim() drops them so that their buffers are freed as well.
+template <typename T, typename t_name = clutils::type_name<T>> class naive_bitonic : public gpu_bitonic<T> {
   using kernel = bitonic_naive_kernel;
 
+public:
+  static constexpr std::size_t max_recordings = 8;
+
 private:
   cl::Program m_program;
   typename kernel::functor_type m_functor;
 
+  // A shape is recorded when it is sorted for the second time, the recording keeps its buffer alive
+  struct recorded_shape {
+    cl::Buffer buffer;
+    std::optional<clutils::launch_recording> recording;
+  };
+
+  std::map<std::pair<cl_mem, unsigned>, recorded_shape> m_recordings;
+  bool m_replay = true;
+
   using gpu_bitonic<T>::m_queue;
-  using gpu_bitonic<T>::m_ctx;
-  using gpu_bitonic<T>::run_boilerplate;
+  using gpu_bitonic<T>::m_programs;
 
   using typename gpu_bitonic<T>::size_type;
 
-public:
-  naive_bitonic()
-      : gpu_bitonic<T>{}, m_program{m_ctx, kernel::source(t_name::name_str), true}, m_functor{m_program,
-                                                                                              kernel::entry()} {}
+  // Same launches as enqueue_naive_network, every one with its own kernel object
+  clutils::launch_recording record(const cl::Buffer &buf, size_type size) {
+    clutils::launch_recording recording{m_queue};
+    const unsigned stages = std::countr_zero(std::bit_ceil(size));
 
-  void operator()(std::span<T> container, clutils::profiling_info *time = nullptr) override {
-    const size_type size = container.size(), stages = std::countr_zero(size);
-    if (std::popcount(size) != 1 || size < 2) throw std::runtime_error("Only power-of-two sequences are supported");
-    cl::Event prev_event, first_event;
-
-    auto submit = [&, first_iter = true](auto buf, auto stage, auto step) mutable {
-      const auto global_size = size / 2;
-
-      if (first_iter) {
-        const auto args = cl::EnqueueArgs{m_queue, global_size};
-        first_event = prev_event = m_functor(args, buf, stage, step);
-        first_iter = false;
-        return;
+    for (unsigned stage = 0; stage < stages; ++stage) {
+      for (int step = stage; step >= 0; --step) {
+        cl::Kernel launch{m_program, kernel::entry().c_str()};
+        launch.setArg(0, buf);
+        launch.setArg(1, cl_uint{stage});
+        launch.setArg(2, static_cast<cl_uint>(step));
+        launch.setArg(3, cl_uint{size});
+        recording.add(step_name("global step", stage, step), launch, active_pairs(size, step));
       }
+    }
 
-      const auto args = cl::EnqueueArgs{m_queue, prev_event, global_size};
-      prev_event = m_functor(args, buf, stage, step);
-    };
+    recording.finalize();
+    return recording;
+  }
 
-    const auto func = [&, stages](auto buf) {
-      for (unsigned stage = 0; stage < stages; ++stage) {
-        for (int step = stage; step >= 0; --step) {
-          submit(buf, stage, step);
-        }
-      }
-      return prev_event;
+protected:
+  kernel_events enqueue_sort(cl::Buffer &buf, size_type size) override {
+    const auto enqueue_direct = [&] {
+      return enqueue_naive_network(m_queue, size, [&](const cl::EnqueueArgs &args, unsigned stage, unsigned step) {
+        return m_functor(args, buf, stage, step, size);
+      });
     };
 
-    const auto wall_start = std::chrono::high_resolution_clock::now();
-    run_boilerplate(container, func);
-    const auto wall_end = std::chrono::high_resolution_clock::now();
+    // Host memory wrapped for a single zero-copy sort is not worth recording
+    if (!m_replay || (buf.getInfo<CL_MEM_FLAGS>() & CL_MEM_USE_HOST_PTR)) return enqueue_direct();
 
-    const std::chrono::nanoseconds pure_start{first_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
-        pure_end{prev_event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+    const std::pair<cl_mem, unsigned> key{buf(), size};
+    auto found = m_recordings.find(key);
+    if (found == m_recordings.end()) {
+      if (m_recordings.size() >= max_recordings) m_recordings.clear();
+      m_recordings.emplace(key, recorded_shape{});
+      return enqueue_direct();
+    }
 
-    if (time) {
-      time->wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
-      time->pure = std::chrono::duration_cast<std::chrono::milliseconds>(pure_end - pure_start);
+    auto &shape = found->second;
+    if (!shape.recording) {
+      shape.buffer = buf;
+      shape.recording.emplace(record(buf, size));
     }
+
+    kernel_events events;
+    events.all = shape.recording->enqueue();
+    events.first = events.all.front().event;
+    events.last = events.all.back().event;
+    return events;
+  }
+
+public:
+  naive_bitonic(std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime(),
+                const sort_order &order = {})
+      : gpu_bitonic<T>{std::move(runtime)},
+        m_program{kernel::program(*m_programs, t_name::name_str, order.less, order.descending)},
+        m_functor{m_program, kernel::entry()} {}
+
+  // Replay is on by default, turning it off also drops the recorded chains
+  void set_replay(bool enabled) {
+    m_replay = enabled;
+    if (!enabled) m_recordings.clear();
+  }
+
+  bool replay() const { return m_replay; }
+
+  // The recorded chains keep their buffers alive, so they go first
+  void trim() override {
+    m_recordings.clear();
+    gpu_bitonic<T>::trim();
   }
 };
 
-template <typename T, typename t_name> class local_bitonic : public gpu_bitonic<T> {
+// Programs of the fused global memory kernel, one for every number of steps from 2 to max_steps
+template <typename t_name> class fused_global_steps {
+  using kernel = bitonic_fused_kernel;
+
+  struct program_entry {
+    cl::Program program;
+    typename kernel::functor_type functor;
+  };
+
+  std::vector<program_entry> m_programs; // m_programs[i] fuses i + 2 steps
+
+public:
+  static constexpr unsigned max_supported_steps = 4;
+
+  fused_global_steps(clutils::program_cache &programs, unsigned max_steps, const sort_order &order = {}) {
+    if (max_steps < 1 || max_steps > max_supported_steps)
+      throw std::runtime_error{"Number of fused steps must be between 1 and 4"};
+
+    for (unsigned steps = 2; steps <= max_steps; ++steps) {
+      cl::Program program = kernel::program(programs, t_name::name_str, steps, order.less, order.descending);
+      typename kernel::functor_type functor{program, kernel::entry()};
+      m_programs.push_back({program, functor});
+    }
+  }
+
+  unsigned max_steps() const { return m_programs.size() + 1; }
+
+  cl::Event operator()(const cl::EnqueueArgs &args, cl::Buffer &buf, unsigned step_lo, unsigned steps, unsigned size) {
+    return m_programs.at(steps - 2).functor(args, buf, step_lo, size);
+  }
+};
+
+template <typename T, typename t_name = clutils::type_name<T>> class local_bitonic : public gpu_bitonic<T> {
   using kernel_initial = bitonic_local_initial_kernel;
   using kernel_naive = bitonic_naive_kernel;
 
@@ -165,74 +714,364 @@ private:
   cl::Program m_program_initial, m_program_last;
   typename kernel_initial::functor_type m_functor_initial;
   typename kernel_naive::functor_type m_functor_last;
+  typename gpu_bitonic<T>::size_type m_local_size = 0;
+  fused_global_steps<t_name> m_fused;
 
-  using gpu_bitonic<T>::m_ctx;
+protected:
   using gpu_bitonic<T>::m_queue;
-  using gpu_bitonic<T>::run_boilerplate;
+  using gpu_bitonic<T>::m_programs;
 
   using typename gpu_bitonic<T>::size_type;
-  size_type m_local_size = 0;
+
+  kernel_events enqueue_sort(cl::Buffer &buf, size_type size) override {
+    return enqueue_local_network(
+        m_queue, size, m_local_size,
+        [&](const cl::EnqueueArgs &args, unsigned stage_start, unsigned stage_end, unsigned step_offset) {
+          return m_functor_initial(args, buf, stage_start, stage_end, step_offset, size);
+        },
+        [&](const cl::EnqueueArgs &args, unsigned stage, unsigned step) {
+          return m_functor_last(args, buf, stage, step, size);
+        },
+        [&](const cl::EnqueueArgs &args, unsigned step_lo, unsigned steps) {
+          return m_fused(args, buf, step_lo, steps, size);
+        },
+        m_fused.max_steps());
+  }
 
 public:
-  local_bitonic(const unsigned segment_size)
-      : gpu_bitonic<T>{}, m_program_initial{m_ctx, kernel_initial::source(t_name::name_str, segment_size), true},
-        m_program_last{m_ctx, kernel_naive::source(t_name::name_str), true}, m_functor_initial{m_program_initial,
-                                                                                               kernel_initial::entry()},
-        m_functor_last{m_program_last, kernel_naive::entry()}, m_local_size{segment_size} {
+  // Global memory steps with strides beyond the segment are fused up to max_fused_steps per launch, 1 disables fusion
+  local_bitonic(const unsigned segment_size, const unsigned max_fused_steps = 4,
+                std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime(),
+                const sort_order &order = {})
+      : gpu_bitonic<T>{std::move(runtime)},
+        m_program_initial{
+            kernel_initial::program(*m_programs, t_name::name_str, segment_size, order.less, order.descending)},
+        m_program_last{kernel_naive::program(*m_programs, t_name::name_str, order.less, order.descending)},
+        m_functor_initial{m_program_initial, kernel_initial::entry()},
+        m_functor_last{m_program_last, kernel_naive::entry()}, m_local_size{segment_size},
+        m_fused{*m_programs, max_fused_steps, order} {
     if (std::popcount(segment_size) != 1 || segment_size < 2)
       throw std::runtime_error{"Segment size must be a natural power of 2"};
   }
+};
 
-  void operator()(std::span<T> container, clutils::profiling_info *time = nullptr) override {
-    const size_type size = container.size(), stages = std::countr_zero(size),
-                    initial_stages = std::countr_zero(m_local_size);
-    if (std::popcount(size) != 1 || size < 2) throw std::runtime_error{"Only power-of-two sequences are supported"};
-    if (size < m_local_size) throw std::runtime_error{"Total size can't be less than local size"};
+// Same schedule as local_bitonic, but every work-item keeps elems_per_thread elements in registers and sorts strides
+// within them without barriers. Work-groups have segment_size / elems_per_thread work-items.
+template <typename T, typename t_name = clutils::type_name<T>> class register_bitonic : public gpu_bitonic<T> {
+  using kernel_register = bitonic_local_register_kernel;
+  using kernel_naive = bitonic_naive_kernel;
 
-    cl::Event prev_event, first_event;
-    const auto initial_end_stage = std::min(initial_stages, stages);
+private:
+  cl::Program m_program_register, m_program_last;
+  typename kernel_register::functor_type m_functor_register;
+  typename kernel_naive::functor_type m_functor_last;
+  unsigned m_local_size = 0, m_elems_per_thread = 0;
+  fused_global_steps<t_name> m_fused;
 
-    auto enqueue_initial = [&](auto buf) {
-      auto args = cl::EnqueueArgs{m_queue, size / 2, m_local_size / 2};
-      first_event = prev_event = m_functor_initial(args, buf, 0, initial_end_stage, 0);
-    };
+  using gpu_bitonic<T>::m_queue;
+  using gpu_bitonic<T>::m_programs;
 
-    auto enqueue_last = [&](auto buf) {
-      for (unsigned stage = initial_end_stage; stage < stages; ++stage) {
-        for (int step = stage; step >= 0; --step) {
-          const size_type global_size = size / 2;
-          const size_type part_length = 1 << (step + 1);
+  using typename gpu_bitonic<T>::size_type;
 
-          if (part_length <= m_local_size) {
-            const auto args = cl::EnqueueArgs{m_queue, size / 2, m_local_size / 2};
-            prev_event = m_functor_initial(args, buf, stage, stage + 1, stage - step);
-            break;
-          }
+protected:
+  kernel_events enqueue_sort(cl::Buffer &buf, size_type size) override {
+    return enqueue_local_network(
+        m_queue, size, m_local_size,
+        [&](const cl::EnqueueArgs &args, unsigned stage_start, unsigned stage_end, unsigned step_offset) {
+          return m_functor_register(args, buf, stage_start, stage_end, step_offset, size);
+        },
+        [&](const cl::EnqueueArgs &args, unsigned stage, unsigned step) {
+          return m_functor_last(args, buf, stage, step, size);
+        },
+        [&](const cl::EnqueueArgs &args, unsigned step_lo, unsigned steps) {
+          return m_fused(args, buf, step_lo, steps, size);
+        },
+        m_fused.max_steps(), m_elems_per_thread);
+  }
 
-          const auto args = cl::EnqueueArgs{m_queue, prev_event, global_size};
-          prev_event = m_functor_last(args, buf, stage, step);
-        }
-      }
-    };
+public:
+  register_bitonic(const unsigned segment_size, const unsigned elems_per_thread, const unsigned max_fused_steps = 4,
+                   std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime(),
+                   const sort_order &order = {})
+      : gpu_bitonic<T>{std::move(runtime)},
+        m_program_register{kernel_register::program(*m_programs, t_name::name_str, segment_size, elems_per_thread,
+                                                    order.less, order.descending)},
+        m_program_last{kernel_naive::program(*m_programs, t_name::name_str, order.less, order.descending)},
+        m_functor_register{m_program_register, kernel_register::entry()},
+        m_functor_last{m_program_last, kernel_naive::entry()}, m_local_size{segment_size},
+        m_elems_per_thread{elems_per_thread}, m_fused{*m_programs, max_fused_steps, order} {
+    if (std::popcount(segment_size) != 1 || segment_size < 2)
+      throw std::runtime_error{"Segment size must be a natural power of 2"};
+    if (std::popcount(elems_per_thread) != 1 || elems_per_thread < 2 || elems_per_thread > segment_size)
+      throw std::runtime_error{"Elements per thread must be a power of 2 between 2 and the segment size"};
+  }
+};
 
-    const auto func = [&](auto buf) {
-      enqueue_initial(buf);
-      enqueue_last(buf);
-      return prev_event;
-    };
+// Sorts many short independent sequences stored back to back in one buffer. Segments are grouped by their length
+// rounded up to a power of two and every group is sorted with a single NDRange, one work-group per segment, with the
+// network specialised for that length. Whole sequences passed to sort() go through local_bitonic.
+template <typename T, typename t_name = clutils::type_name<T>>
+class segmented_bitonic : public local_bitonic<T, t_name> {
+  using kernel = bitonic_segmented_kernel;
+
+  std::map<unsigned, typename kernel::functor_type> m_functors; // Built on first use for every segment size class
+  unsigned m_max_segment_size;
+  sort_order m_order;
+
+  using local_bitonic<T, t_name>::m_queue;
+  using local_bitonic<T, t_name>::m_programs;
+  using gpu_bitonic<T>::m_pool;
 
+  typename kernel::functor_type &get_functor(unsigned segment_size) {
+    auto found = m_functors.find(segment_size);
+    if (found != m_functors.end()) return found->second;
+
+    typename kernel::functor_type functor{
+        kernel::program(*m_programs, t_name::name_str, segment_size, m_order.less, m_order.descending),
+        kernel::entry()};
+    return m_functors.emplace(segment_size, functor).first->second;
+  }
+
+public:
+  segmented_bitonic(const unsigned max_segment_size,
+                    std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime(),
+                    sort_order order = {})
+      : local_bitonic<T, t_name>{max_segment_size, 4, std::move(runtime), order}, m_max_segment_size{max_segment_size},
+        m_order{std::move(order)} {}
+
+  unsigned max_segment_size() const { return m_max_segment_size; }
+
+  // Sort every segment [offsets[i], offsets[i + 1]) of container independently. Offsets must be non-decreasing and
+  // within the container, segments must not be longer than max_segment_size().
+  void sort_segments(std::span<T> container, std::span<const unsigned> offsets,
+                     clutils::profiling_info *time = nullptr) {
+    this->check_fits(container.size());
     const auto wall_start = std::chrono::high_resolution_clock::now();
-    run_boilerplate(container, func);
+    if (time) *time = {};
+    if (offsets.size() < 2) return;
+
+    // Segment indices grouped by size class, all classes are uploaded in one buffer
+    std::map<unsigned, std::vector<cl_uint>> classes;
+    for (std::size_t i = 0; i + 1 < offsets.size(); ++i) {
+      if (offsets[i + 1] < offsets[i] || offsets[i + 1] > container.size())
+        throw std::invalid_argument{"Segment offsets must be non-decreasing and lie within the container"};
+
+      const unsigned length = offsets[i + 1] - offsets[i];
+      if (length < 2) continue;
+      if (length > m_max_segment_size) throw std::invalid_argument{"Segment is longer than the maximum segment size"};
+      classes[std::bit_ceil(length)].push_back(i);
+    }
+
+    if (classes.empty()) return;
+
+    std::vector<cl_uint> segments;
+    for (const auto &[segment_size, indices] : classes)
+      segments.insert(segments.end(), indices.begin(), indices.end());
+
+    const auto stats_before = m_pool.stats();
+    const auto bin_size = clutils::sizeof_container(container), offsets_bin_size = clutils::sizeof_container(offsets),
+               segments_bin_size = clutils::sizeof_container(segments);
+
+    auto data_lease = m_pool.acquire(bin_size);
+    auto offsets_lease = m_pool.acquire(offsets_bin_size, CL_MEM_READ_ONLY);
+    auto segments_lease = m_pool.acquire(segments_bin_size, CL_MEM_READ_ONLY);
+
+    std::vector<clutils::profiled_event> events(3, {"upload", clutils::command_kind::upload, {}});
+    m_queue.enqueueWriteBuffer(data_lease.buffer(), CL_FALSE, 0, bin_size, container.data(), nullptr,
+                               &events[0].event);
+    m_queue.enqueueWriteBuffer(offsets_lease.buffer(), CL_FALSE, 0, offsets_bin_size, offsets.data(), nullptr,
+                               &events[1].event);
+    m_queue.enqueueWriteBuffer(segments_lease.buffer(), CL_FALSE, 0, segments_bin_size, segments.data(), nullptr,
+                               &events[2].event);
+
+    cl::Event first_event, last_event;
+    unsigned segments_offset = 0;
+
+    for (const auto &[segment_size, indices] : classes) {
+      const unsigned count = indices.size();
+      const auto args = cl::EnqueueArgs{m_queue, count * (segment_size / 2), segment_size / 2};
+      last_event = get_functor(segment_size)(args, data_lease.buffer(), offsets_lease.buffer(),
+                                             segments_lease.buffer(), segments_offset);
+      events.push_back({"segmented " + std::to_string(segment_size), clutils::command_kind::kernel, last_event});
+      if (!first_event()) first_event = last_event;
+      segments_offset += count;
+    }
+
+    events.push_back({"download", clutils::command_kind::download, {}});
+    m_queue.enqueueReadBuffer(data_lease.buffer(), CL_TRUE, 0, bin_size, container.data(), nullptr,
+                              &events.back().event);
     const auto wall_end = std::chrono::high_resolution_clock::now();
 
+    if (!time) return;
+    const auto stats_after = m_pool.stats();
     const std::chrono::nanoseconds pure_start{first_event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
-        pure_end{prev_event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+        pure_end{last_event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+
+    time->pure = pure_end - pure_start;
+    time->wall = wall_end - wall_start;
+    time->pool_hits = stats_after.hits - stats_before.hits;
+    time->pool_misses = stats_after.misses - stats_before.misses;
+    time->commands = clutils::collect_timings(events);
+  }
+};
+
+// Sorts keys and moves a payload of type V along with them. Pairs are ordered by key, then by value, so the
+// permutation returned by argsort() is stable.
+template <typename K, typename V> class gpu_bitonic_kv {
+protected:
+  std::shared_ptr<clutils::runtime> m_runtime;
+  cl::Context m_ctx;
+  cl::CommandQueue m_queue;
+  clutils::buffer_pool m_pool;
+  std::shared_ptr<clutils::program_cache> m_programs;
+
+  using size_type = unsigned;
+
+  gpu_bitonic_kv(std::shared_ptr<clutils::runtime> runtime)
+      : m_runtime{std::move(runtime)}, m_ctx{m_runtime->context()}, m_queue{m_runtime->queue()}, m_pool{m_ctx},
+        m_programs{m_runtime->programs()} {}
+
+  // Enqueue the sorting network for the first size pairs of keys and values on m_queue
+  virtual kernel_events enqueue_sort(cl::Buffer &keys, cl::Buffer &values, size_type size) = 0;
+
+public:
+  static constexpr clutils::platform_version cl_api_version = {2, 2};
 
-    if (time) {
-      time->wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
-      time->pure = std::chrono::duration_cast<std::chrono::milliseconds>(pure_end - pure_start);
+  static std::shared_ptr<clutils::runtime> default_runtime() { return clutils::shared_runtime(cl_api_version); }
+
+  const std::shared_ptr<clutils::runtime> &get_runtime() const { return m_runtime; }
+
+  void sort(std::span<K> keys, std::span<V> values, clutils::profiling_info *time = nullptr) {
+    if (keys.size() != values.size()) throw std::invalid_argument{"Keys and values must have the same length"};
+
+    if (keys.size() > max_network_size) throw std::length_error{"Key-value sort is limited to 2^31 pairs"};
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    const size_type size = keys.size();
+    if (size < 2) {
+      if (time) *time = {};
+      return;
     }
+
+    const auto stats_before = m_pool.stats();
+    const auto keys_bin_size = clutils::sizeof_container(keys), values_bin_size = clutils::sizeof_container(values);
+    auto keys_lease = m_pool.acquire(keys_bin_size), values_lease = m_pool.acquire(values_bin_size);
+
+    std::vector<clutils::profiled_event> transfers = {{"upload keys", clutils::command_kind::upload, {}},
+                                                      {"upload values", clutils::command_kind::upload, {}},
+                                                      {"download keys", clutils::command_kind::download, {}},
+                                                      {"download values", clutils::command_kind::download, {}}};
+
+    m_queue.enqueueWriteBuffer(keys_lease.buffer(), CL_FALSE, 0, keys_bin_size, keys.data(), nullptr,
+                               &transfers[0].event);
+    m_queue.enqueueWriteBuffer(values_lease.buffer(), CL_FALSE, 0, values_bin_size, values.data(), nullptr,
+                               &transfers[1].event);
+    kernel_events events = enqueue_sort(keys_lease.buffer(), values_lease.buffer(), size);
+    m_queue.enqueueReadBuffer(keys_lease.buffer(), CL_FALSE, 0, keys_bin_size, keys.data(), nullptr,
+                              &transfers[2].event);
+    m_queue.enqueueReadBuffer(values_lease.buffer(), CL_TRUE, 0, values_bin_size, values.data(), nullptr,
+                              &transfers[3].event);
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    if (!time) return;
+
+    const auto stats_after = m_pool.stats();
+    const std::chrono::nanoseconds pure_start{events.first.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        pure_end{events.last.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+
+    time->pure = pure_end - pure_start;
+    time->wall = wall_end - wall_start;
+    time->pool_hits = stats_after.hits - stats_before.hits;
+    time->pool_misses = stats_after.misses - stats_before.misses;
+
+    events.all.insert(events.all.begin(), transfers.begin(), transfers.begin() + 2);
+    events.all.insert(events.all.end(), transfers.begin() + 2, transfers.end());
+    time->commands = clutils::collect_timings(events.all);
+  }
+
+  // Permutation p such that keys[p[0]] <= keys[p[1]] <= ..., equal keys keep their relative order
+  std::vector<V> argsort(std::span<const K> keys, clutils::profiling_info *time = nullptr)
+    requires std::is_integral_v<V>
+  {
+    std::vector<K> sorted_keys{keys.begin(), keys.end()};
+    std::vector<V> permutation(keys.size());
+    std::iota(permutation.begin(), permutation.end(), V{0});
+    sort(sorted_keys, permutation, time);
+    return permutation;
+  }
+
+  void trim() { m_pool.trim(); }
+  clutils::pool_stats pool_stats() const { return m_pool.stats(); }
+
+  virtual ~gpu_bitonic_kv() {}
+};
+
+template <typename K, typename V, typename k_name = clutils::type_name<K>, typename v_name = clutils::type_name<V>>
+class naive_bitonic_kv : public gpu_bitonic_kv<K, V> {
+  using kernel = bitonic_naive_kv_kernel;
+
+private:
+  cl::Program m_program;
+  typename kernel::functor_type m_functor;
+
+  using gpu_bitonic_kv<K, V>::m_queue;
+  using gpu_bitonic_kv<K, V>::m_programs;
+
+  using typename gpu_bitonic_kv<K, V>::size_type;
+
+protected:
+  kernel_events enqueue_sort(cl::Buffer &keys, cl::Buffer &values, size_type size) override {
+    return enqueue_naive_network(m_queue, size, [&](const cl::EnqueueArgs &args, unsigned stage, unsigned step) {
+      return m_functor(args, keys, values, stage, step, size);
+    });
+  }
+
+public:
+  naive_bitonic_kv(std::shared_ptr<clutils::runtime> runtime = gpu_bitonic_kv<K, V>::default_runtime())
+      : gpu_bitonic_kv<K, V>{std::move(runtime)},
+        m_program{kernel::program(*m_programs, k_name::name_str, v_name::name_str)},
+        m_functor{m_program, kernel::entry()} {}
+};
+
+template <typename K, typename V, typename k_name = clutils::type_name<K>, typename v_name = clutils::type_name<V>>
+class local_bitonic_kv : public gpu_bitonic_kv<K, V> {
+  using kernel_initial = bitonic_local_initial_kv_kernel;
+  using kernel_naive = bitonic_naive_kv_kernel;
+
+private:
+  cl::Program m_program_initial, m_program_last;
+  typename kernel_initial::functor_type m_functor_initial;
+  typename kernel_naive::functor_type m_functor_last;
+  unsigned m_local_size = 0;
+
+  using gpu_bitonic_kv<K, V>::m_queue;
+  using gpu_bitonic_kv<K, V>::m_programs;
+
+  using typename gpu_bitonic_kv<K, V>::size_type;
+
+protected:
+  kernel_events enqueue_sort(cl::Buffer &keys, cl::Buffer &values, size_type size) override {
+    return enqueue_local_network(
+        m_queue, size, m_local_size,
+        [&](const cl::EnqueueArgs &args, unsigned stage_start, unsigned stage_end, unsigned step_offset) {
+          return m_functor_initial(args, keys, values, stage_start, stage_end, step_offset, size);
+        },
+        [&](const cl::EnqueueArgs &args, unsigned stage, unsigned step) {
+          return m_functor_last(args, keys, values, stage, step, size);
+        });
+  }
+
+public:
+  local_bitonic_kv(const unsigned segment_size,
+                   std::shared_ptr<clutils::runtime> runtime = gpu_bitonic_kv<K, V>::default_runtime())
+      : gpu_bitonic_kv<K, V>{std::move(runtime)},
+        m_program_initial{kernel_initial::program(*m_programs, k_name::name_str, v_name::name_str, segment_size)},
+        m_program_last{kernel_naive::program(*m_programs, k_name::name_str, v_name::name_str)},
+        m_functor_initial{m_program_initial, kernel_initial::entry()},
+        m_functor_last{m_program_last, kernel_naive::entry()}, m_local_size{segment_size} {
+    if (std::popcount(segment_size) != 1 || segment_size < 2)
+      throw std::runtime_error{"Segment size must be a natural power of 2"};
   }
 };
 
-} // namespace bitonic
\ No newline at end of file
+} // namespace bitonic
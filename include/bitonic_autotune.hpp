@@ -0,0 +1,160 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "runtime.hpp"
+#include "tuning_store.hpp"
+#include "type_name.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bitonic {
+
+// Parameters of local_bitonic (elems_per_thread == 0) or register_bitonic
+struct local_config {
+  unsigned segment_size, max_fused_steps, elems_per_thread = 0;
+
+  clutils::tuning_params params() const {
+    clutils::tuning_params result;
+    result.set("lsz", segment_size).set("fuse", max_fused_steps);
+    if (elems_per_thread) result.set("ept", elems_per_thread);
+    return result;
+  }
+
+  static std::optional<local_config> from_params(const clutils::tuning_params &params) {
+    const auto lsz = params.get("lsz"), fuse = params.get("fuse");
+    if (!lsz || !fuse) return std::nullopt;
+    return local_config{*lsz, *fuse, params.get("ept").value_or(0)};
+  }
+};
+
+inline std::string local_kernel_name(bool register_kernel) {
+  return (register_kernel ? "bitonic-register" : "bitonic-local");
+}
+
+// Configurations the device can launch: segment_size / elems_per_thread work-items per group within
+// CL_DEVICE_MAX_WORK_GROUP_SIZE and a segment of T within CL_DEVICE_LOCAL_MEM_SIZE. Segments shorter than 64 elements
+// never pay off and are skipped.
+template <typename T> std::vector<local_config> local_candidates(const cl::Device &device, bool register_kernel) {
+  const std::size_t max_group = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+  const std::size_t local_mem = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+  std::vector<unsigned> items_per_thread = {2}; // The local kernel sorts a pair per work-item
+  if (register_kernel) items_per_thread = {2, 4, 8, 16};
+
+  std::vector<local_config> candidates;
+  for (unsigned segment_size = 64; segment_size * sizeof(T) <= local_mem && segment_size <= (1u << 16);
+       segment_size *= 2)
+    for (unsigned ept : items_per_thread) {
+      if (segment_size / ept > max_group || ept > segment_size) continue;
+      for (unsigned fuse = 1; fuse <= fused_global_steps<clutils::type_name<T>>::max_supported_steps; ++fuse)
+        candidates.push_back({segment_size, fuse, (register_kernel ? ept : 0)});
+    }
+
+  return candidates;
+}
+
+struct local_tuning_result {
+  local_config config;
+  double ns_per_element; // Device time averaged over the benchmark sizes
+};
+
+// Benchmark every candidate on random arrays of the given sizes and return the fastest one. Each size is sorted once to
+// warm up and then repetitions times, the median device time counts. Candidates the driver refuses to build or launch,
+// e.g. when the kernel needs more registers than a full work-group has, are skipped.
+template <typename T>
+local_tuning_result autotune_local(std::shared_ptr<clutils::runtime> runtime, bool register_kernel,
+                                   std::vector<std::size_t> sizes = {1 << 18, 1 << 21, 1 << 24},
+                                   unsigned repetitions = 5, std::ostream *log = nullptr) {
+  if (!repetitions) throw std::invalid_argument{"Autotuning needs at least one repetition"};
+  const auto candidates = local_candidates<T>(runtime->device(), register_kernel);
+  if (candidates.empty()) throw std::runtime_error{"Device can't run the local kernels for this type"};
+
+  // Sizes that don't fit into one device buffer are left out
+  const std::size_t max_size =
+      std::min<std::size_t>(runtime->device().getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / sizeof(T), max_network_size);
+
+  std::vector<std::vector<T>> inputs;
+  for (auto size : sizes) {
+    if (size > max_size) continue;
+    std::vector<T> input(size);
+    auto rand_gen = clutils::create_random_number_generator<T>(std::numeric_limits<T>::min(),
+                                                               std::numeric_limits<T>::max());
+    rand_gen(input);
+    inputs.push_back(std::move(input));
+  }
+  if (inputs.empty()) throw std::invalid_argument{"None of the benchmark sizes fits into device memory"};
+
+  std::optional<local_tuning_result> best;
+  std::vector<T> data;
+
+  for (const auto &config : candidates) {
+    double ns_per_element = 0;
+    try {
+      std::unique_ptr<gpu_bitonic<T>> sorter;
+      if (register_kernel)
+        sorter = std::make_unique<register_bitonic<T>>(config.segment_size, config.elems_per_thread,
+                                                       config.max_fused_steps, runtime);
+      else sorter = std::make_unique<local_bitonic<T>>(config.segment_size, config.max_fused_steps, runtime);
+
+      for (const auto &input : inputs) {
+        std::vector<std::chrono::nanoseconds> times;
+        for (unsigned r = 0; r <= repetitions; ++r) {
+          data = input;
+          auto handle = sorter->sort_async(data);
+          handle.wait();
+          if (r) times.push_back(handle.device_time()); // The first run only warms up
+        }
+
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        ns_per_element += static_cast<double>(times[times.size() / 2].count()) / input.size() / inputs.size();
+      }
+    } catch (cl::Error &) {
+      if (log) *log << "Info: skipping " << config.params().str() << ", the device can't run it\n";
+      continue;
+    }
+
+    if (log) *log << "Info: " << config.params().str() << ": " << ns_per_element << " ns per element\n";
+    if (!best || ns_per_element < best->ns_per_element) best = local_tuning_result{config, ns_per_element};
+  }
+
+  if (!best) throw std::runtime_error{"None of the local kernel configurations could run on the device"};
+  return *best;
+}
+
+template <typename T>
+std::optional<local_config> load_local_config(const clutils::tuning_store &store, const cl::Device &device,
+                                              bool register_kernel) {
+  const auto params = store.find(
+      clutils::tuning_store::key(device, local_kernel_name(register_kernel), clutils::type_name<T>::name_str));
+  if (!params) return std::nullopt;
+  return local_config::from_params(*params);
+}
+
+template <typename T>
+void store_local_config(clutils::tuning_store &store, const cl::Device &device, bool register_kernel,
+                        const local_config &config) {
+  store.set(clutils::tuning_store::key(device, local_kernel_name(register_kernel), clutils::type_name<T>::name_str),
+            config.params());
+}
+
+} // namespace bitonic
@@ -0,0 +1,141 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace bitonic {
+
+// Number of elements of first among the first k elements of merge(first, second). Ties are taken from first like
+// std::merge does, so splitting the output at any k and merging the parts separately gives the same result.
+template <typename T>
+std::size_t merge_path_split(std::span<const T> first, std::span<const T> second, std::size_t k) {
+  std::size_t lo = (k > second.size() ? k - second.size() : 0), hi = std::min(k, first.size());
+  while (lo < hi) {
+    const std::size_t mid = lo + (hi - lo) / 2;
+    if (!(second[k - mid - 1] < first[mid])) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Merge two sorted ranges into output. The output is cut into equal chunks, each chunk finds its starting point in
+// both inputs with merge_path_split and is merged by its own task.
+template <typename T>
+void parallel_merge(clutils::thread_pool &pool, std::span<const T> first, std::span<const T> second,
+                    std::span<T> output) {
+  const std::size_t length = output.size();
+  if (length != first.size() + second.size()) throw std::invalid_argument{"Output length must match the inputs"};
+
+  constexpr std::size_t min_chunk = 1 << 16; // Shorter chunks don't pay off the binary searches and task overhead
+  const std::size_t chunk = std::max(min_chunk, length / (4 * pool.size()) + 1);
+
+  pool.parallel_for(0, (length + chunk - 1) / chunk, 1, [&](std::size_t chunk_first, std::size_t chunk_last) {
+    for (std::size_t c = chunk_first; c < chunk_last; ++c) {
+      const std::size_t k_begin = c * chunk, k_end = std::min(length, k_begin + chunk);
+      const std::size_t i_begin = merge_path_split(first, second, k_begin),
+                        i_end = merge_path_split(first, second, k_end);
+      std::merge(first.begin() + i_begin, first.begin() + i_end, second.begin() + (k_begin - i_begin),
+                 second.begin() + (k_end - i_end), output.begin() + k_begin);
+    }
+  });
+}
+
+// Cooperative sort for devices sharing the machine with idle CPU cores, e.g. integrated GPUs. The front of the
+// sequence is submitted to the GPU sorter with sort_async, the rest is sorted by the CPU sorter in the meantime and
+// the two halves are merged on the thread pool. The GPU share follows the throughput measured on both sides: it is
+// moved towards gpu_rate / (gpu_rate + cpu_rate) after every call, so repeated sorts converge to a split where both
+// sides finish together.
+template <typename T> class hybrid_bitonic_sort : public i_bitonic_sort<T> {
+  using typename i_bitonic_sort<T>::size_type;
+  using ms = std::chrono::duration<double, std::milli>;
+
+  std::unique_ptr<gpu_bitonic<T>> m_gpu;
+  std::unique_ptr<i_bitonic_sort<T>> m_cpu;
+  std::shared_ptr<clutils::thread_pool> m_pool;
+
+  double m_gpu_share;
+  double m_gpu_rate = 0, m_cpu_rate = 0; // Elements per millisecond, exponentially smoothed
+  std::vector<T> m_merged;
+
+  static constexpr double smoothing = 0.5;            // Weight of the newest measurement
+  static constexpr double min_share = 1.0 / 32;       // Both sides keep some work to stay measured
+  static constexpr size_type min_tuned_size = 1 << 16; // Below that launch overheads dominate the measurements
+
+  static double smooth(double average, double sample) {
+    return (average > 0 ? smoothing * sample + (1 - smoothing) * average : sample);
+  }
+
+  void update_share(size_type gpu_size, ms gpu_time, size_type cpu_size, ms cpu_time) {
+    if (gpu_size < min_tuned_size || cpu_size < min_tuned_size || gpu_time.count() <= 0 || cpu_time.count() <= 0)
+      return;
+
+    m_gpu_rate = smooth(m_gpu_rate, gpu_size / gpu_time.count());
+    m_cpu_rate = smooth(m_cpu_rate, cpu_size / cpu_time.count());
+    m_gpu_share = std::clamp(m_gpu_rate / (m_gpu_rate + m_cpu_rate), min_share, 1 - min_share);
+  }
+
+public:
+  hybrid_bitonic_sort(std::unique_ptr<gpu_bitonic<T>> gpu, std::unique_ptr<i_bitonic_sort<T>> cpu,
+                      std::shared_ptr<clutils::thread_pool> pool = std::make_shared<clutils::thread_pool>(),
+                      double gpu_share = 0.5)
+      : m_gpu{std::move(gpu)}, m_cpu{std::move(cpu)}, m_pool{std::move(pool)},
+        m_gpu_share{std::clamp(gpu_share, min_share, 1 - min_share)} {
+    if (!m_gpu || !m_cpu || !m_pool) throw std::invalid_argument{"Hybrid sort requires both sorters and a pool"};
+  }
+
+  // Share of the elements given to the GPU by the next call
+  double gpu_share() const { return m_gpu_share; }
+
+  void operator()(std::span<T> container, clutils::profiling_info *info) override {
+    const size_type size = container.size();
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+
+    const auto gpu_size = static_cast<size_type>(std::llround(size * m_gpu_share));
+    const auto gpu_part = container.first(gpu_size), cpu_part = container.subspan(gpu_size);
+
+    clutils::profiling_info gpu_info;
+    auto handle = m_gpu->sort_async(gpu_part);
+
+    const auto cpu_start = std::chrono::high_resolution_clock::now();
+    m_cpu->sort(cpu_part);
+    const auto cpu_end = std::chrono::high_resolution_clock::now();
+
+    handle.wait(&gpu_info);
+    update_share(gpu_part.size(), handle.device_time(), cpu_part.size(), cpu_end - cpu_start);
+
+    if (!gpu_part.empty() && !cpu_part.empty()) {
+      m_merged.resize(size);
+      parallel_merge<T>(*m_pool, gpu_part, cpu_part, m_merged);
+      m_pool->parallel_for(0, size, size / m_pool->size() + 1, [&](std::size_t first, std::size_t last) {
+        std::copy(m_merged.begin() + first, m_merged.begin() + last, container.begin() + first);
+      });
+    }
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (!info) return;
+    *info = gpu_info;
+    info->wall = wall_end - wall_start;
+  }
+};
+
+} // namespace bitonic
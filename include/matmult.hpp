@@ -0,0 +1,712 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "opencl_include.hpp"
+#include "pinned_memory.hpp"
+#include "program_cache.hpp"
+#include "reduced_float.hpp"
+#include "runtime.hpp"
+#include "selector.hpp"
+#include "type_name.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "linmath/contiguous_matrix.hpp"
+
+#include "kernelhpp/matmult_batched_kernel.hpp"
+#include "kernelhpp/matmult_blocked_kernel.hpp"
+#include "kernelhpp/matmult_mixed_kernel.hpp"
+#include "kernelhpp/matmult_naive_kernel.hpp"
+#include "kernelhpp/matmult_tiled_arb_kernel.hpp"
+#include "kernelhpp/matmult_tiled_kernel.hpp"
+
+namespace matmult {
+
+template <typename T> using matrix_type = throttle::linmath::contiguous_matrix<T>;
+
+struct matrix_sizes {
+  std::size_t ax, ay, by;
+};
+
+struct ndrange_query {
+  cl::NDRange global, local;
+};
+
+// count products C_i = A_i * B_i of row-major matrices. A_i starts stride_a elements after A_{i-1} and B_i stride_b
+// elements after B_{i-1}, a stride of 0 multiplies every matrix by the same operand. Results are packed back to back.
+struct batch_layout {
+  matrix_sizes sizes;
+  std::size_t count, stride_a, stride_b;
+
+  static batch_layout packed(matrix_sizes sizes, std::size_t count) {
+    return {sizes, count, sizes.ax * sizes.ay, sizes.ay * sizes.by};
+  }
+
+  std::size_t extent_a() const { return (count ? (count - 1) * stride_a + sizes.ax * sizes.ay : 0); }
+  std::size_t extent_b() const { return (count ? (count - 1) * stride_b + sizes.ay * sizes.by : 0); }
+  std::size_t extent_c() const { return count * sizes.ax * sizes.by; }
+};
+
+using clutils::profiling_info;
+template <typename T> class i_matmult {
+public:
+  virtual matrix_type<T> operator()(const matrix_type<T> &, const matrix_type<T> &, profiling_info *) = 0;
+  virtual void run_batched(std::span<const T>, std::span<const T>, std::span<T>, const batch_layout &,
+                           profiling_info *) = 0;
+
+  matrix_type<T> multiply(const matrix_type<T> &mata, const matrix_type<T> &matb, profiling_info *time = nullptr) {
+    return operator()(mata, matb, time);
+  }
+
+  // All products of the batch are computed by one launch, every operand array is a single transfer
+  void multiply_batched(std::span<const T> a, std::span<const T> b, std::span<T> c, const batch_layout &layout,
+                        profiling_info *time = nullptr) {
+    run_batched(a, b, c, layout, time);
+  }
+
+  virtual ~i_matmult() {}
+};
+
+// Matrix kept in a device buffer. Products of device matrices stay on the device and only wait for their operands
+// there, so a chain like A * B * C * D only transfers the inputs and the final result. The contents are read back on
+// the first call to host() and cached. Handles are move-only, every buffer belongs to one of them.
+template <typename T> class device_matrix {
+  cl::Context m_ctx;
+  cl::CommandQueue m_queue;
+  cl::Buffer m_buf;
+  std::size_t m_rows = 0, m_cols = 0;
+  cl::Event m_ready; // Last command writing the buffer
+  mutable std::unique_ptr<matrix_type<T>> m_host;
+
+public:
+  device_matrix() = default;
+  device_matrix(cl::Context ctx, cl::CommandQueue queue, cl::Buffer buf, std::size_t rows, std::size_t cols,
+                cl::Event ready)
+      : m_ctx{std::move(ctx)}, m_queue{std::move(queue)}, m_buf{std::move(buf)}, m_rows{rows}, m_cols{cols},
+        m_ready{std::move(ready)} {}
+
+  device_matrix(const device_matrix &) = delete;
+  device_matrix &operator=(const device_matrix &) = delete;
+  device_matrix(device_matrix &&) = default;
+  device_matrix &operator=(device_matrix &&) = default;
+
+  std::size_t rows() const { return m_rows; }
+  std::size_t cols() const { return m_cols; }
+  std::size_t bin_size() const { return m_rows * m_cols * sizeof(T); }
+
+  const cl::Context &context() const { return m_ctx; }
+  const cl::Buffer &buffer() const { return m_buf; }
+  const cl::Event &event() const { return m_ready; }
+
+  // Whether the contents were already read back
+  bool on_host() const { return m_host != nullptr; }
+
+  const matrix_type<T> &host() const {
+    if (m_host) return *m_host;
+
+    auto host = std::make_unique<matrix_type<T>>(m_rows, m_cols);
+    std::vector<cl::Event> wait_for;
+    if (m_ready()) wait_for.push_back(m_ready);
+    m_queue.enqueueReadBuffer(m_buf, CL_TRUE, 0, bin_size(), host->data(), &wait_for);
+    m_host = std::move(host);
+    return *m_host;
+  }
+};
+
+template <typename T> class gpu_matmult : public i_matmult<T> {
+protected:
+  std::shared_ptr<clutils::runtime> m_runtime;
+  cl::Context m_ctx;
+  cl::CommandQueue m_queue;
+  clutils::buffer_pool m_pool;
+  std::shared_ptr<clutils::program_cache> m_programs;
+  clutils::host_memory_mode m_host_memory_mode = clutils::host_memory_mode::copy;
+  std::map<unsigned, matmult_batched_kernel::functor_type> m_batched; // By tile size
+
+protected:
+  gpu_matmult(std::shared_ptr<clutils::runtime> runtime)
+      : m_runtime{std::move(runtime)}, m_ctx{m_runtime->context()}, m_queue{m_runtime->queue()}, m_pool{m_ctx},
+        m_programs{m_runtime->programs()} {}
+
+  // Launch C [ax x by] = A [ax x ay] * B [ay x by] on m_queue once wait_for is complete
+  virtual cl::Event enqueue_multiply(const cl::Buffer &bufa, const cl::Buffer &bufb, const cl::Buffer &bufc,
+                                     const matrix_sizes &sizes, const std::vector<cl::Event> &wait_for) = 0;
+
+  // Throws for sizes the kernel can't multiply
+  virtual void check_sizes(const matrix_sizes &) const {}
+
+  using func_signature = cl::Event(cl::Buffer, cl::Buffer, cl::Buffer);
+  using kind = clutils::command_kind;
+  matrix_type<T> run_boilerplate(const matrix_type<T> &mata, const matrix_type<T> &matb,
+                                 std::function<func_signature> func, profiling_info *time) {
+
+    const auto mat_size = [](const auto &m) { return std::distance(m.begin(), m.end()); };
+    const auto mat_bin_size = [&mat_size](const auto &m) { return mat_size(m) * sizeof(T); };
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto stats_before = m_pool.stats();
+
+    matrix_type<T> matc = {mata.rows(), matb.cols()};
+    cl::Event event;
+    std::vector<clutils::profiled_event> events;
+
+    if (m_host_memory_mode == clutils::host_memory_mode::zero_copy) {
+      // Wrap host storage directly. The driver is free to access it in place, which avoids copying altogether on
+      // devices sharing memory with the host. Mapping C afterwards makes the result visible to the host.
+      const auto wrap = [this, &mat_bin_size](auto &m, cl_mem_flags flags) {
+        return cl::Buffer{m_ctx, flags | CL_MEM_USE_HOST_PTR, mat_bin_size(m), const_cast<T *>(m.data())};
+      };
+      auto bufa = wrap(mata, CL_MEM_READ_ONLY), bufb = wrap(matb, CL_MEM_READ_ONLY),
+           bufc = wrap(matc, CL_MEM_WRITE_ONLY);
+
+      event = func(bufa, bufb, bufc);
+      event.wait();
+      events.push_back({"matmult", kind::kernel, event});
+
+      events.push_back({"map C", kind::download, {}});
+      auto *mapped =
+          m_queue.enqueueMapBuffer(bufc, CL_TRUE, CL_MAP_READ, 0, mat_bin_size(matc), nullptr, &events.back().event);
+      m_queue.enqueueUnmapMemObject(bufc, mapped);
+      m_queue.finish();
+    } else {
+      auto lease_a = m_pool.acquire(mat_bin_size(mata), CL_MEM_READ_ONLY);
+      auto lease_b = m_pool.acquire(mat_bin_size(matb), CL_MEM_READ_ONLY);
+      auto lease_c = m_pool.acquire(mat_bin_size(matc), CL_MEM_WRITE_ONLY);
+      auto &bufa = lease_a.buffer(), &bufb = lease_b.buffer(), &bufc = lease_c.buffer();
+
+      events = {{"upload A", kind::upload, {}}, {"upload B", kind::upload, {}}};
+      m_queue.enqueueWriteBuffer(bufa, CL_FALSE, 0, mat_bin_size(mata), mata.data(), nullptr, &events[0].event);
+      m_queue.enqueueWriteBuffer(bufb, CL_FALSE, 0, mat_bin_size(matb), matb.data(), nullptr, &events[1].event);
+
+      event = func(bufa, bufb, bufc);
+      events.push_back({"matmult", kind::kernel, event});
+
+      events.push_back({"download C", kind::download, {}});
+      m_queue.enqueueReadBuffer(bufc, CL_TRUE, 0, mat_bin_size(matc), matc.data(), nullptr, &events.back().event);
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    std::chrono::nanoseconds pure_start{event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        pure_end{event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+
+    if (time) {
+      const auto stats_after = m_pool.stats();
+      *time = {pure_end - pure_start, wall_end - wall_start, stats_after.hits - stats_before.hits,
+               stats_after.misses - stats_before.misses, clutils::collect_timings(events)};
+    }
+
+    return matc;
+  }
+
+  // Square tiles up to 16 x 16 within the work-group limit. Small matrices get the smallest tile covering them, so
+  // work-items without an element of C don't dominate the launch.
+  unsigned batched_tile_size(const matrix_sizes &sizes) const {
+    const std::size_t max_group = m_runtime->device().template getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    auto tile = std::min<std::size_t>(std::bit_ceil(std::max(sizes.ax, sizes.by)), 16);
+    while (tile > 1 && tile * tile > max_group)
+      tile /= 2;
+    return tile;
+  }
+
+  matmult_batched_kernel::functor_type &batched_functor(unsigned tile_size) {
+    if (auto found = m_batched.find(tile_size); found != m_batched.end()) return found->second;
+    const auto program = matmult_batched_kernel::program(*m_programs, clutils::type_name<T>::name_str, tile_size);
+    return m_batched.emplace(tile_size, matmult_batched_kernel::functor_type{program, matmult_batched_kernel::entry()})
+        .first->second;
+  }
+
+public:
+  void run_batched(std::span<const T> a, std::span<const T> b, std::span<T> c, const batch_layout &layout,
+                   profiling_info *time = nullptr) override {
+    const auto [ax, ay, by] = layout.sizes;
+    if (!ax || !ay || !by) throw std::invalid_argument{"Matrix sizes should be positive"};
+    if (a.size() < layout.extent_a() || b.size() < layout.extent_b() || c.size() < layout.extent_c())
+      throw std::invalid_argument{"Batch doesn't fit into the operand arrays"};
+
+    constexpr std::size_t max_stride = std::numeric_limits<cl_uint>::max();
+    if (layout.stride_a > max_stride || layout.stride_b > max_stride || ax * by > max_stride)
+      throw std::invalid_argument{"Matrices of the batch are too far apart"};
+
+    if (time) *time = {};
+    if (!layout.count) return;
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto stats_before = m_pool.stats();
+
+    const unsigned tile = batched_tile_size(layout.sizes);
+    auto &functor = batched_functor(tile);
+    const auto tiles = [tile](std::size_t sz) { return (sz + tile - 1) / tile; };
+    const cl::EnqueueArgs args{m_queue, {tiles(ax) * tile, tiles(by) * tile, layout.count}, {tile, tile, 1}};
+    const auto launch = [&](cl::Buffer &bufa, cl::Buffer &bufb, cl::Buffer &bufc) {
+      return functor(args, bufa, bufb, bufc, ax, ay, by, tiles(ay), layout.stride_a, layout.stride_b, ax * by);
+    };
+
+    const std::size_t bin_a = layout.extent_a() * sizeof(T), bin_b = layout.extent_b() * sizeof(T),
+                      bin_c = layout.extent_c() * sizeof(T);
+    cl::Event event;
+    std::vector<clutils::profiled_event> events;
+
+    if (m_host_memory_mode == clutils::host_memory_mode::zero_copy) {
+      auto bufa = cl::Buffer{m_ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, bin_a, const_cast<T *>(a.data())};
+      auto bufb = cl::Buffer{m_ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, bin_b, const_cast<T *>(b.data())};
+      auto bufc = cl::Buffer{m_ctx, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, bin_c, c.data()};
+
+      event = launch(bufa, bufb, bufc);
+      events.push_back({"matmult batched", kind::kernel, event});
+
+      events.push_back({"map C", kind::download, {}});
+      auto *mapped = m_queue.enqueueMapBuffer(bufc, CL_TRUE, CL_MAP_READ, 0, bin_c, nullptr, &events.back().event);
+      m_queue.enqueueUnmapMemObject(bufc, mapped);
+      m_queue.finish();
+    } else {
+      auto lease_a = m_pool.acquire(bin_a, CL_MEM_READ_ONLY), lease_b = m_pool.acquire(bin_b, CL_MEM_READ_ONLY);
+      auto lease_c = m_pool.acquire(bin_c, CL_MEM_WRITE_ONLY);
+
+      events = {{"upload A", kind::upload, {}}, {"upload B", kind::upload, {}}};
+      m_queue.enqueueWriteBuffer(lease_a.buffer(), CL_FALSE, 0, bin_a, a.data(), nullptr, &events[0].event);
+      m_queue.enqueueWriteBuffer(lease_b.buffer(), CL_FALSE, 0, bin_b, b.data(), nullptr, &events[1].event);
+
+      event = launch(lease_a.buffer(), lease_b.buffer(), lease_c.buffer());
+      events.push_back({"matmult batched", kind::kernel, event});
+
+      events.push_back({"download C", kind::download, {}});
+      m_queue.enqueueReadBuffer(lease_c.buffer(), CL_TRUE, 0, bin_c, c.data(), nullptr, &events.back().event);
+    }
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) {
+      const auto stats_after = m_pool.stats();
+      std::chrono::nanoseconds pure_start{event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+          pure_end{event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+      *time = {pure_end - pure_start, wall_end - wall_start, stats_after.hits - stats_before.hits,
+               stats_after.misses - stats_before.misses, clutils::collect_timings(events)};
+    }
+  }
+
+  matrix_type<T> operator()(const matrix_type<T> &mata, const matrix_type<T> &matb,
+                            profiling_info *time = nullptr) override {
+    if (mata.cols() != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
+    const matrix_sizes sizes = {mata.rows(), mata.cols(), matb.cols()};
+    check_sizes(sizes);
+
+    const auto func = [&](auto bufa, auto bufb, auto bufc) { return enqueue_multiply(bufa, bufb, bufc, sizes, {}); };
+    return run_boilerplate(mata, matb, func, time);
+  }
+
+  using i_matmult<T>::multiply;
+
+  // Blocking upload into a new buffer of the multiplier's context
+  device_matrix<T> to_device(const matrix_type<T> &mat) {
+    if (!mat.rows() || !mat.cols()) throw std::invalid_argument{"Device matrices can't be empty"};
+
+    const std::size_t bin_size = mat.rows() * mat.cols() * sizeof(T);
+    cl::Buffer buf{m_ctx, CL_MEM_READ_WRITE, bin_size};
+    m_queue.enqueueWriteBuffer(buf, CL_TRUE, 0, bin_size, mat.data());
+    return {m_ctx, m_queue, std::move(buf), mat.rows(), mat.cols(), {}};
+  }
+
+  // Enqueues the product and returns without waiting for it, the result can be fed to the next multiply right away.
+  // Asking for the time waits for the kernel.
+  device_matrix<T> multiply(const device_matrix<T> &mata, const device_matrix<T> &matb,
+                            profiling_info *time = nullptr) {
+    if (mata.cols() != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
+    if (!mata.rows() || !matb.cols()) throw std::invalid_argument{"Device matrices can't be empty"};
+    if (mata.context()() != m_ctx() || matb.context()() != m_ctx())
+      throw std::invalid_argument{"Device matrices belong to a different context"};
+
+    const matrix_sizes sizes = {mata.rows(), mata.cols(), matb.cols()};
+    check_sizes(sizes);
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+
+    std::vector<cl::Event> wait_for;
+    for (const auto *operand : {&mata, &matb})
+      if (operand->event()()) wait_for.push_back(operand->event());
+
+    cl::Buffer bufc{m_ctx, CL_MEM_READ_WRITE, sizes.ax * sizes.by * sizeof(T)};
+    cl::Event event = enqueue_multiply(mata.buffer(), matb.buffer(), bufc, sizes, wait_for);
+
+    if (time) {
+      event.wait();
+      auto wall_end = std::chrono::high_resolution_clock::now();
+      std::chrono::nanoseconds pure_start{event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+          pure_end{event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+      *time = {pure_end - pure_start, wall_end - wall_start, 0, 0,
+               clutils::collect_timings({{"matmult", kind::kernel, event}})};
+    }
+
+    return {m_ctx, m_queue, std::move(bufc), sizes.ax, sizes.by, std::move(event)};
+  }
+
+  static constexpr clutils::platform_version c_api_version = {2, 2};
+
+  static std::shared_ptr<clutils::runtime> default_runtime() { return clutils::shared_runtime(c_api_version); }
+
+  const std::shared_ptr<clutils::runtime> &get_runtime() const { return m_runtime; }
+
+  // Give cached device buffers back to the driver
+  void trim() { m_pool.trim(); }
+  clutils::pool_stats pool_stats() const { return m_pool.stats(); }
+
+  void set_host_memory_mode(clutils::host_memory_mode mode) { m_host_memory_mode = mode; }
+  clutils::host_memory_mode host_memory_mode() const { return m_host_memory_mode; }
+};
+
+template <typename T> class naive_matmult : public gpu_matmult<T> {
+  using kernel = matmult_naive_kernel;
+
+private:
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::m_programs;
+
+public:
+  naive_matmult(std::shared_ptr<clutils::runtime> runtime = gpu_matmult<T>::default_runtime())
+      : gpu_matmult<T>{std::move(runtime)}, m_program{kernel::program(*m_programs, clutils::type_name<T>::name_str)},
+        m_functor{m_program, kernel::entry()} {}
+
+protected:
+  cl::Event enqueue_multiply(const cl::Buffer &bufa, const cl::Buffer &bufb, const cl::Buffer &bufc,
+                             const matrix_sizes &sizes, const std::vector<cl::Event> &wait_for) override {
+    cl::EnqueueArgs args = {m_queue, wait_for, {sizes.ax, sizes.by}};
+    return m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by);
+  }
+};
+
+template <typename T> class tiled_matmult : public gpu_matmult<T> {
+  using kernel = matmult_tiled_kernel;
+
+private:
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  unsigned m_tile_size;
+
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::m_programs;
+
+public:
+  tiled_matmult(unsigned tile_size, std::shared_ptr<clutils::runtime> runtime = gpu_matmult<T>::default_runtime())
+      : gpu_matmult<T>{std::move(runtime)},
+        m_program{kernel::program(*m_programs, clutils::type_name<T>::name_str, tile_size)},
+        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size} {}
+
+protected:
+  void check_sizes(const matrix_sizes &sizes) const override {
+    if (sizes.ax % m_tile_size != 0 || sizes.ay % m_tile_size != 0 || sizes.by % m_tile_size != 0)
+      throw std::invalid_argument{"Matrix sizes should be divisible by the tile size"};
+  }
+
+  cl::Event enqueue_multiply(const cl::Buffer &bufa, const cl::Buffer &bufb, const cl::Buffer &bufc,
+                             const matrix_sizes &sizes, const std::vector<cl::Event> &wait_for) override {
+    cl::EnqueueArgs args = {m_queue, wait_for, {sizes.ax, sizes.by}, {m_tile_size, m_tile_size}};
+    return m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by);
+  }
+};
+
+template <typename T> class tiled_arbitrary_matmult : public gpu_matmult<T> {
+  using kernel = matmult_tiled_arb_kernel;
+
+private:
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  unsigned m_tile_size;
+
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::m_programs;
+
+public:
+  tiled_arbitrary_matmult(unsigned tile_size,
+                          std::shared_ptr<clutils::runtime> runtime = gpu_matmult<T>::default_runtime())
+      : gpu_matmult<T>{std::move(runtime)},
+        m_program{kernel::program(*m_programs, clutils::type_name<T>::name_str, tile_size)},
+        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size} {}
+
+protected:
+  cl::Event enqueue_multiply(const cl::Buffer &bufa, const cl::Buffer &bufb, const cl::Buffer &bufc,
+                             const matrix_sizes &sizes, const std::vector<cl::Event> &wait_for) override {
+    const auto tile_sz = m_tile_size;
+    const auto recalc_size = [tile_sz](auto sz) {
+      if (sz % tile_sz == 0) return sz / tile_sz;
+      return (sz / tile_sz + 1);
+    };
+
+    auto recalc_rows = recalc_size(sizes.ax) * tile_sz;
+    auto recalc_cols = recalc_size(sizes.by) * tile_sz;
+
+    cl::EnqueueArgs args = {m_queue, wait_for, {recalc_rows, recalc_cols}, {tile_sz, tile_sz}};
+
+    int tile_count = recalc_size(sizes.ay);
+    return m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by, tile_count);
+  }
+};
+
+// Every work-item computes a block_rows x block_cols micro-tile of C in registers, a work-group of
+// (tile_size / block_rows) x (tile_size / block_cols) work-items covers a tile_size x tile_size block. A and B are
+// staged in local memory tile_depth columns/rows at a time. See kernels/matmult_blocked.cl.
+template <typename T> class blocked_matmult : public gpu_matmult<T> {
+  using kernel = matmult_blocked_kernel;
+
+private:
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+
+  unsigned m_tile_size, m_block_rows, m_block_cols;
+
+  using gpu_matmult<T>::m_queue;
+  using gpu_matmult<T>::m_programs;
+
+  static unsigned validate(unsigned tile_size, unsigned tile_depth, unsigned block_rows, unsigned block_cols) {
+    if (!tile_size || !tile_depth || !block_rows || !block_cols)
+      throw std::invalid_argument{"Tile and block sizes should be positive"};
+    if (block_cols % 4 != 0) throw std::invalid_argument{"Block columns should be a multiple of 4"};
+    if (tile_size % block_rows != 0 || tile_size % block_cols != 0)
+      throw std::invalid_argument{"Tile size should be divisible by the block sizes"};
+    return tile_size;
+  }
+
+public:
+  blocked_matmult(unsigned tile_size = 64, unsigned block_rows = 4, unsigned block_cols = 4, unsigned tile_depth = 16,
+                  std::shared_ptr<clutils::runtime> runtime = gpu_matmult<T>::default_runtime())
+      : gpu_matmult<T>{std::move(runtime)},
+        m_program{kernel::program(*m_programs, clutils::type_name<T>::name_str,
+                                  validate(tile_size, tile_depth, block_rows, block_cols), tile_depth, block_rows,
+                                  block_cols)},
+        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size}, m_block_rows{block_rows},
+        m_block_cols{block_cols} {}
+
+protected:
+  cl::Event enqueue_multiply(const cl::Buffer &bufa, const cl::Buffer &bufb, const cl::Buffer &bufc,
+                             const matrix_sizes &sizes, const std::vector<cl::Event> &wait_for) override {
+    const auto tiles = [this](std::size_t sz) { return (sz + m_tile_size - 1) / m_tile_size; };
+    const std::size_t group_rows = m_tile_size / m_block_rows, group_cols = m_tile_size / m_block_cols;
+
+    cl::EnqueueArgs args = {
+        m_queue, wait_for, {tiles(sizes.ax) * group_rows, tiles(sizes.by) * group_cols}, {group_rows, group_cols}};
+    return m_functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by);
+  }
+};
+
+// Format of A and B on the device, the values of STORAGE in kernels/matmult_mixed.cl
+enum class storage_precision : unsigned { fp32 = 0, fp16 = 1, bf16 = 2 };
+
+inline const char *precision_name(storage_precision precision) {
+  switch (precision) {
+  case storage_precision::fp16: return "fp16";
+  case storage_precision::bf16: return "bf16";
+  default: return "fp32";
+  }
+}
+
+inline storage_precision precision_from_string(const std::string &name) {
+  for (auto precision : {storage_precision::fp32, storage_precision::fp16, storage_precision::bf16})
+    if (name == precision_name(precision)) return precision;
+  throw std::invalid_argument{"Unknown precision " + name + ", supported: fp32, fp16, bf16"};
+}
+
+// fp16 storage needs cl_khr_fp16, bfloat16 is widened with integer operations and works everywhere
+inline bool device_supports_precision(const cl::Device &device, storage_precision precision) {
+  if (precision != storage_precision::fp16) return true;
+  const std::array<std::string, 1> required = {"cl_khr_fp16"};
+  return clutils::device_supports_extensions(device, required.begin(), required.end()).first;
+}
+
+// The value the device multiplies after float is stored with the precision
+inline float round_to_precision(float value, storage_precision precision) {
+  switch (precision) {
+  case storage_precision::fp16: return clutils::half_to_float(clutils::float_to_half(value));
+  case storage_precision::bf16: return clutils::bfloat16_to_float(clutils::float_to_bfloat16(value));
+  default: return value;
+  }
+}
+
+// Tiled multiplication of float matrices stored as fp16 or bfloat16 on the device and accumulated in fp32. Halving
+// the storage halves the uploads, the global reads and the local memory of a tile. A and B are converted on the host,
+// so the host memory mode doesn't apply to them. Devices without cl_khr_fp16 fall back to fp32, see precision().
+// Device matrices hold fp32 data and are multiplied in fp32.
+class mixed_matmult : public gpu_matmult<float> {
+  using kernel = matmult_mixed_kernel;
+
+private:
+  storage_precision m_precision;
+  unsigned m_tile_size;
+  cl::Program m_program;
+  kernel::functor_type m_functor;
+  std::optional<kernel::functor_type> m_fp32_functor; // Built on the first multiplication of device matrices
+
+  static storage_precision effective_precision(const clutils::runtime &runtime, storage_precision requested) {
+    return (device_supports_precision(runtime.device(), requested) ? requested : storage_precision::fp32);
+  }
+
+  kernel::functor_type &fp32_functor() {
+    if (m_precision == storage_precision::fp32) return m_functor;
+    if (!m_fp32_functor) {
+      const auto program = kernel::program(*m_programs, static_cast<unsigned>(storage_precision::fp32), m_tile_size);
+      m_fp32_functor.emplace(program, kernel::entry());
+    }
+    return *m_fp32_functor;
+  }
+
+  cl::Event launch(kernel::functor_type &functor, const cl::Buffer &bufa, const cl::Buffer &bufb,
+                   const cl::Buffer &bufc, const matrix_sizes &sizes, const std::vector<cl::Event> &wait_for) {
+    const auto tiles = [this](std::size_t sz) { return (sz + m_tile_size - 1) / m_tile_size; };
+    cl::EnqueueArgs args = {
+        m_queue, wait_for, {tiles(sizes.ax) * m_tile_size, tiles(sizes.by) * m_tile_size}, {m_tile_size, m_tile_size}};
+    return functor(args, bufa, bufb, bufc, sizes.ax, sizes.ay, sizes.by, tiles(sizes.ay));
+  }
+
+  std::vector<cl_ushort> to_storage(const matrix_type<float> &mat) const {
+    std::vector<cl_ushort> result(mat.rows() * mat.cols());
+    const auto convert = (m_precision == storage_precision::fp16 ? clutils::float_to_half : clutils::float_to_bfloat16);
+    std::transform(mat.begin(), mat.end(), result.begin(), convert);
+    return result;
+  }
+
+protected:
+  cl::Event enqueue_multiply(const cl::Buffer &bufa, const cl::Buffer &bufb, const cl::Buffer &bufc,
+                             const matrix_sizes &sizes, const std::vector<cl::Event> &wait_for) override {
+    return launch(fp32_functor(), bufa, bufb, bufc, sizes, wait_for);
+  }
+
+public:
+  mixed_matmult(unsigned tile_size, storage_precision precision = storage_precision::fp16,
+                std::shared_ptr<clutils::runtime> runtime = gpu_matmult<float>::default_runtime())
+      : gpu_matmult<float>{std::move(runtime)}, m_precision{effective_precision(*m_runtime, precision)},
+        m_tile_size{tile_size},
+        m_program{kernel::program(*m_programs, static_cast<unsigned>(m_precision), tile_size)},
+        m_functor{m_program, kernel::entry()} {}
+
+  // The precision A and B are stored with, fp32 when the requested one isn't supported
+  storage_precision precision() const { return m_precision; }
+
+  matrix_type<float> operator()(const matrix_type<float> &mata, const matrix_type<float> &matb,
+                                profiling_info *time = nullptr) override {
+    if (m_precision == storage_precision::fp32) return gpu_matmult<float>::operator()(mata, matb, time);
+    if (mata.cols() != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
+    const matrix_sizes sizes = {mata.rows(), mata.cols(), matb.cols()};
+
+    auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto stats_before = m_pool.stats();
+
+    const auto a = to_storage(mata), b = to_storage(matb);
+    matrix_type<float> matc = {sizes.ax, sizes.by};
+    const std::size_t bin_a = a.size() * sizeof(cl_ushort), bin_b = b.size() * sizeof(cl_ushort),
+                      bin_c = sizes.ax * sizes.by * sizeof(float);
+
+    auto lease_a = m_pool.acquire(bin_a, CL_MEM_READ_ONLY), lease_b = m_pool.acquire(bin_b, CL_MEM_READ_ONLY);
+    auto lease_c = m_pool.acquire(bin_c, CL_MEM_WRITE_ONLY);
+
+    std::vector<clutils::profiled_event> events = {{"upload A", kind::upload, {}}, {"upload B", kind::upload, {}}};
+    m_queue.enqueueWriteBuffer(lease_a.buffer(), CL_FALSE, 0, bin_a, a.data(), nullptr, &events[0].event);
+    m_queue.enqueueWriteBuffer(lease_b.buffer(), CL_FALSE, 0, bin_b, b.data(), nullptr, &events[1].event);
+
+    cl::Event event = launch(m_functor, lease_a.buffer(), lease_b.buffer(), lease_c.buffer(), sizes, {});
+    events.push_back({"matmult", kind::kernel, event});
+
+    events.push_back({"download C", kind::download, {}});
+    m_queue.enqueueReadBuffer(lease_c.buffer(), CL_TRUE, 0, bin_c, matc.data(), nullptr, &events.back().event);
+
+    auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (time) {
+      std::chrono::nanoseconds pure_start{event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+          pure_end{event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+      const auto stats_after = m_pool.stats();
+      *time = {pure_end - pure_start, wall_end - wall_start, stats_after.hits - stats_before.hits,
+               stats_after.misses - stats_before.misses, clutils::collect_timings(events)};
+    }
+
+    return matc;
+  }
+};
+
+// Tile sizes the device can launch: tile_size^2 work-items per group within CL_DEVICE_MAX_WORK_GROUP_SIZE and the
+// tiles of A and B within CL_DEVICE_LOCAL_MEM_SIZE
+template <typename T> std::vector<unsigned> tile_candidates(const cl::Device &device) {
+  const std::size_t max_group = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+  const std::size_t local_mem = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+  std::vector<unsigned> candidates;
+  for (std::size_t tile = 2; tile * tile <= max_group && 2 * tile * tile * sizeof(T) <= local_mem; tile *= 2)
+    candidates.push_back(tile);
+  return candidates;
+}
+
+inline std::string tiled_kernel_name(bool arbitrary) { return (arbitrary ? "matmult-tiledarb" : "matmult-tiled"); }
+
+// Multiply random square matrices with every candidate tile size and return the fastest one. Each tile size runs once
+// to warm up and then repetitions times, the median wall time of multiply counts. Tile sizes the driver refuses to
+// build or launch are skipped.
+template <typename T>
+unsigned autotune_tile(std::shared_ptr<clutils::runtime> runtime, bool arbitrary, std::size_t size = 1024,
+                       unsigned repetitions = 5, std::ostream *log = nullptr) {
+  if (!repetitions) throw std::invalid_argument{"Autotuning needs at least one repetition"};
+  const auto candidates = tile_candidates<T>(runtime->device());
+  if (candidates.empty()) throw std::runtime_error{"Device can't run the tiled kernels for this type"};
+
+  matrix_type<T> a{size, size}, b{size, size};
+  auto random_filler = clutils::create_random_number_generator<T>(T(0), T(32));
+  random_filler(a);
+  random_filler(b);
+
+  std::optional<std::pair<unsigned, std::chrono::nanoseconds>> best;
+  for (auto tile : candidates) {
+    std::vector<std::chrono::nanoseconds> times;
+    try {
+      std::unique_ptr<i_matmult<T>> mult;
+      if (arbitrary) mult = std::make_unique<tiled_arbitrary_matmult<T>>(tile, runtime);
+      else mult = std::make_unique<tiled_matmult<T>>(tile, runtime);
+
+      for (unsigned r = 0; r <= repetitions; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        mult->multiply(a, b);
+        if (r) times.push_back(std::chrono::steady_clock::now() - start); // The first run only warms up
+      }
+    } catch (cl::Error &) {
+      if (log) *log << "Info: skipping tile=" << tile << ", the device can't run it\n";
+      continue;
+    }
+
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    const auto median = times[times.size() / 2];
+    if (log) *log << "Info: tile=" << tile << ": " << median.count() << " ns\n";
+    if (!best || median < best->second) best.emplace(tile, median);
+  }
+
+  if (!best) throw std::runtime_error{"None of the tile sizes could run on the device"};
+  return best->first;
+}
+
+} // namespace matmult
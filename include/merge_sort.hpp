@@ -0,0 +1,178 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "buffer_pool.hpp"
+#include "opencl_include.hpp"
+#include "runtime.hpp"
+#include "type_name.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "kernelhpp/merge_block_kernel.hpp"
+#include "kernelhpp/merge_partition_kernel.hpp"
+
+namespace bitonic {
+
+// Merges sorted runs on the device. Every pass merges neighbouring runs pairwise, so k runs take ceil(log2 k) passes
+// of O(n) work, each a merge-path partition of the output into tiles of tile_size elements and a merge of every tile
+// in local memory by tile_size / elems_per_thread work-items. As a sorter it first sorts segments of segment_size with
+// the local bitonic kernel and merges them instead of running the global steps of the network, O(log n) passes over
+// global memory instead of O(log^2 n). Runs given to merge_runs() are merged as they are, which keeps the work done
+// upstream, e.g. by shards that sorted their part of the data.
+template <typename T, typename t_name = clutils::type_name<T>> class merge_sort : public gpu_bitonic<T> {
+  using kernel_initial = bitonic_local_initial_kernel;
+  using kernel_partition = merge_partition_kernel;
+  using kernel_block = merge_block_kernel;
+
+private:
+  cl::Program m_program_initial, m_program_partition, m_program_block;
+  typename kernel_initial::functor_type m_functor_initial;
+  typename kernel_partition::functor_type m_functor_partition;
+  typename kernel_block::functor_type m_functor_block;
+  unsigned m_segment_size, m_tile_size, m_group_size;
+
+  // Reused by every sort, see radix_sort
+  clutils::buffer_pool::lease m_scratch, m_splits;
+
+  using gpu_bitonic<T>::m_ctx;
+  using gpu_bitonic<T>::m_queue;
+  using gpu_bitonic<T>::m_pool;
+  using gpu_bitonic<T>::m_programs;
+
+  using typename gpu_bitonic<T>::size_type;
+
+  cl::Buffer &reserve(clutils::buffer_pool::lease &lease, std::size_t bin_size) {
+    if (!lease.buffer()() || lease.capacity() < bin_size) lease = m_pool.acquire(bin_size);
+    return lease.buffer();
+  }
+
+  // Run bounds are copied when the buffer is created, so the host vector may go away before the kernels run
+  cl::Buffer make_offsets(std::span<const unsigned> offsets) {
+    std::vector<cl_uint> bounds{offsets.begin(), offsets.end()};
+    return {m_ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, clutils::sizeof_container(bounds), bounds.data()};
+  }
+
+  // Merge the runs bounded by offsets (runs + 1 entries) with the result ending up in buf
+  void enqueue_merge(cl::Buffer &buf, size_type size, const cl::Buffer &offsets, unsigned runs, kernel_events &events) {
+    const unsigned tiles = (size + m_tile_size - 1) / m_tile_size;
+    auto &scratch = reserve(m_scratch, std::size_t{size} * sizeof(T));
+    auto &splits = reserve(m_splits, std::size_t{tiles + 1} * sizeof(cl_uint));
+
+    cl::Buffer *src = &buf, *dst = &scratch;
+    for (unsigned stride = 1, pass = 0; stride < runs; stride *= 2, ++pass) {
+      const auto name = std::to_string(pass);
+      auto partition = events.record("merge partition " + name,
+                                     m_functor_partition({m_queue, tiles + 1}, *src, offsets, splits, runs, stride,
+                                                         size, tiles));
+      events.last = events.record("merge " + name, m_functor_block({m_queue, tiles * m_group_size, m_group_size},
+                                                                   *src, *dst, offsets, splits, runs, stride, size));
+      if (!events.first()) events.first = partition;
+      std::swap(src, dst);
+    }
+
+    if (src == &buf) return;
+    cl::Event copy;
+    m_queue.enqueueCopyBuffer(*src, buf, 0, 0, std::size_t{size} * sizeof(T), nullptr, &copy);
+    events.last = events.record("merge copy", copy);
+  }
+
+protected:
+  kernel_events enqueue_sort(cl::Buffer &buf, size_type size) override {
+    const unsigned stages = std::countr_zero(std::bit_ceil(size)), segment_stages = std::countr_zero(m_segment_size);
+    const unsigned runs = active_segments(size, m_segment_size);
+
+    kernel_events events;
+    const cl::EnqueueArgs args{m_queue, runs * (m_segment_size / 2), m_segment_size / 2};
+    events.first = events.last =
+        events.record("local initial", m_functor_initial(args, buf, 0, std::min(stages, segment_stages), 0, size));
+    if (runs < 2) return events;
+
+    std::vector<unsigned> offsets(runs + 1);
+    for (unsigned i = 0; i <= runs; ++i)
+      offsets[i] = std::min<std::size_t>(std::size_t{i} * m_segment_size, size);
+
+    enqueue_merge(buf, size, make_offsets(offsets), runs, events);
+    return events;
+  }
+
+public:
+  merge_sort(const unsigned segment_size = 256, const unsigned tile_size = 1024, const unsigned elems_per_thread = 8,
+             std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime())
+      : gpu_bitonic<T>{std::move(runtime)},
+        m_program_initial{kernel_initial::program(*m_programs, t_name::name_str, segment_size)},
+        m_program_partition{kernel_partition::program(*m_programs, t_name::name_str, tile_size)},
+        m_program_block{kernel_block::program(*m_programs, t_name::name_str, tile_size, elems_per_thread)},
+        m_functor_initial{m_program_initial, kernel_initial::entry()},
+        m_functor_partition{m_program_partition, kernel_partition::entry()},
+        m_functor_block{m_program_block, kernel_block::entry()}, m_segment_size{segment_size},
+        m_tile_size{tile_size}, m_group_size{elems_per_thread ? tile_size / elems_per_thread : 0} {
+    if (std::popcount(segment_size) != 1 || segment_size < 2)
+      throw std::runtime_error{"Segment size must be a natural power of 2"};
+    if (!elems_per_thread || !m_group_size || tile_size % elems_per_thread != 0)
+      throw std::runtime_error{"Tile size must be a positive multiple of the elements per thread"};
+  }
+
+  // Merge the sorted runs [offsets[i], offsets[i + 1]) of container into one sorted sequence. Offsets must start at 0,
+  // be non-decreasing and end at the container size. Equal elements keep the order of their runs.
+  void merge_runs(std::span<T> container, std::span<const unsigned> offsets, clutils::profiling_info *time = nullptr) {
+    this->check_fits(container.size());
+    if (offsets.empty() || offsets.front() != 0 || offsets.back() != container.size() ||
+        !std::is_sorted(offsets.begin(), offsets.end()))
+      throw std::invalid_argument{"Run offsets must be non-decreasing from 0 to the container size"};
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    if (time) *time = {};
+    const unsigned runs = offsets.size() - 1;
+    if (runs < 2 || container.size() < 2) return;
+
+    const auto stats_before = m_pool.stats();
+    const size_type size = container.size();
+    const auto bin_size = clutils::sizeof_container(container);
+    auto lease = m_pool.acquire(bin_size);
+
+    std::vector<clutils::profiled_event> transfers = {{"upload", clutils::command_kind::upload, {}},
+                                                      {"download", clutils::command_kind::download, {}}};
+    m_queue.enqueueWriteBuffer(lease.buffer(), CL_FALSE, 0, bin_size, container.data(), nullptr, &transfers[0].event);
+
+    kernel_events events;
+    enqueue_merge(lease.buffer(), size, make_offsets(offsets), runs, events);
+
+    m_queue.enqueueReadBuffer(lease.buffer(), CL_TRUE, 0, bin_size, container.data(), nullptr, &transfers[1].event);
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    if (!time) return;
+
+    const auto stats_after = m_pool.stats();
+    const std::chrono::nanoseconds pure_start{events.first.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        pure_end{events.last.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+
+    time->pure = pure_end - pure_start;
+    time->wall = wall_end - wall_start;
+    time->pool_hits = stats_after.hits - stats_before.hits;
+    time->pool_misses = stats_after.misses - stats_before.misses;
+
+    events.all.insert(events.all.begin(), transfers.front());
+    events.all.push_back(transfers.back());
+    time->commands = clutils::collect_timings(events.all);
+  }
+};
+
+} // namespace bitonic
@@ -0,0 +1,146 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "selector.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bitonic {
+
+// Sample sort over several devices, each with its own context and queue. Splitters taken from a regular sample of the
+// input cut the value range into one bucket per device, the host scatters every element into its bucket and the
+// buckets are sorted concurrently with local_bitonic. Sorted buckets follow each other, so no merge is needed.
+// OpenCL has no peer transfers between contexts, which is why the exchange happens on the host before the upload: that
+// way every element crosses the bus once in each direction, the same as with a single device.
+template <typename T, typename t_name = clutils::type_name<T>> class multi_gpu_bitonic : public i_bitonic_sort<T> {
+  std::vector<std::unique_ptr<local_bitonic<T, t_name>>> m_sorters;
+  std::shared_ptr<clutils::thread_pool> m_pool;
+  std::vector<T> m_scratch;
+
+  static constexpr std::size_t oversampling = 64;             // Sample elements per bucket
+  static constexpr std::size_t min_size_per_device = 1 << 16; // Shorter inputs are sorted on the first device alone
+
+  std::vector<T> choose_splitters(std::span<const T> container, std::size_t buckets) const {
+    const std::size_t sample_size = std::min(container.size(), oversampling * buckets);
+    std::vector<T> sample(sample_size);
+    for (std::size_t i = 0; i < sample_size; ++i)
+      sample[i] = container[i * container.size() / sample_size];
+    std::sort(sample.begin(), sample.end());
+
+    std::vector<T> splitters(buckets - 1);
+    for (std::size_t i = 1; i < buckets; ++i)
+      splitters[i - 1] = sample[i * sample_size / buckets];
+    return splitters;
+  }
+
+  // Stable scatter of container into m_scratch by bucket. Every task counts the buckets of its chunk, an exclusive scan
+  // over chunks and buckets gives every chunk its output positions. Returns the bucket boundaries.
+  std::vector<std::size_t> partition(std::span<const T> container, const std::vector<T> &splitters) {
+    const std::size_t size = container.size(), buckets = splitters.size() + 1;
+    const std::size_t chunks = 4 * m_pool->size(), chunk_length = (size + chunks - 1) / chunks;
+    const auto bucket_of = [&splitters](const T &value) {
+      return static_cast<std::size_t>(std::upper_bound(splitters.begin(), splitters.end(), value) - splitters.begin());
+    };
+
+    std::vector<std::size_t> offsets(chunks * buckets);
+    m_pool->parallel_for(0, chunks, 1, [&](std::size_t first, std::size_t last) {
+      for (std::size_t c = first; c < last; ++c)
+        for (std::size_t i = c * chunk_length; i < std::min(size, (c + 1) * chunk_length); ++i)
+          ++offsets[c * buckets + bucket_of(container[i])];
+    });
+
+    std::vector<std::size_t> bounds(buckets + 1);
+    for (std::size_t b = 0, position = 0; b < buckets; ++b) {
+      bounds[b] = position;
+      for (std::size_t c = 0; c < chunks; ++c)
+        position += std::exchange(offsets[c * buckets + b], position);
+    }
+    bounds[buckets] = size;
+
+    m_scratch.resize(size);
+    m_pool->parallel_for(0, chunks, 1, [&](std::size_t first, std::size_t last) {
+      for (std::size_t c = first; c < last; ++c)
+        for (std::size_t i = c * chunk_length; i < std::min(size, (c + 1) * chunk_length); ++i)
+          m_scratch[offsets[c * buckets + bucket_of(container[i])]++] = container[i];
+    });
+
+    return bounds;
+  }
+
+public:
+  static constexpr clutils::platform_version cl_api_version = {2, 2};
+
+  multi_gpu_bitonic(const unsigned segment_size, const unsigned max_fused_steps = 4,
+                    std::vector<cl::Device> devices = clutils::select_devices(cl_api_version),
+                    std::shared_ptr<clutils::thread_pool> pool = std::make_shared<clutils::thread_pool>())
+      : m_pool{std::move(pool)} {
+    if (devices.empty()) throw std::invalid_argument{"Multi-device sort requires at least one device"};
+    for (auto &device : devices)
+      m_sorters.push_back(std::make_unique<local_bitonic<T, t_name>>(
+          segment_size, max_fused_steps, std::make_shared<clutils::runtime>(std::move(device))));
+  }
+
+  unsigned devices() const { return m_sorters.size(); }
+
+  // Pure time is the longest device time of all buckets
+  void operator()(std::span<T> container, clutils::profiling_info *info) override {
+    const std::size_t size = container.size();
+    const std::size_t buckets = std::clamp<std::size_t>(size / min_size_per_device, 1, m_sorters.size());
+
+    if (buckets == 1) return m_sorters.front()->sort(container, info);
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto bounds = partition(container, choose_splitters(container, buckets));
+
+    std::vector<sort_handle<T>> handles;
+    const std::span<T> scratch{m_scratch};
+    for (std::size_t b = 0; b < buckets; ++b)
+      handles.push_back(m_sorters[b]->sort_async(scratch.subspan(bounds[b], bounds[b + 1] - bounds[b])));
+
+    clutils::profiling_info total = {}, bucket_info;
+    for (auto &handle : handles) {
+      handle.wait(&bucket_info);
+      total.pure = std::max(total.pure, bucket_info.pure);
+      total.pool_hits += bucket_info.pool_hits;
+      total.pool_misses += bucket_info.pool_misses;
+
+      // Devices have their own clocks, every bucket keeps the timeline of its device
+      const auto device = "device " + std::to_string(&handle - handles.data()) + ": ";
+      for (auto &command : bucket_info.commands) {
+        command.name = device + command.name;
+        total.commands.push_back(std::move(command));
+      }
+    }
+
+    m_pool->parallel_for(0, size, size / m_pool->size() + 1, [&](std::size_t first, std::size_t last) {
+      std::copy(m_scratch.begin() + first, m_scratch.begin() + last, container.begin() + first);
+    });
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (!info) return;
+    *info = total;
+    info->wall = wall_end - wall_start;
+  }
+};
+
+} // namespace bitonic
@@ -0,0 +1,266 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace bitonic {
+
+// Merge sorted runs into output with a binary heap of the current run heads
+template <typename T> void heap_merge(std::span<const std::span<const T>> runs, std::span<T> output) {
+  using head = std::pair<T, std::size_t>; // Value and run index
+  const auto greater = [](const head &a, const head &b) { return b.first < a.first; };
+
+  std::vector<head> heap;
+  std::vector<std::size_t> cursors(runs.size(), 0);
+  for (std::size_t r = 0; r < runs.size(); ++r)
+    if (!runs[r].empty()) heap.emplace_back(runs[r].front(), r);
+  std::make_heap(heap.begin(), heap.end(), greater);
+
+  auto out = output.begin();
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), greater);
+    auto &[value, r] = heap.back();
+    *out++ = value;
+
+    if (++cursors[r] < runs[r].size()) {
+      value = runs[r][cursors[r]];
+      std::push_heap(heap.begin(), heap.end(), greater);
+    } else {
+      heap.pop_back();
+    }
+  }
+}
+
+// K-way merge split by value: splitters sampled from the runs cut every run with lower_bound, the slices between two
+// consecutive splitters hold all elements of one value range and are merged into their place of the output by their
+// own task.
+template <typename T>
+void parallel_multiway_merge(clutils::thread_pool &pool, std::span<const std::span<const T>> runs,
+                             std::span<T> output) {
+  std::size_t total = 0;
+  for (const auto &run : runs)
+    total += run.size();
+  if (total != output.size()) throw std::invalid_argument{"Output length must match the runs"};
+
+  constexpr std::size_t min_part = 1 << 18; // Shorter parts don't pay off the binary searches and task overhead
+  const std::size_t parts = std::clamp<std::size_t>(total / min_part, 1, 4 * pool.size());
+
+  std::vector<T> sample, splitters;
+  for (const auto &run : runs)
+    for (std::size_t i = 1; i < parts && !run.empty(); ++i)
+      sample.push_back(run[i * run.size() / parts]);
+  std::sort(sample.begin(), sample.end());
+  for (std::size_t i = 1; i < parts && !sample.empty(); ++i)
+    splitters.push_back(sample[i * sample.size() / parts]);
+  splitters.erase(std::unique(splitters.begin(), splitters.end()), splitters.end());
+
+  // cuts[p * runs + r] is where part p starts in run r, part p covers values in [splitters[p - 1], splitters[p])
+  const std::size_t part_count = splitters.size() + 1;
+  std::vector<std::size_t> cuts((part_count + 1) * runs.size()), starts(part_count + 1, 0);
+  for (std::size_t r = 0; r < runs.size(); ++r) {
+    for (std::size_t p = 1; p < part_count; ++p)
+      cuts[p * runs.size() + r] =
+          std::lower_bound(runs[r].begin(), runs[r].end(), splitters[p - 1]) - runs[r].begin();
+    cuts[part_count * runs.size() + r] = runs[r].size();
+  }
+  for (std::size_t p = 0; p < part_count; ++p) {
+    starts[p + 1] = starts[p];
+    for (std::size_t r = 0; r < runs.size(); ++r)
+      starts[p + 1] += cuts[(p + 1) * runs.size() + r] - cuts[p * runs.size() + r];
+  }
+
+  pool.parallel_for(0, part_count, 1, [&](std::size_t first, std::size_t last) {
+    std::vector<std::span<const T>> slices(runs.size());
+    for (std::size_t p = first; p < last; ++p) {
+      for (std::size_t r = 0; r < runs.size(); ++r) {
+        const auto begin = cuts[p * runs.size() + r], end = cuts[(p + 1) * runs.size() + r];
+        slices[r] = runs[r].subspan(begin, end - begin);
+      }
+      heap_merge<T>(slices, output.subspan(starts[p], starts[p + 1] - starts[p]));
+    }
+  });
+}
+
+// Cut sorted runs so that the prefixes hold the rank smallest elements. The pivot comes from the middle of the widest
+// remaining window, so every round halves it.
+template <typename T> std::vector<std::size_t> select_prefixes(std::span<const std::span<T>> runs, std::size_t rank) {
+  std::vector<std::size_t> lo(runs.size(), 0), hi(runs.size()), lower(runs.size()), upper(runs.size());
+  for (std::size_t r = 0; r < runs.size(); ++r)
+    hi[r] = runs[r].size();
+
+  for (;;) {
+    std::size_t widest = 0;
+    for (std::size_t r = 1; r < runs.size(); ++r)
+      if (hi[r] - lo[r] > hi[widest] - lo[widest]) widest = r;
+    if (hi[widest] == lo[widest]) return lo;
+
+    const T pivot = runs[widest][lo[widest] + (hi[widest] - lo[widest]) / 2];
+    std::size_t below = 0, through = 0;
+    for (std::size_t r = 0; r < runs.size(); ++r) {
+      const auto first = runs[r].begin() + lo[r], last = runs[r].begin() + hi[r];
+      lower[r] = std::lower_bound(first, last, pivot) - runs[r].begin();
+      upper[r] = std::upper_bound(first + (lower[r] - lo[r]), last, pivot) - runs[r].begin();
+      below += lower[r];
+      through += upper[r];
+    }
+
+    if (rank < below) {
+      hi = lower;
+    } else if (rank > through) {
+      lo = upper;
+    } else {
+      // Elements equal to the pivot go to the prefixes in run order until the rank is reached
+      for (std::size_t r = 0; r < runs.size(); ++r) {
+        const auto equal = std::min(upper[r] - lower[r], rank - below);
+        lower[r] += equal;
+        below += equal;
+      }
+      return lower;
+    }
+  }
+}
+
+// Merge sorted runs lying back to back in container, in place. Each round merges the smallest scratch.size() elements
+// into scratch, moves what is left of the runs to the back and copies the merged elements into the freed front.
+template <typename T>
+void in_place_multiway_merge(clutils::thread_pool &pool, std::vector<std::span<T>> runs, std::span<T> container,
+                             std::span<T> scratch) {
+  if (scratch.empty()) throw std::invalid_argument{"Merge needs a scratch buffer"};
+
+  const auto parallel_copy = [&pool](std::span<const T> from, std::span<T> to) {
+    pool.parallel_for(0, from.size(), from.size() / pool.size() + 1, [&](std::size_t first, std::size_t last) {
+      std::copy(from.begin() + first, from.begin() + last, to.begin() + first);
+    });
+  };
+
+  for (std::size_t merged = 0; runs.size() > 1;) {
+    const auto take = std::min(scratch.size(), container.size() - merged);
+    const auto cuts = select_prefixes<T>(runs, take);
+
+    std::vector<std::span<const T>> prefixes;
+    for (std::size_t r = 0; r < runs.size(); ++r)
+      prefixes.push_back(runs[r].first(cuts[r]));
+    parallel_multiway_merge<T>(pool, prefixes, scratch.first(take));
+
+    // Suffixes only move towards the end, so going from the last run keeps the unmoved ones intact
+    auto end = container.size();
+    for (std::size_t r = runs.size(); r-- > 0;) {
+      const auto suffix = runs[r].subspan(cuts[r]);
+      std::move_backward(suffix.begin(), suffix.end(), container.begin() + end);
+      end -= suffix.size();
+      runs[r] = container.subspan(end, suffix.size());
+    }
+    std::erase_if(runs, [](const std::span<T> &run) { return run.empty(); });
+
+    parallel_copy(scratch.first(take), container.subspan(merged, take));
+    merged += take;
+  }
+}
+
+// Sort for sequences that don't fit into device memory. The sequence is cut into power of two long chunks that fit
+// the device. The chunks are streamed through local_bitonic with the sort_many pipeline, so uploads, kernels and
+// downloads of different chunks overlap, and the sorted runs are written back in place. A k-way merge on the thread
+// pool produces the result, in place it needs a scratch of an eighth of the sequence. Lengths are 64-bit, only a chunk
+// has to be indexable by the kernels.
+template <typename T, typename t_name = clutils::type_name<T>> class out_of_core_bitonic : public i_bitonic_sort<T> {
+  using typename i_bitonic_sort<T>::size_type;
+
+  local_bitonic<T, t_name> m_sorter;
+  std::shared_ptr<clutils::thread_pool> m_pool;
+  size_type m_chunk_size;
+  unsigned m_depth;
+
+  static constexpr std::size_t merge_rounds = 8; // In place merge rounds, each moves the rest of the runs once
+
+  // The pipeline keeps depth chunks in device memory at once, leave a quarter of it to the driver and other users
+  size_type default_chunk_size() const {
+    const std::size_t global_mem = m_sorter.device().template getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+    const std::size_t by_global = global_mem / 4 * 3 / m_depth / sizeof(T);
+    return std::bit_floor(std::min(by_global, m_sorter.max_sort_size()));
+  }
+
+  // Sort the chunks of container in place through the pipeline, pure time is its device time
+  std::vector<std::span<T>> sort_chunks(std::span<T> container, clutils::profiling_info *info) {
+    std::vector<std::span<T>> chunks;
+    for (size_type offset = 0; offset < container.size(); offset += m_chunk_size)
+      chunks.push_back(container.subspan(offset, std::min(m_chunk_size, container.size() - offset)));
+
+    clutils::batch_profiling_info pipeline_info;
+    m_sorter.sort_many(chunks, &pipeline_info, m_depth);
+
+    if (info) {
+      *info = {};
+      info->pure = pipeline_info.pure;
+    }
+    return chunks;
+  }
+
+public:
+  // chunk_size = 0 picks the largest power of two that fits the device
+  out_of_core_bitonic(const unsigned segment_size, size_type chunk_size = 0, const unsigned depth = 3,
+                      const unsigned max_fused_steps = 4,
+                      std::shared_ptr<clutils::thread_pool> pool = std::make_shared<clutils::thread_pool>(),
+                      std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime())
+      : m_sorter{segment_size, max_fused_steps, std::move(runtime)}, m_pool{std::move(pool)}, m_depth{depth} {
+    if (depth < 2) throw std::invalid_argument{"Pipeline depth must be at least 2"};
+    m_chunk_size = (chunk_size ? chunk_size : default_chunk_size());
+    if (m_chunk_size < 2 || m_chunk_size > m_sorter.max_sort_size())
+      throw std::invalid_argument{"Chunk must hold at least 2 elements and fit into one device buffer"};
+  }
+
+  size_type chunk_size() const { return m_chunk_size; }
+
+  // Sort container into output of the same length, e.g. a memory mapped file. The container is left holding the sorted
+  // runs. Pure time is the device time of the chunk pipeline.
+  void sort_to(std::span<T> container, std::span<T> output, clutils::profiling_info *info = nullptr) {
+    if (output.size() != container.size()) throw std::invalid_argument{"Output length must match the input"};
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    const auto chunks = sort_chunks(container, info);
+
+    if (chunks.size() == 1) {
+      std::copy(container.begin(), container.end(), output.begin());
+    } else {
+      const std::vector<std::span<const T>> runs{chunks.begin(), chunks.end()};
+      parallel_multiway_merge<T>(*m_pool, runs, output);
+    }
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    if (info) info->wall = wall_end - wall_start;
+  }
+
+  void operator()(std::span<T> container, clutils::profiling_info *info) override {
+    if (container.size() <= m_chunk_size) return m_sorter.sort(container, info);
+
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    auto chunks = sort_chunks(container, info);
+
+    std::vector<T> scratch((container.size() + merge_rounds - 1) / merge_rounds);
+    in_place_multiway_merge<T>(*m_pool, std::move(chunks), container, scratch);
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    if (info) info->wall = wall_end - wall_start;
+  }
+};
+
+} // namespace bitonic
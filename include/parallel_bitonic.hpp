@@ -0,0 +1,137 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "simd_bitonic.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace bitonic {
+
+// Multithreaded bitonic network on a persistent work-stealing pool, organised like local_bitonic. The sequence is cut
+// into cache sized blocks: the first log2(block_size) stages sort every block independently, later stages first run
+// their steps with strides >= block_size and then finish the remaining steps block by block. Strided steps only
+// compare elements whose positions modulo block_size are r or block_size - 1 - r, so every task owns a range of such
+// residues for all strided steps of a stage. That leaves two joins per stage. Blocks are processed with simd_network.
+template <typename T> class parallel_bitonic_sort : public i_bitonic_sort<T> {
+  using typename i_bitonic_sort<T>::size_type;
+
+  std::shared_ptr<clutils::thread_pool> m_pool;
+  std::size_t m_block_size;
+  std::vector<T> m_scratch; // Padded copy for sequences that are not a power of two long
+
+  static void compare_exchange(T &first, T &second) { scalar_network<T>::compare_exchange(first, second); }
+
+  // Steps of a stage with strides >= block_size restricted to residues [r_begin, r_end) < block_size / 2 and their
+  // mirrors
+  void strided_steps(std::span<T> data, std::size_t part_length, std::size_t r_begin, std::size_t r_end) const {
+    const std::size_t block = m_block_size, count = r_end - r_begin;
+    const std::size_t mirror_begin = block - r_end;
+
+    // Flip step: i and part_length - 1 - i lie in blocks q and part_length / block - 1 - q with mirrored residues
+    for (std::size_t offset = 0; offset < data.size(); offset += part_length) {
+      T *part = data.data() + offset;
+      for (std::size_t q = 0; q < part_length / block / 2; ++q) {
+        T *low = part + q * block, *high = part + part_length - (q + 1) * block;
+        for (std::size_t r = 0; r < count; ++r) {
+          compare_exchange(low[r_begin + r], high[block - 1 - r_begin - r]);
+          compare_exchange(low[mirror_begin + r], high[block - 1 - mirror_begin - r]);
+        }
+      }
+    }
+
+    for (std::size_t half_length = part_length / 4; half_length >= block; half_length /= 2) {
+      for (std::size_t offset = 0; offset < data.size(); offset += half_length * 2) {
+        T *part = data.data() + offset;
+        for (std::size_t q = 0; q < half_length / block; ++q) {
+          T *low = part + q * block, *high = low + half_length;
+          for (std::size_t r = r_begin; r < r_end; ++r)
+            compare_exchange(low[r], high[r]);
+          for (std::size_t r = mirror_begin; r < mirror_begin + count; ++r)
+            compare_exchange(low[r], high[r]);
+        }
+      }
+    }
+  }
+
+  void sort_padded(std::span<T> data) {
+    const std::size_t length = data.size(), block = std::min(m_block_size, length);
+    const std::size_t blocks = length / block;
+
+    m_pool->parallel_for(0, blocks, 1, [&](std::size_t first, std::size_t last) {
+      for (std::size_t b = first; b < last; ++b)
+        simd_network<T>::sort(data.subspan(b * block, block));
+    });
+
+    if (blocks == 1) return;
+
+    // Enough residue ranges to keep every worker busy, but long enough to stream through memory. Blocks shorter than
+    // 32 elements are a single range.
+    const std::size_t half_block = block / 2, min_grain = std::min<std::size_t>(16, half_block);
+    const std::size_t residue_grain = std::clamp<std::size_t>(half_block / (4 * m_pool->size()), min_grain, half_block);
+
+    for (std::size_t part_length = block * 2; part_length <= length; part_length *= 2) {
+      m_pool->parallel_for(0, half_block, residue_grain, [&](std::size_t r_begin, std::size_t r_end) {
+        strided_steps(data, part_length, r_begin, r_end);
+      });
+
+      m_pool->parallel_for(0, blocks, 1, [&](std::size_t first, std::size_t last) {
+        for (std::size_t b = first; b < last; ++b)
+          simd_network<T>::merge(data.subspan(b * block, block));
+      });
+    }
+  }
+
+public:
+  static constexpr std::size_t default_block_size = 1 << 15;
+
+  parallel_bitonic_sort(std::shared_ptr<clutils::thread_pool> pool = std::make_shared<clutils::thread_pool>(),
+                        std::size_t block_size = default_block_size)
+      : m_pool{std::move(pool)}, m_block_size{block_size} {
+    if (std::popcount(block_size) != 1 || block_size < 2)
+      throw std::runtime_error{"Block size must be a natural power of 2"};
+  }
+
+  void operator()(std::span<T> container, clutils::profiling_info *info) override {
+    const size_type size = container.size();
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+
+    if (size >= 2) {
+      const size_type padded_size = std::bit_ceil(size);
+      if (padded_size == size) {
+        sort_padded(container);
+      } else {
+        m_scratch.assign(container.begin(), container.end());
+        m_scratch.resize(padded_size, padding_value<T>());
+        sort_padded(m_scratch);
+        std::copy_n(m_scratch.begin(), size, container.begin());
+      }
+    }
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (info) {
+      *info = {};
+      info->wall = info->pure = wall_end - wall_start;
+    }
+  }
+};
+
+} // namespace bitonic
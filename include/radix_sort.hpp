@@ -0,0 +1,122 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "buffer_pool.hpp"
+#include "opencl_include.hpp"
+#include "runtime.hpp"
+#include "type_name.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "kernelhpp/radix_histogram_kernel.hpp"
+#include "kernelhpp/radix_scan_kernel.hpp"
+#include "kernelhpp/radix_scatter_kernel.hpp"
+
+namespace bitonic {
+
+// Unsigned key with the order of T, see radix_key in kernels/radix_histogram.cl
+template <typename T> struct radix_key_traits {
+  static_assert(sizeof(T) == 4 || sizeof(T) == 8, "Radix sort supports 32 and 64-bit keys");
+
+  static constexpr const char *key_type = (sizeof(T) == 8 ? "ulong" : "uint");
+  static constexpr unsigned key_kind = (std::is_floating_point_v<T> ? 2 : (std::is_signed_v<T> ? 1 : 0));
+  static constexpr unsigned key_bits = sizeof(T) * 8;
+};
+
+// LSD radix sort with 4-bit digits: every digit is a histogram, an exclusive scan of the histograms and a stable
+// scatter into a second buffer, 8 passes for 32-bit keys and 16 for 64-bit ones. It moves O(n) data per digit instead
+// of the O(n log^2 n) of the bitonic network, which pays off for long sequences. Signed and floating keys are mapped to
+// unsigned ones with the same order (floats as IEEE 754 total order of the bits, -0 before +0, NaNs at the ends).
+// Work-groups of group_size work-items handle blocks of group_size * tiles_per_group elements.
+template <typename T, typename t_name = clutils::type_name<T>> class radix_sort : public gpu_bitonic<T> {
+  using kernel_histogram = radix_histogram_kernel;
+  using kernel_scan = radix_scan_kernel;
+  using kernel_scatter = radix_scatter_kernel;
+  using traits = radix_key_traits<T>;
+
+  static constexpr unsigned radix_bits = 4, radix = 1 << radix_bits;
+  static_assert(traits::key_bits % (2 * radix_bits) == 0, "Even number of passes leaves the result in place");
+
+private:
+  cl::Program m_program_histogram, m_program_scan, m_program_scatter;
+  typename kernel_histogram::functor_type m_functor_histogram;
+  typename kernel_scan::functor_type m_functor_scan;
+  typename kernel_scatter::functor_type m_functor_scatter;
+  unsigned m_group_size, m_block_size;
+
+  // Reused by every sort: all kernels run on the in-order m_queue, so a later sort only touches them after the
+  // previous one is done with them
+  clutils::buffer_pool::lease m_scratch, m_counts;
+
+  using gpu_bitonic<T>::m_queue;
+  using gpu_bitonic<T>::m_pool;
+  using gpu_bitonic<T>::m_programs;
+
+  using typename gpu_bitonic<T>::size_type;
+
+  cl::Buffer &reserve(clutils::buffer_pool::lease &lease, std::size_t bin_size) {
+    if (!lease.buffer()() || lease.capacity() < bin_size) lease = m_pool.acquire(bin_size);
+    return lease.buffer();
+  }
+
+protected:
+  kernel_events enqueue_sort(cl::Buffer &buf, size_type size) override {
+    const unsigned groups = (size + m_block_size - 1) / m_block_size, counts_length = radix * groups;
+    auto &scratch = reserve(m_scratch, std::size_t{size} * sizeof(T));
+    auto &counts = reserve(m_counts, std::size_t{counts_length} * sizeof(cl_uint));
+
+    const cl::NDRange blocks{groups * m_group_size}, group{m_group_size};
+    kernel_events events;
+
+    for (unsigned shift = 0; shift < traits::key_bits; shift += radix_bits) {
+      auto &src = (shift / radix_bits % 2 ? scratch : buf), &dst = (shift / radix_bits % 2 ? buf : scratch);
+
+      const auto digit = std::to_string(shift / radix_bits);
+      const cl::EnqueueArgs block_args{m_queue, blocks, group};
+      auto histogram = events.record("radix histogram " + digit,
+                                     m_functor_histogram(block_args, src, counts, shift, size, m_block_size));
+      events.record("radix scan " + digit, m_functor_scan({m_queue, group, group}, counts, counts_length));
+      events.last = events.record("radix scatter " + digit,
+                                  m_functor_scatter(block_args, src, dst, counts, shift, size, m_block_size));
+      if (!shift) events.first = histogram;
+    }
+
+    return events;
+  }
+
+public:
+  radix_sort(const unsigned group_size = 256, const unsigned tiles_per_group = 16,
+             std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime())
+      : gpu_bitonic<T>{std::move(runtime)},
+        m_program_histogram{kernel_histogram::program(*m_programs, t_name::name_str, traits::key_type, traits::key_kind,
+                                                      radix_bits)},
+        m_program_scan{kernel_scan::program(*m_programs, group_size)},
+        m_program_scatter{kernel_scatter::program(*m_programs, t_name::name_str, traits::key_type, traits::key_kind,
+                                                  radix_bits, group_size)},
+        m_functor_histogram{m_program_histogram, kernel_histogram::entry()},
+        m_functor_scan{m_program_scan, kernel_scan::entry()},
+        m_functor_scatter{m_program_scatter, kernel_scatter::entry()}, m_group_size{group_size},
+        m_block_size{group_size * tiles_per_group} {
+    if (std::popcount(group_size) != 1 || group_size < radix)
+      throw std::runtime_error{"Work-group size must be a power of 2 not less than 16"};
+    if (!tiles_per_group) throw std::runtime_error{"Number of tiles per work-group must be positive"};
+  }
+};
+
+} // namespace bitonic
@@ -0,0 +1,200 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#if __has_include(<experimental/simd>)
+#include <experimental/simd>
+#define BITONIC_SIMD_AVAILABLE 1
+#else
+#define BITONIC_SIMD_AVAILABLE 0
+#endif
+
+namespace bitonic {
+
+// Scalar bitonic network over power of two long ranges, used for short ranges and where vectors are unavailable
+template <typename T> struct scalar_network {
+  static void compare_exchange(T &first, T &second) {
+    const auto a = first, b = second;
+    first = std::min(a, b);
+    second = std::max(a, b);
+  }
+
+  static void step(std::span<T> data, std::size_t half_length, bool flip) {
+    const std::size_t part_length = half_length * 2;
+    for (std::size_t offset = 0; offset < data.size(); offset += part_length) {
+      T *part = data.data() + offset;
+      if (flip) {
+        for (std::size_t i = 0; i < half_length; ++i)
+          compare_exchange(part[i], part[part_length - i - 1]);
+      } else {
+        for (std::size_t i = 0; i < half_length; ++i)
+          compare_exchange(part[i], part[i + half_length]);
+      }
+    }
+  }
+
+  // Whole network
+  static void sort(std::span<T> data) {
+    for (std::size_t part_length = 2; part_length <= data.size(); part_length *= 2) {
+      step(data, part_length / 2, true);
+      for (std::size_t half_length = part_length / 4; half_length > 0; half_length /= 2)
+        step(data, half_length, false);
+    }
+  }
+
+  // Non-flip steps half_length = size / 2, ..., 1 finishing the last stage
+  static void merge(std::span<T> data) {
+    for (std::size_t half_length = data.size() / 2; half_length > 0; half_length /= 2)
+      step(data, half_length, false);
+  }
+};
+
+#if BITONIC_SIMD_AVAILABLE
+
+// Bitonic network on the widest vectors of the target (SSE/AVX2/AVX-512/NEON, picked by the compiler flags, see
+// OPTIMIZE_FOR_NATIVE). Steps with half_length >= width compare whole vectors with min/max, the steps inside a vector
+// are done with lane permutations, all steps of a stage that fit into one vector are applied while it stays loaded.
+template <typename T> class simd_network {
+  using simd_type = std::experimental::native_simd<T>;
+
+public:
+  static constexpr std::size_t width = simd_type::size();
+
+private:
+  static simd_type load(const T *ptr) { return simd_type{ptr, std::experimental::element_aligned}; }
+  static void store(const simd_type &vec, T *ptr) { vec.copy_to(ptr, std::experimental::element_aligned); }
+
+  static simd_type reverse(const simd_type &vec) {
+    return simd_type{[&vec](auto lane) { return vec[width - 1 - lane]; }};
+  }
+
+  // Compare-exchange of lane l with lane l ^ mask, lanes with the half bit cleared get the minimum
+  template <std::size_t mask, std::size_t half> static simd_type exchange(const simd_type &vec) {
+    const simd_type partner{[&vec](auto lane) { return vec[lane ^ mask]; }};
+    const auto lo = std::experimental::min(vec, partner), hi = std::experimental::max(vec, partner);
+    return simd_type{[&lo, &hi](auto lane) {
+      if constexpr ((lane & half) == 0) return lo[lane];
+      else return hi[lane];
+    }};
+  }
+
+  // Steps half_length = top_half, ..., 1 inside the vector, the step with half_length == flip_half is a flip
+  template <std::size_t half = width / 2>
+  static void exchange_steps(simd_type &vec, std::size_t top_half, std::size_t flip_half) {
+    if constexpr (half > 0) {
+      if (half <= top_half) vec = (half == flip_half ? exchange<2 * half - 1, half>(vec) : exchange<half, half>(vec));
+      exchange_steps<half / 2>(vec, top_half, flip_half);
+    }
+  }
+
+  static void vector_step(std::span<T> data, std::size_t half_length, bool flip) {
+    const std::size_t part_length = half_length * 2;
+
+    for (std::size_t offset = 0; offset < data.size(); offset += part_length) {
+      T *part = data.data() + offset;
+
+      for (std::size_t i = 0; i < half_length; i += width) {
+        if (flip) { // The first step in a stage pairs i with part_length - i - 1
+          T *second = part + part_length - i - width;
+          const auto a = load(part + i), b = reverse(load(second));
+          store(std::experimental::min(a, b), part + i);
+          store(reverse(std::experimental::max(a, b)), second);
+        } else {
+          const auto a = load(part + i), b = load(part + i + half_length);
+          store(std::experimental::min(a, b), part + i);
+          store(std::experimental::max(a, b), part + i + half_length);
+        }
+      }
+    }
+  }
+
+  static void register_steps(std::span<T> data, std::size_t top_half, std::size_t flip_half) {
+    for (std::size_t offset = 0; offset < data.size(); offset += width) {
+      auto vec = load(data.data() + offset);
+      exchange_steps(vec, top_half, flip_half);
+      store(vec, data.data() + offset);
+    }
+  }
+
+public:
+  // Ranges shorter than two vectors go through scalar_network
+  static bool supported(std::size_t length) { return width >= 2 && length >= 2 * width; }
+
+  static void sort(std::span<T> data) {
+    if (!supported(data.size())) return scalar_network<T>::sort(data);
+
+    for (std::size_t part_length = 2; part_length <= data.size(); part_length *= 2) {
+      std::size_t half_length = part_length / 2;
+      for (; half_length >= width; half_length /= 2)
+        vector_step(data, half_length, half_length == part_length / 2);
+      register_steps(data, half_length, (half_length == part_length / 2 ? half_length : 0));
+    }
+  }
+
+  static void merge(std::span<T> data) {
+    if (!supported(data.size())) return scalar_network<T>::merge(data);
+
+    std::size_t half_length = data.size() / 2;
+    for (; half_length >= width; half_length /= 2)
+      vector_step(data, half_length, false);
+    register_steps(data, half_length, 0);
+  }
+};
+
+#else
+
+template <typename T> using simd_network = scalar_network<T>;
+
+#endif
+
+// Bitonic sort on simd_network. Falls back to the scalar network without std::experimental::simd.
+template <typename T> class simd_bitonic_sort : public i_bitonic_sort<T> {
+  using typename i_bitonic_sort<T>::size_type;
+
+  std::vector<T> m_scratch; // Padded copy for sequences that are not a power of two long
+
+public:
+  void operator()(std::span<T> container, clutils::profiling_info *info) override {
+    const size_type size = container.size();
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+
+    if (size >= 2) {
+      const size_type padded_size = std::bit_ceil(size);
+      if (padded_size == size) {
+        simd_network<T>::sort(container);
+      } else {
+        // Padding with the largest value keeps the real elements in front
+        m_scratch.assign(container.begin(), container.end());
+        m_scratch.resize(padded_size, padding_value<T>());
+        simd_network<T>::sort(m_scratch);
+        std::copy_n(m_scratch.begin(), size, container.begin());
+      }
+    }
+
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+
+    if (info) {
+      *info = {};
+      info->wall = info->pure = wall_end - wall_start;
+    }
+  }
+};
+
+} // namespace bitonic
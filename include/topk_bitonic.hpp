@@ -0,0 +1,180 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy us a beer in
+ * return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+
+#include "bitonic.hpp"
+#include "buffer_pool.hpp"
+#include "opencl_include.hpp"
+#include "runtime.hpp"
+#include "type_name.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "kernelhpp/bitonic_topk_kernel.hpp"
+
+namespace bitonic {
+
+// padding_value() spelled as an OpenCL C literal
+template <typename T> std::string padding_literal() {
+  if constexpr (std::numeric_limits<T>::has_infinity) return "INFINITY";
+  else {
+    return std::to_string(std::numeric_limits<T>::max()) + (std::is_unsigned_v<T> ? "U" : "") +
+           (sizeof(T) == 8 ? "L" : "");
+  }
+}
+
+// Sorter that can also select the k smallest elements without sorting the rest. Segments of segment_size are sorted
+// with the local bitonic kernel and only the first k' = bit_ceil(k) of each are kept. Every reduction pass then halves
+// the number of runs: a bitonic split of two runs keeps the smaller half, which a bitonic merge of log k' local memory
+// steps rebuilds into a sorted run. A pass reads and writes k' elements per run, so after the local sort the work is
+// O(n / segment_size * k' log k') and only k elements are read back. Larger k fall back to a full sort.
+template <typename T, typename t_name = clutils::type_name<T>>
+class topk_bitonic : public local_bitonic<T, t_name> {
+  using kernel_initial = bitonic_local_initial_kernel;
+  using kernel_topk = bitonic_topk_kernel;
+
+  cl::Program m_program_initial;
+  typename kernel_initial::functor_type m_functor_initial;
+  std::map<unsigned, typename kernel_topk::functor_type> m_functors; // Built on first use for every run length
+  unsigned m_segment_size;
+
+  // Ping-pong buffers of the reduction passes, reused by every selection
+  clutils::buffer_pool::lease m_first, m_second;
+
+  using local_bitonic<T, t_name>::m_queue;
+  using local_bitonic<T, t_name>::m_programs;
+  using gpu_bitonic<T>::m_pool;
+
+  using typename local_bitonic<T, t_name>::size_type;
+
+  typename kernel_topk::functor_type &get_functor(unsigned run_length) {
+    auto found = m_functors.find(run_length);
+    if (found != m_functors.end()) return found->second;
+
+    typename kernel_topk::functor_type functor{
+        kernel_topk::program(*m_programs, t_name::name_str, run_length, padding_literal<T>()), kernel_topk::entry()};
+    return m_functors.emplace(run_length, functor).first->second;
+  }
+
+  cl::Buffer &reserve(clutils::buffer_pool::lease &lease, std::size_t bin_size) {
+    if (!lease.buffer()() || lease.capacity() < bin_size) lease = m_pool.acquire(bin_size);
+    return lease.buffer();
+  }
+
+  // Real elements of a run, the same as in the kernel
+  static unsigned run_size(unsigned run, unsigned runs, unsigned stride, unsigned total, unsigned run_length) {
+    if (run >= runs || std::size_t{run} * stride >= total) return 0;
+    return std::min(run_length, total - run * stride);
+  }
+
+  // Leave the run_length smallest elements of buf sorted at the start of the returned buffer
+  cl::Buffer &enqueue_select(cl::Buffer &buf, size_type size, unsigned run_length, kernel_events &events) {
+    const unsigned stages = std::countr_zero(std::bit_ceil(size)), segment_stages = std::countr_zero(m_segment_size);
+    unsigned runs = active_segments(size, m_segment_size);
+
+    const cl::EnqueueArgs args{m_queue, runs * (m_segment_size / 2), m_segment_size / 2};
+    events.first = events.last =
+        events.record("local initial", m_functor_initial(args, buf, 0, std::min(stages, segment_stages), 0, size));
+
+    // Run r of the sorted segments starts at r * segment_size, reduced runs are stored back to back
+    auto &functor = get_functor(run_length);
+    cl::Buffer *src = &buf;
+    unsigned stride = m_segment_size, total = size;
+
+    for (unsigned pass = 0; runs > 1; ++pass) {
+      const unsigned reduced = (runs + 1) / 2, last = 2 * (reduced - 1);
+      auto &dst = reserve(pass % 2 ? m_second : m_first, std::size_t{reduced} * run_length * sizeof(T));
+      events.last = events.record("topk reduce " + std::to_string(pass),
+                                  functor({m_queue, reduced * (run_length / 2), run_length / 2}, *src, dst, stride,
+                                          total, runs));
+
+      // Only the last run may be shorter than run_length
+      const unsigned last_size = run_size(last, runs, stride, total, run_length) +
+                                 run_size(last + 1, runs, stride, total, run_length);
+      total = (reduced - 1) * run_length + std::min(run_length, last_size);
+      stride = run_length;
+      runs = reduced;
+      src = &dst;
+    }
+
+    return *src;
+  }
+
+public:
+  topk_bitonic(const unsigned segment_size, const unsigned max_fused_steps = 4,
+               std::shared_ptr<clutils::runtime> runtime = gpu_bitonic<T>::default_runtime())
+      : local_bitonic<T, t_name>{segment_size, max_fused_steps, std::move(runtime)},
+        m_program_initial{kernel_initial::program(*m_programs, t_name::name_str, segment_size)},
+        m_functor_initial{m_program_initial, kernel_initial::entry()}, m_segment_size{segment_size} {}
+
+  // Largest k selected without sorting the whole sequence
+  std::size_t max_select_size() const { return m_segment_size; }
+
+  // The min(k, size) smallest elements of container in ascending order
+  std::vector<T> smallest(std::span<const T> container, std::size_t k, clutils::profiling_info *time = nullptr) {
+    this->check_fits(container.size());
+    const auto wall_start = std::chrono::high_resolution_clock::now();
+    if (time) *time = {};
+
+    const size_type size = container.size();
+    k = std::min<std::size_t>(k, size);
+    if (size < 2) return {container.begin(), container.begin() + k};
+
+    std::vector<T> result(k);
+    if (!k) return result;
+
+    const auto stats_before = m_pool.stats();
+    const auto bin_size = clutils::sizeof_container(container);
+    auto lease = m_pool.acquire(bin_size);
+
+    std::vector<clutils::profiled_event> transfers = {{"upload", clutils::command_kind::upload, {}},
+                                                      {"download", clutils::command_kind::download, {}}};
+    m_queue.enqueueWriteBuffer(lease.buffer(), CL_FALSE, 0, bin_size, container.data(), nullptr, &transfers[0].event);
+
+    kernel_events events;
+    const unsigned run_length = std::max(std::bit_ceil(static_cast<unsigned>(k)), 2u);
+    cl::Buffer *selected = &lease.buffer();
+    if (run_length > m_segment_size) events = this->enqueue_sort(lease.buffer(), size);
+    else selected = &enqueue_select(lease.buffer(), size, run_length, events);
+
+    m_queue.enqueueReadBuffer(*selected, CL_TRUE, 0, clutils::sizeof_container(result), result.data(), nullptr,
+                              &transfers[1].event);
+    const auto wall_end = std::chrono::high_resolution_clock::now();
+    if (!time) return result;
+
+    const auto stats_after = m_pool.stats();
+    const std::chrono::nanoseconds pure_start{events.first.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
+        pure_end{events.last.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
+
+    time->pure = pure_end - pure_start;
+    time->wall = wall_end - wall_start;
+    time->pool_hits = stats_after.hits - stats_before.hits;
+    time->pool_misses = stats_after.misses - stats_before.misses;
+
+    events.all.insert(events.all.begin(), transfers.front());
+    events.all.push_back(transfers.back());
+    time->commands = clutils::collect_timings(events.all);
+    return result;
+  }
+};
+
+} // namespace bitonic
@@ -0,0 +1,47 @@
+/* FUSED_STEPS consecutive non-flip steps step_lo + FUSED_STEPS - 1, ..., step_lo of the network in one launch. The
+ * elements compared by these steps form independent groups of 2^FUSED_STEPS elements spaced by 2^step_lo, every
+ * work-item loads one group into registers, runs all steps on it and writes it back. This replaces FUSED_STEPS full
+ * passes over global memory with one. Elements with index >= size are ordered after every element.
+ *
+ *  @kernel    ( {"name" : "bitonic_fused_kernel", "entry" : "fused_bitonic"} )
+ *  @signature ( ["cl::Buffer", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "FUSED_STEPS"}, {"type" : "std::string", "name": "LESS", "default": "a < b"}, {"type" : "unsigned", "name": "DESCENDING", "default": 0}] )
+ *  @preamble  ( ["bitonic_order.clh"] )
+ *
+ */
+
+#define GROUP_SIZE (1 << FUSED_STEPS)
+
+__kernel void fused_bitonic(__global TYPE *buf, uint step_lo, uint size) {
+  uint gid = get_global_id(0);
+
+  // Spread gid around the FUSED_STEPS bits starting at step_lo, which enumerate the elements of the group
+  const uint stride = 1 << step_lo;
+  const uint low = gid & (stride - 1), high = gid >> step_lo;
+  const uint base = (high << (step_lo + FUSED_STEPS)) | low;
+
+  TYPE regs[GROUP_SIZE];
+
+#pragma unroll
+  for (uint m = 0; m < GROUP_SIZE; ++m) {
+    const uint index = base + m * stride;
+    if (index < size) regs[m] = buf[index];
+  }
+
+#pragma unroll
+  for (uint half_length = GROUP_SIZE / 2; half_length > 0; half_length >>= 1) {
+#pragma unroll
+    for (uint q = 0; q < GROUP_SIZE / 2; ++q) {
+      const uint part_index = q / half_length;
+      const uint i = q - part_index * half_length;
+      const uint first_index = part_index * half_length * 2 + i, second_index = first_index + half_length;
+      if (base + second_index * stride < size) SORT2(regs[first_index], regs[second_index]);
+    }
+  }
+
+#pragma unroll
+  for (uint m = 0; m < GROUP_SIZE; ++m) {
+    const uint index = base + m * stride;
+    if (index < size) buf[index] = regs[m];
+  }
+}
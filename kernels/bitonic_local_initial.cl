@@ -1,35 +1,31 @@
 /* Simplest possible bitonic sort using only global memory. Note: SEGMENT_SIZE should be a power of 2
- * (obviously)
+ * (obviously). Elements with index >= size are virtual padding ordered after every element: they are never loaded,
+ * compared or stored.
  *
  *  @kernel    ( {"name" : "bitonic_local_initial_kernel", "entry" : "local_initial"} )
- *  @signature ( ["cl::Buffer", "unsigned", "unsigned", "unsigned"] )
- *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}] )
+ *  @signature ( ["cl::Buffer", "unsigned", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}, {"type" : "std::string", "name": "LESS", "default": "a < b"}, {"type" : "unsigned", "name": "DESCENDING", "default": 0}] )
+ *  @preamble  ( ["bitonic_order.clh"] )
  *
  */
 
-#define SORT2(a, b)                                                                                                    \
-  if (a > b) {                                                                                                         \
-    TYPE temp = a;                                                                                                     \
-    a = b;                                                                                                             \
-    b = temp;                                                                                                          \
-  }
-
 #define HALF_SEGMENT_SIZE (SEGMENT_SIZE / 2)
 #define LOCAL_THREADS HALF_SEGMENT_SIZE
 
-__kernel void local_initial(__global TYPE *buf, uint stage_start, uint stage_end, uint step_offset) {
+__kernel void local_initial(__global TYPE *buf, uint stage_start, uint stage_end, uint step_offset, uint size) {
   uint gid = get_global_id(0);
   uint lid = get_local_id(0);
   uint sid = (gid / HALF_SEGMENT_SIZE);
 
   uint local_first_load_id = lid, local_second_load_id = SEGMENT_SIZE - lid - 1;
 
-  uint first_data_load_id = sid * SEGMENT_SIZE + lid;
-  uint second_data_load_id = sid * SEGMENT_SIZE + SEGMENT_SIZE - 1 - lid;
+  uint segment_offset = sid * SEGMENT_SIZE;
+  uint first_data_load_id = segment_offset + lid;
+  uint second_data_load_id = segment_offset + SEGMENT_SIZE - 1 - lid;
 
   __local TYPE segment[SEGMENT_SIZE];
-  segment[local_first_load_id] = buf[first_data_load_id];
-  segment[local_second_load_id] = buf[second_data_load_id];
+  if (first_data_load_id < size) segment[local_first_load_id] = buf[first_data_load_id];
+  if (second_data_load_id < size) segment[local_second_load_id] = buf[second_data_load_id];
   barrier(CLK_LOCAL_MEM_FENCE);
 
   for (uint stage = stage_start; stage < stage_end; ++stage) {
@@ -49,11 +45,11 @@ __kernel void local_initial(__global TYPE *buf, uint stage_start, uint stage_end
       const uint offset = part_index * part_length;
       const uint first_index = offset + i, second_index = offset + j;
 
-      SORT2(segment[first_index], segment[second_index]);
+      if (segment_offset + second_index < size) SORT2(segment[first_index], segment[second_index]);
       barrier(CLK_LOCAL_MEM_FENCE);
     }
   }
 
-  buf[first_data_load_id] = segment[local_first_load_id];
-  buf[second_data_load_id] = segment[local_second_load_id];
+  if (first_data_load_id < size) buf[first_data_load_id] = segment[local_first_load_id];
+  if (second_data_load_id < size) buf[second_data_load_id] = segment[local_second_load_id];
 }
\ No newline at end of file
@@ -0,0 +1,84 @@
+/* Key-value variant of local_initial: keys and values of a segment are both staged in local memory and swapped
+ * together. Pairs are ordered by key, then by value. SEGMENT_SIZE should be a power of 2, elements with index >= size
+ * are virtual and ordered after every element.
+ *
+ *  @kernel    ( {"name" : "bitonic_local_initial_kv_kernel", "entry" : "local_initial_kv"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "unsigned", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "VALUE_TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}] )
+ *
+ */
+
+#define SORT2_KV(a, b, va, vb)                                                                                         \
+  if (a > b || (a == b && va > vb)) {                                                                                  \
+    TYPE temp = a;                                                                                                     \
+    a = b;                                                                                                             \
+    b = temp;                                                                                                          \
+    VALUE_TYPE value_temp = va;                                                                                        \
+    va = vb;                                                                                                           \
+    vb = value_temp;                                                                                                   \
+  }
+
+#define HALF_SEGMENT_SIZE (SEGMENT_SIZE / 2)
+#define LOCAL_THREADS HALF_SEGMENT_SIZE
+
+__kernel void local_initial_kv(__global TYPE *keys, __global VALUE_TYPE *values, uint stage_start, uint stage_end,
+                               uint step_offset, uint size) {
+  uint gid = get_global_id(0);
+  uint lid = get_local_id(0);
+  uint sid = (gid / HALF_SEGMENT_SIZE);
+
+  uint local_first_load_id = lid, local_second_load_id = SEGMENT_SIZE - lid - 1;
+
+  uint segment_offset = sid * SEGMENT_SIZE;
+  uint first_data_load_id = segment_offset + lid;
+  uint second_data_load_id = segment_offset + SEGMENT_SIZE - 1 - lid;
+
+  __local TYPE segment[SEGMENT_SIZE];
+  __local VALUE_TYPE segment_values[SEGMENT_SIZE];
+
+  if (first_data_load_id < size) {
+    segment[local_first_load_id] = keys[first_data_load_id];
+    segment_values[local_first_load_id] = values[first_data_load_id];
+  }
+
+  if (second_data_load_id < size) {
+    segment[local_second_load_id] = keys[second_data_load_id];
+    segment_values[local_second_load_id] = values[second_data_load_id];
+  }
+
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint stage = stage_start; stage < stage_end; ++stage) {
+    for (int step = stage - step_offset; step >= 0; --step) {
+      const uint half_length = 1 << step, part_length = half_length * 2;
+      const uint part_index = lid >> step;
+
+      const uint i = lid - part_index * half_length;
+      uint j;
+
+      if (stage == step) { // The first step in a stage
+        j = part_length - i - 1;
+      } else {
+        j = i + half_length;
+      }
+
+      const uint offset = part_index * part_length;
+      const uint first_index = offset + i, second_index = offset + j;
+
+      if (segment_offset + second_index < size)
+        SORT2_KV(segment[first_index], segment[second_index], segment_values[first_index],
+                 segment_values[second_index]);
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+  }
+
+  if (first_data_load_id < size) {
+    keys[first_data_load_id] = segment[local_first_load_id];
+    values[first_data_load_id] = segment_values[local_first_load_id];
+  }
+
+  if (second_data_load_id < size) {
+    keys[second_data_load_id] = segment[local_second_load_id];
+    values[second_data_load_id] = segment_values[local_second_load_id];
+  }
+}
@@ -0,0 +1,112 @@
+/* Variant of local_initial where every work-item owns ELEMS_PER_THREAD consecutive elements of the segment. Steps with
+ * part_length <= ELEMS_PER_THREAD compare elements of the same work-item and run in private registers without any
+ * barriers, local memory is only used for larger strides. SEGMENT_SIZE and ELEMS_PER_THREAD should be powers of 2,
+ * the work-group has SEGMENT_SIZE / ELEMS_PER_THREAD work-items. Elements with index >= size are virtual padding
+ * ordered after every element.
+ *
+ *  @kernel    ( {"name" : "bitonic_local_register_kernel", "entry" : "local_register"} )
+ *  @signature ( ["cl::Buffer", "unsigned", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}, {"type" : "unsigned", "name": "ELEMS_PER_THREAD"}, {"type" : "std::string", "name": "LESS", "default": "a < b"}, {"type" : "unsigned", "name": "DESCENDING", "default": 0}] )
+ *  @preamble  ( ["bitonic_order.clh"] )
+ *
+ */
+
+#define LOCAL_THREADS (SEGMENT_SIZE / ELEMS_PER_THREAD)
+#define HALF_ELEMS_PER_THREAD (ELEMS_PER_THREAD / 2)
+
+__kernel void local_register(__global TYPE *buf, uint stage_start, uint stage_end, uint step_offset, uint size) {
+  uint lid = get_local_id(0);
+  uint sid = get_group_id(0);
+
+  uint segment_offset = sid * SEGMENT_SIZE;
+  uint block_offset = lid * ELEMS_PER_THREAD; // First element of the work-item's block inside the segment
+
+  __local TYPE segment[SEGMENT_SIZE];
+  TYPE regs[ELEMS_PER_THREAD];
+
+  // Coalesced load into local memory, blocks are picked up from there
+#pragma unroll
+  for (uint k = 0; k < ELEMS_PER_THREAD; ++k) {
+    uint index = k * LOCAL_THREADS + lid;
+    if (segment_offset + index < size) segment[index] = buf[segment_offset + index];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  bool in_registers = false;
+
+  for (uint stage = stage_start; stage < stage_end; ++stage) {
+    int step = stage - step_offset;
+
+    // Strides larger than a block: every work-item handles HALF_ELEMS_PER_THREAD pairs in local memory
+    for (; (1 << step) >= ELEMS_PER_THREAD; --step) {
+      if (in_registers) {
+#pragma unroll
+        for (uint k = 0; k < ELEMS_PER_THREAD; ++k)
+          segment[block_offset + k] = regs[k];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        in_registers = false;
+      }
+
+      const uint half_length = 1 << step, part_length = half_length * 2;
+
+#pragma unroll
+      for (uint q = 0; q < HALF_ELEMS_PER_THREAD; ++q) {
+        const uint pair = lid * HALF_ELEMS_PER_THREAD + q;
+        const uint part_index = pair >> step;
+        const uint i = pair - part_index * half_length;
+        const uint j = (stage == step ? part_length - i - 1 : i + half_length);
+
+        const uint offset = part_index * part_length;
+        const uint first_index = offset + i, second_index = offset + j;
+        if (segment_offset + second_index < size) SORT2(segment[first_index], segment[second_index]);
+      }
+
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (!in_registers) {
+#pragma unroll
+      for (uint k = 0; k < ELEMS_PER_THREAD; ++k)
+        regs[k] = segment[block_offset + k];
+      in_registers = true;
+    }
+
+    // Remaining steps stay inside the block. Loops are fully unrolled, so registers are indexed with constants.
+    const uint top_half_length = 1 << step;
+
+#pragma unroll
+    for (uint half_length = HALF_ELEMS_PER_THREAD; half_length > 0; half_length >>= 1) {
+      if (half_length > top_half_length) continue;
+      const bool flip = (half_length == (1u << stage));
+
+#pragma unroll
+      for (uint q = 0; q < HALF_ELEMS_PER_THREAD; ++q) {
+        const uint part_index = q / half_length;
+        const uint i = q - part_index * half_length;
+        const uint offset = part_index * half_length * 2;
+        const uint first_index = offset + i;
+
+        if (flip) {
+          const uint second_index = offset + half_length * 2 - i - 1;
+          if (segment_offset + block_offset + second_index < size) SORT2(regs[first_index], regs[second_index]);
+        } else {
+          const uint second_index = offset + i + half_length;
+          if (segment_offset + block_offset + second_index < size) SORT2(regs[first_index], regs[second_index]);
+        }
+      }
+    }
+  }
+
+  if (in_registers) {
+#pragma unroll
+    for (uint k = 0; k < ELEMS_PER_THREAD; ++k)
+      segment[block_offset + k] = regs[k];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+#pragma unroll
+  for (uint k = 0; k < ELEMS_PER_THREAD; ++k) {
+    uint index = k * LOCAL_THREADS + lid;
+    if (segment_offset + index < size) buf[segment_offset + index] = segment[index];
+  }
+}
@@ -1,19 +1,14 @@
-/* Simplest possible bitonic sort using only global memory
+/* Simplest possible bitonic sort using only global memory. Buffer may have arbitrary length: elements with index >= size
+ * are ordered after every element, so comparisons against them never swap and they don't have to exist in memory.
  *
  *  @kernel    ( {"name" : "bitonic_naive_kernel", "entry" : "naive_bitonic"} )
- *  @signature ( ["cl::Buffer", "unsigned", "unsigned"] )
- *  @macros    ( [{"type" : "std::string", "name": "TYPE"}] )
+ *  @signature ( ["cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "LESS", "default": "a < b"}, {"type" : "unsigned", "name": "DESCENDING", "default": 0}] )
+ *  @preamble  ( ["bitonic_order.clh"] )
  *
  */
 
-#define SORT2(a, b)                                                                                                    \
-  if (a > b) {                                                                                                         \
-    TYPE temp = a;                                                                                                     \
-    a = b;                                                                                                             \
-    b = temp;                                                                                                          \
-  }
-
-__kernel void naive_bitonic(__global TYPE *buf, uint stage, uint step) {
+__kernel void naive_bitonic(__global TYPE *buf, uint stage, uint step, uint size) {
   uint gid = get_global_id(0);
 
   const uint half_length = 1 << step, part_length = half_length * 2;
@@ -30,6 +25,7 @@ __kernel void naive_bitonic(__global TYPE *buf, uint stage, uint step) {
 
   const uint offset = part_index * part_length;
   const uint first_index = offset + i, second_index = offset + j;
+  if (second_index >= size) return; // first_index < second_index, so the pair is either real or compared to padding
 
   SORT2(buf[first_index], buf[second_index]);
 }
\ No newline at end of file
@@ -0,0 +1,41 @@
+/* Key-value variant of naive_bitonic: values are moved together with their keys. Pairs are ordered by key, then by
+ * value, so sorting (key, index) pairs gives a stable argsort. Elements with index >= size are ordered after every
+ * element.
+ *
+ *  @kernel    ( {"name" : "bitonic_naive_kv_kernel", "entry" : "naive_bitonic_kv"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "VALUE_TYPE"}] )
+ *
+ */
+
+#define SORT2_KV(a, b, va, vb)                                                                                         \
+  if (a > b || (a == b && va > vb)) {                                                                                  \
+    TYPE temp = a;                                                                                                     \
+    a = b;                                                                                                             \
+    b = temp;                                                                                                          \
+    VALUE_TYPE value_temp = va;                                                                                        \
+    va = vb;                                                                                                           \
+    vb = value_temp;                                                                                                   \
+  }
+
+__kernel void naive_bitonic_kv(__global TYPE *keys, __global VALUE_TYPE *values, uint stage, uint step, uint size) {
+  uint gid = get_global_id(0);
+
+  const uint half_length = 1 << step, part_length = half_length * 2;
+  const uint part_index = gid >> step;
+
+  const uint i = gid - part_index * half_length;
+  uint j;
+
+  if (stage == step) { // The first step in a stage
+    j = part_length - i - 1;
+  } else {
+    j = i + half_length;
+  }
+
+  const uint offset = part_index * part_length;
+  const uint first_index = offset + i, second_index = offset + j;
+  if (second_index >= size) return;
+
+  SORT2_KV(keys[first_index], keys[second_index], values[first_index], values[second_index]);
+}
@@ -0,0 +1,56 @@
+/* Segmented variant of local_initial: every work-group sorts one independent segment of the flat buffer entirely in
+ * local memory. Segment s occupies [offsets[s], offsets[s + 1]), segment lengths must not exceed SEGMENT_SIZE (a power
+ * of 2). Work-group g sorts segment segments[segments_offset + g], so the host can launch all segments of the same
+ * size class with one NDRange. Elements past the end of a segment are virtual padding ordered after every element.
+ *
+ *  @kernel    ( {"name" : "bitonic_segmented_kernel", "entry" : "segmented"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "SEGMENT_SIZE"}, {"type" : "std::string", "name": "LESS", "default": "a < b"}, {"type" : "unsigned", "name": "DESCENDING", "default": 0}] )
+ *  @preamble  ( ["bitonic_order.clh"] )
+ *
+ */
+
+#define HALF_SEGMENT_SIZE (SEGMENT_SIZE / 2)
+#define LOCAL_THREADS HALF_SEGMENT_SIZE
+
+__kernel void segmented(__global TYPE *buf, __global const uint *offsets, __global const uint *segments,
+                        uint segments_offset) {
+  uint lid = get_local_id(0);
+  uint sid = segments[segments_offset + get_group_id(0)];
+
+  uint segment_offset = offsets[sid];
+  uint size = offsets[sid + 1] - segment_offset;
+  __global TYPE *data = buf + segment_offset;
+
+  uint first_load_id = lid, second_load_id = SEGMENT_SIZE - lid - 1;
+
+  __local TYPE segment[SEGMENT_SIZE];
+  if (first_load_id < size) segment[first_load_id] = data[first_load_id];
+  if (second_load_id < size) segment[second_load_id] = data[second_load_id];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint stage = 0; (1 << stage) < SEGMENT_SIZE; ++stage) {
+    for (int step = stage; step >= 0; --step) {
+      const uint half_length = 1 << step, part_length = half_length * 2;
+      const uint part_index = lid >> step;
+
+      const uint i = lid - part_index * half_length;
+      uint j;
+
+      if (stage == step) { // The first step in a stage
+        j = part_length - i - 1;
+      } else {
+        j = i + half_length;
+      }
+
+      const uint offset = part_index * part_length;
+      const uint first_index = offset + i, second_index = offset + j;
+
+      if (second_index < size) SORT2(segment[first_index], segment[second_index]);
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+  }
+
+  if (first_load_id < size) data[first_load_id] = segment[first_load_id];
+  if (second_load_id < size) data[second_load_id] = segment[second_load_id];
+}
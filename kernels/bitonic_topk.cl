@@ -0,0 +1,57 @@
+/* One reduction pass of the top-k selection. Runs are ascending sequences of RUN_LENGTH (a power of 2) elements, run r
+ * starts at r * stride in src and holds the first min(RUN_LENGTH, total - r * stride) of them, the rest is PADDING.
+ * Work-group g keeps the RUN_LENGTH smallest elements of runs 2g and 2g + 1: the minimum of the first run and the
+ * reversed second one is the lower half of a bitonic split, a bitonic sequence that is merged in local memory. The
+ * result is run g of dst, with stride RUN_LENGTH. Work-groups have RUN_LENGTH / 2 work-items.
+ *
+ *  @kernel    ( {"name" : "bitonic_topk_kernel", "entry" : "topk_reduce"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "RUN_LENGTH"}, {"type" : "std::string", "name": "PADDING"}] )
+ *
+ */
+
+#define SORT2(a, b)                                                                                                    \
+  if (a > b) {                                                                                                         \
+    TYPE temp = a;                                                                                                     \
+    a = b;                                                                                                             \
+    b = temp;                                                                                                          \
+  }
+
+#define HALF_RUN_LENGTH (RUN_LENGTH / 2)
+
+uint run_length(uint run, uint runs, uint stride, uint total) {
+  if (run >= runs || run * stride >= total) return 0;
+  return min((uint)RUN_LENGTH, total - run * stride);
+}
+
+TYPE load(__global const TYPE *src, uint run, uint length, uint stride, uint i) {
+  return (i < length ? src[run * stride + i] : (TYPE)(PADDING));
+}
+
+__kernel void topk_reduce(__global const TYPE *src, __global TYPE *dst, uint stride, uint total, uint runs) {
+  uint g = get_group_id(0);
+  uint lid = get_local_id(0);
+
+  __local TYPE tile[RUN_LENGTH];
+
+  uint a_length = run_length(2 * g, runs, stride, total), b_length = run_length(2 * g + 1, runs, stride, total);
+
+  // Step 1. Lower half of the split of a and b reversed, bitonic and holding the smallest RUN_LENGTH of both
+  for (uint i = lid; i < RUN_LENGTH; i += HALF_RUN_LENGTH) {
+    TYPE a = load(src, 2 * g, a_length, stride, i), b = load(src, 2 * g + 1, b_length, stride, RUN_LENGTH - 1 - i);
+    tile[i] = (b < a ? b : a);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // Step 2. Bitonic merge of the tile
+  for (uint half_length = HALF_RUN_LENGTH; half_length > 0; half_length /= 2) {
+    uint first_index = (lid / half_length) * 2 * half_length + lid % half_length;
+    SORT2(tile[first_index], tile[first_index + half_length]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  // Padding sorts behind the real elements and is not stored
+  uint length = min((uint)RUN_LENGTH, a_length + b_length);
+  for (uint i = lid; i < length; i += HALF_RUN_LENGTH)
+    dst[g * RUN_LENGTH + i] = tile[i];
+}
@@ -0,0 +1,52 @@
+/* Strided batched matrix multiplication with local memory. Accepts arbitrary size matrices and TILE_SIZE.
+ * The third NDRange dimension enumerates the products C_i = A_i * B_i, matrices of operand X start stride_X elements
+ * apart. A stride of 0 uses the same matrix for the whole batch.
+ *
+ *  @kernel    ( {"name" : "matmult_batched_kernel", "entry" : "batched"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int", "int", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE_SIZE"}] )
+ *
+ */
+
+__kernel void batched(__global TYPE *A, __global TYPE *B, __global TYPE *C, int AX, int AY, int BY, int tile_count,
+                      uint stride_A, uint stride_B, uint stride_C) {
+  ulong batch = get_global_id(2);
+  A += batch * stride_A;
+  B += batch * stride_B;
+  C += batch * stride_C;
+
+  int local_row = get_local_id(0);
+  int local_col = get_local_id(1);
+
+  __local TYPE tile_A[TILE_SIZE * TILE_SIZE];
+  __local TYPE tile_B[TILE_SIZE * TILE_SIZE];
+
+  int global_row = TILE_SIZE * get_group_id(0) + local_row;
+  int global_col = TILE_SIZE * get_group_id(1) + local_col;
+
+  int row_out_of_bounds = (global_row >= AX);
+  int col_out_of_bounds = (global_col >= BY);
+
+  TYPE sum = 0;
+
+  for (int t = 0; t < tile_count; ++t) {
+    int curr_tiled_col = t * TILE_SIZE + local_col;
+    int curr_tiled_row = t * TILE_SIZE + local_row;
+
+    tile_A[local_row * TILE_SIZE + local_col] =
+        ((curr_tiled_col >= AY || row_out_of_bounds) ? 0 : A[global_row * AY + curr_tiled_col]);
+    tile_B[local_row * TILE_SIZE + local_col] =
+        ((curr_tiled_row >= AY || col_out_of_bounds) ? 0 : B[BY * curr_tiled_row + global_col]);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int k = 0; k < TILE_SIZE; ++k) {
+      sum += tile_A[TILE_SIZE * local_row + k] * tile_B[k * TILE_SIZE + local_col];
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (row_out_of_bounds || col_out_of_bounds) return;
+  C[global_row * BY + global_col] = sum;
+}
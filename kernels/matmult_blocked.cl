@@ -0,0 +1,88 @@
+/* Register blocked matrix multiplication. Accepts arbitrary size matrices.
+ * Every work-group computes a TILE_SIZE x TILE_SIZE block of C, every work-item a BLOCK_ROWS x BLOCK_COLS micro-tile
+ * of it accumulated in registers. Rows of the micro-tile are TILE_SIZE / BLOCK_ROWS apart, columns come in vectors of
+ * 4 that are 4 * TILE_SIZE / BLOCK_COLS apart, so neighbouring work-items read neighbouring words of local memory.
+ * Per step of the inner product a work-item loads BLOCK_ROWS values of A and BLOCK_COLS / 4 vectors of B and does
+ * BLOCK_ROWS * BLOCK_COLS multiply-adds with them. TILE_SIZE must be a multiple of both blocks and BLOCK_COLS of 4.
+ *
+ *  @kernel    ( {"name" : "matmult_blocked_kernel", "entry" : "blocked"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type": "unsigned", "name": "TILE_SIZE"}, {"type": "unsigned", "name": "TILE_DEPTH"}, {"type": "unsigned", "name": "BLOCK_ROWS"}, {"type": "unsigned", "name": "BLOCK_COLS"}] )
+ *
+ */
+
+#define CONCAT0(a, b) a##b
+#define CONCAT(a, b) CONCAT0(a, b)
+#define VECTOR_TYPE CONCAT(TYPE, 4)
+
+#define THREADS_ROWS (TILE_SIZE / BLOCK_ROWS)
+#define THREADS_COLS (TILE_SIZE / BLOCK_COLS)
+#define VECTORS_COLS (BLOCK_COLS / 4)
+
+__kernel void blocked(__global TYPE *A, __global TYPE *B, __global TYPE *C, int AX, int AY, int BY) {
+  int local_row = get_local_id(0);
+  int local_col = get_local_id(1);
+  int local_id = local_row * THREADS_COLS + local_col;
+
+  int block_row = get_group_id(0) * TILE_SIZE;
+  int block_col = get_group_id(1) * TILE_SIZE;
+
+  __local TYPE tile_A[TILE_SIZE * TILE_DEPTH];
+  __local TYPE tile_B[TILE_DEPTH * TILE_SIZE];
+
+  VECTOR_TYPE acc[BLOCK_ROWS][VECTORS_COLS];
+  for (int i = 0; i < BLOCK_ROWS; ++i)
+    for (int v = 0; v < VECTORS_COLS; ++v)
+      acc[i][v] = (VECTOR_TYPE)(0);
+
+  for (int t = 0; t < AY; t += TILE_DEPTH) {
+    // Step 1. Work-items copy both tiles element by element in row-major order, so global reads are coalesced.
+    // Elements outside of the matrices are zero.
+    for (int idx = local_id; idx < TILE_SIZE * TILE_DEPTH; idx += THREADS_ROWS * THREADS_COLS) {
+      int a_row = block_row + idx / TILE_DEPTH, a_col = t + idx % TILE_DEPTH;
+      int b_row = t + idx / TILE_SIZE, b_col = block_col + idx % TILE_SIZE;
+      tile_A[idx] = ((a_row >= AX || a_col >= AY) ? 0 : A[a_row * AY + a_col]);
+      tile_B[idx] = ((b_row >= AY || b_col >= BY) ? 0 : B[b_row * BY + b_col]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Step 2. Outer products of a column of A and a row of B fragments, every loaded value is reused from registers.
+    for (int k = 0; k < TILE_DEPTH; ++k) {
+      TYPE frag_A[BLOCK_ROWS];
+      VECTOR_TYPE frag_B[VECTORS_COLS];
+
+      for (int i = 0; i < BLOCK_ROWS; ++i)
+        frag_A[i] = tile_A[(local_row + i * THREADS_ROWS) * TILE_DEPTH + k];
+      for (int v = 0; v < VECTORS_COLS; ++v)
+        frag_B[v] = vload4(0, tile_B + k * TILE_SIZE + (local_col + v * THREADS_COLS) * 4);
+
+      for (int i = 0; i < BLOCK_ROWS; ++i)
+        for (int v = 0; v < VECTORS_COLS; ++v)
+          acc[i][v] = acc[i][v] + frag_B[v] * frag_A[i];
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  for (int i = 0; i < BLOCK_ROWS; ++i) {
+    int row = block_row + local_row + i * THREADS_ROWS;
+    if (row >= AX) break;
+
+    for (int v = 0; v < VECTORS_COLS; ++v) {
+      int col = block_col + (local_col + v * THREADS_COLS) * 4;
+      __global TYPE *dst = C + row * BY + col;
+      VECTOR_TYPE sum = acc[i][v];
+
+      if (col + 4 <= BY) {
+        vstore4(sum, 0, dst);
+        continue;
+      }
+
+      // Last columns of a matrix whose width isn't a multiple of 4
+      if (col < BY) dst[0] = sum.x;
+      if (col + 1 < BY) dst[1] = sum.y;
+      if (col + 2 < BY) dst[2] = sum.z;
+    }
+  }
+}
@@ -0,0 +1,65 @@
+/* Tiled matrix multiplication of 16-bit matrices with fp32 accumulation. Accepts arbitrary size matrices and TILE_SIZE.
+ * A and B are stored in STORAGE format both in global and local memory: 0 for fp32, 1 for fp16 (needs cl_khr_fp16),
+ * 2 for bfloat16, the upper half of an fp32 kept in an ushort. Products are summed in fp32 and C is fp32.
+ *
+ *  @kernel    ( {"name" : "matmult_mixed_kernel", "entry" : "tiled_mixed"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "int", "int", "int", "int"] )
+ *  @macros    ( [{"type": "unsigned", "name": "STORAGE"}, {"type": "unsigned", "name": "TILE_SIZE"}] )
+ *
+ */
+
+#if STORAGE == 1
+#pragma OPENCL EXTENSION cl_khr_fp16 : enable
+#define STORAGE_TYPE half
+#define TO_FLOAT(x) ((float)(x))
+#elif STORAGE == 2
+#define STORAGE_TYPE ushort
+#define TO_FLOAT(x) as_float((uint)(x) << 16)
+#else
+#define STORAGE_TYPE float
+#define TO_FLOAT(x) (x)
+#endif
+
+__kernel void tiled_mixed(__global STORAGE_TYPE *A, __global STORAGE_TYPE *B, __global float *C, int AX, int AY,
+                          int BY, int tile_count) {
+  int tile_row = get_group_id(0);
+  int tile_col = get_group_id(1);
+
+  int local_row = get_local_id(0);
+  int local_col = get_local_id(1);
+
+  __local STORAGE_TYPE tile_A[TILE_SIZE * TILE_SIZE];
+  __local STORAGE_TYPE tile_B[TILE_SIZE * TILE_SIZE];
+
+  int global_row = TILE_SIZE * tile_row + local_row;
+  int global_col = TILE_SIZE * tile_col + local_col;
+
+  int row_out_of_bounds = (global_row >= AX);
+  int col_out_of_bounds = (global_col >= BY);
+
+  float sum = 0;
+
+  for (int t = 0; t < tile_count; ++t) {
+    // Step 1. Copy the tiles without conversion, so they take half of the local memory of fp32 ones. All zero bit
+    // patterns are zero in every format.
+    int curr_tiled_col = t * TILE_SIZE + local_col;
+    int curr_tiled_row = t * TILE_SIZE + local_row;
+
+    tile_A[local_row * TILE_SIZE + local_col] =
+        ((curr_tiled_col >= AY || row_out_of_bounds) ? 0 : A[global_row * AY + curr_tiled_col]);
+    tile_B[local_row * TILE_SIZE + local_col] =
+        ((curr_tiled_row >= AY || col_out_of_bounds) ? 0 : B[BY * curr_tiled_row + global_col]);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Step 2. Widen both operands and accumulate in fp32
+    for (int k = 0; k < TILE_SIZE; ++k) {
+      sum += TO_FLOAT(tile_A[TILE_SIZE * local_row + k]) * TO_FLOAT(tile_B[k * TILE_SIZE + local_col]);
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if (row_out_of_bounds || col_out_of_bounds) return;
+  C[global_row * BY + global_col] = sum;
+}
@@ -0,0 +1,77 @@
+/* Block-local merging of one merge pass, see kernels/merge_partition.cl for the runs and splits. Work-group g writes
+ * output tile [g * TILE_SIZE, (g + 1) * TILE_SIZE) of dst: the parts of both runs feeding it are staged in local
+ * memory, every work-item finds the start of its ELEMS_PER_THREAD outputs with a merge-path search there and merges
+ * them sequentially. A tile covering the ends of several short pairs handles them one after another. Work-groups have
+ * TILE_SIZE / ELEMS_PER_THREAD work-items.
+ *
+ *  @kernel    ( {"name" : "merge_block_kernel", "entry" : "merge_block"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "TILE_SIZE"}, {"type" : "unsigned", "name": "ELEMS_PER_THREAD"}] )
+ *
+ */
+
+#define GROUP_SIZE (TILE_SIZE / ELEMS_PER_THREAD)
+
+uint run_bound(__global const uint *offsets, uint runs, uint run) { return offsets[min(run, runs)]; }
+
+uint find_pair(__global const uint *offsets, uint runs, uint stride, uint pos) {
+  uint lo = 0, hi = (runs + 2 * stride - 1) / (2 * stride);
+  while (hi - lo > 1) {
+    uint mid = (lo + hi) / 2;
+    if (run_bound(offsets, runs, 2 * mid * stride) <= pos) lo = mid;
+    else hi = mid;
+  }
+  return lo;
+}
+
+__kernel void merge_block(__global const TYPE *src, __global TYPE *dst, __global const uint *offsets,
+                          __global const uint *splits, uint runs, uint stride, uint size) {
+  uint g = get_group_id(0);
+  uint lid = get_local_id(0);
+
+  __local TYPE tile[TILE_SIZE];
+
+  uint tile_begin = g * TILE_SIZE, tile_end = min(tile_begin + TILE_SIZE, size);
+
+  for (uint pos = tile_begin; pos < tile_end;) {
+    // Step 1. Bounds of the pair merged into [pos, section_end), the same for the whole work-group
+    uint pair = find_pair(offsets, runs, stride, pos);
+    uint a_begin = run_bound(offsets, runs, 2 * pair * stride);
+    uint b_begin = run_bound(offsets, runs, (2 * pair + 1) * stride);
+    uint b_end = run_bound(offsets, runs, (2 * pair + 2) * stride);
+    uint section_end = min(tile_end, b_end);
+
+    // Elements of the first run before both ends of the section, the pair starts or ends inside the tile otherwise
+    uint a_lo = (pos == tile_begin ? splits[g] : 0);
+    uint a_hi = (section_end == tile_end && tile_end < b_end ? splits[g + 1] : b_begin - a_begin);
+    uint b_lo = pos - a_begin - a_lo, b_hi = section_end - a_begin - a_hi;
+    uint a_length = a_hi - a_lo, b_length = b_hi - b_lo, length = section_end - pos;
+
+    // Step 2. Stage the section's inputs, the part of the first run followed by the part of the second one
+    for (uint i = lid; i < length; i += GROUP_SIZE)
+      tile[i] = (i < a_length ? src[a_begin + a_lo + i] : src[b_begin + b_lo + i - a_length]);
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Step 3. Merge path within local memory, then a sequential merge of this work-item's outputs.
+    // The first run's part is tile[0, a_length), the second one's is tile[a_length, length).
+    uint k = lid * ELEMS_PER_THREAD;
+    if (k < length) {
+      uint lo = (k > b_length ? k - b_length : 0), hi = min(k, a_length);
+      while (lo < hi) {
+        uint mid = lo + (hi - lo) / 2;
+        if (!(tile[a_length + k - mid - 1] < tile[mid])) lo = mid + 1;
+        else hi = mid;
+      }
+
+      uint i = lo, j = a_length + k - lo, count = min((uint)ELEMS_PER_THREAD, length - k);
+      for (uint n = 0; n < count; ++n) {
+        bool take_first = (j >= length || (i < a_length && !(tile[j] < tile[i])));
+        dst[pos + k + n] = (take_first ? tile[i++] : tile[j++]);
+      }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+    pos = section_end;
+  }
+}
@@ -0,0 +1,51 @@
+/* Merge-path partitioning of one merge pass. Runs are [offsets[i], offsets[i + 1]) for i < runs, the pass merges runs
+ * of run_stride input runs pairwise: pair j is the run [offsets[2j * stride], offsets[(2j + 1) * stride]) followed by
+ * [offsets[(2j + 1) * stride], offsets[(2j + 2) * stride]), indices past runs clamp to the end. The output is cut into
+ * tiles of TILE_SIZE elements, work-item g stores in splits[g] how many elements of the first run of its pair precede
+ * output position g * TILE_SIZE. Ties go to the first run, like merge_path_split in include/hybrid_bitonic.hpp.
+ *
+ *  @kernel    ( {"name" : "merge_partition_kernel", "entry" : "merge_partition"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "unsigned", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "unsigned", "name": "TILE_SIZE"}] )
+ *
+ */
+
+uint run_bound(__global const uint *offsets, uint runs, uint run) { return offsets[min(run, runs)]; }
+
+// Last pair starting at or before pos, so pos lies inside it
+uint find_pair(__global const uint *offsets, uint runs, uint stride, uint pos) {
+  uint lo = 0, hi = (runs + 2 * stride - 1) / (2 * stride);
+  while (hi - lo > 1) {
+    uint mid = (lo + hi) / 2;
+    if (run_bound(offsets, runs, 2 * mid * stride) <= pos) lo = mid;
+    else hi = mid;
+  }
+  return lo;
+}
+
+__kernel void merge_partition(__global const TYPE *src, __global const uint *offsets, __global uint *splits, uint runs,
+                              uint stride, uint size, uint tiles) {
+  uint g = get_global_id(0);
+  if (g > tiles) return;
+
+  uint pos = min(g * TILE_SIZE, size);
+  if (pos == size) {
+    splits[g] = 0;
+    return;
+  }
+
+  uint pair = find_pair(offsets, runs, stride, pos);
+  uint a_begin = run_bound(offsets, runs, 2 * pair * stride);
+  uint b_begin = run_bound(offsets, runs, (2 * pair + 1) * stride);
+  uint b_end = run_bound(offsets, runs, (2 * pair + 2) * stride);
+  uint a_length = b_begin - a_begin, b_length = b_end - b_begin, k = pos - a_begin;
+
+  uint lo = (k > b_length ? k - b_length : 0), hi = min(k, a_length);
+  while (lo < hi) {
+    uint mid = lo + (hi - lo) / 2;
+    if (!(src[b_begin + k - mid - 1] < src[a_begin + mid])) lo = mid + 1;
+    else hi = mid;
+  }
+
+  splits[g] = lo;
+}
@@ -0,0 +1,48 @@
+/* First pass of one LSD radix sort digit: work-group g counts the digits of block [g * block_size, (g + 1) *
+ * block_size) of src and stores the count of digit d to counts[d * num_groups + g]. The digit-major layout lets a
+ * single exclusive scan over counts produce the scatter offset of every (digit, group) pair.
+ * Keys are the element bits mapped to unsigned KEY_TYPE so their order matches the order of TYPE: KEY_KIND 0 is
+ * unsigned, 1 flips the sign bit of signed integers, 2 flips the sign bit of positive floats and all bits of
+ * negative ones. RADIX_BITS must divide the key width.
+ *
+ *  @kernel    ( {"name" : "radix_histogram_kernel", "entry" : "radix_histogram"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "KEY_TYPE"}, {"type" : "unsigned", "name": "KEY_KIND"}, {"type" : "unsigned", "name": "RADIX_BITS"}] )
+ *
+ */
+
+#define RADIX (1 << RADIX_BITS)
+#define SIGN_BIT ((KEY_TYPE)1 << (sizeof(KEY_TYPE) * 8 - 1))
+
+#define AS_KEY0(type, value) as_##type(value)
+#define AS_KEY(type, value) AS_KEY0(type, value)
+
+KEY_TYPE radix_key(TYPE value) {
+  KEY_TYPE bits = AS_KEY(KEY_TYPE, value);
+#if KEY_KIND == 1
+  return bits ^ SIGN_BIT;
+#elif KEY_KIND == 2
+  return bits ^ ((bits & SIGN_BIT) ? ~(KEY_TYPE)0 : SIGN_BIT);
+#else
+  return bits;
+#endif
+}
+
+__kernel void radix_histogram(__global const TYPE *src, __global uint *counts, uint shift, uint size,
+                              uint block_size) {
+  uint lid = get_local_id(0), group = get_group_id(0);
+
+  __local uint histogram[RADIX];
+  for (uint d = lid; d < RADIX; d += get_local_size(0))
+    histogram[d] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  uint begin = group * block_size;
+  uint end = (size - begin < block_size) ? size : begin + block_size;
+  for (uint i = begin + lid; i < end; i += get_local_size(0))
+    atomic_inc(&histogram[(radix_key(src[i]) >> shift) & (RADIX - 1)]);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for (uint d = lid; d < RADIX; d += get_local_size(0))
+    counts[d * get_num_groups(0) + group] = histogram[d];
+}
@@ -0,0 +1,33 @@
+/* Exclusive prefix sum of counts[0, length) in place, run as a single work-group of GROUP_SIZE (a power of 2)
+ * work-items. The array is walked in chunks of GROUP_SIZE with a Hillis-Steele scan in local memory, the sum of the
+ * previous chunks is carried over.
+ *
+ *  @kernel    ( {"name" : "radix_scan_kernel", "entry" : "radix_scan"} )
+ *  @signature ( ["cl::Buffer", "unsigned"] )
+ *  @macros    ( [{"type" : "unsigned", "name": "GROUP_SIZE"}] )
+ *
+ */
+
+__kernel void radix_scan(__global uint *counts, uint length) {
+  uint lid = get_local_id(0);
+  uint carry = 0;
+
+  __local uint partial[GROUP_SIZE];
+  for (uint base = 0; base < length; base += GROUP_SIZE) {
+    uint i = base + lid;
+    uint value = (i < length) ? counts[i] : 0;
+
+    partial[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (uint offset = 1; offset < GROUP_SIZE; offset <<= 1) {
+      uint add = (lid >= offset) ? partial[lid - offset] : 0;
+      barrier(CLK_LOCAL_MEM_FENCE);
+      partial[lid] += add;
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (i < length) counts[i] = carry + partial[lid] - value;
+    carry += partial[GROUP_SIZE - 1];
+    barrier(CLK_LOCAL_MEM_FENCE); // partial is overwritten by the next chunk
+  }
+}
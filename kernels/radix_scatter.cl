@@ -0,0 +1,89 @@
+/* Last pass of one LSD radix sort digit: work-group g moves block [g * block_size, (g + 1) * block_size) of src to
+ * dst, digit d of the block starting at offsets[d * num_groups + g] (the scanned histogram). The block is processed in
+ * tiles of GROUP_SIZE (a power of 2, at least 2^RADIX_BITS) elements, every tile is sorted by the digit in local
+ * memory with RADIX_BITS stable one-bit splits, so elements keep their relative order and the sort stays stable
+ * across digits. Keys are mapped from TYPE as in radix_histogram.
+ *
+ *  @kernel    ( {"name" : "radix_scatter_kernel", "entry" : "radix_scatter"} )
+ *  @signature ( ["cl::Buffer", "cl::Buffer", "cl::Buffer", "unsigned", "unsigned", "unsigned"] )
+ *  @macros    ( [{"type" : "std::string", "name": "TYPE"}, {"type" : "std::string", "name": "KEY_TYPE"}, {"type" : "unsigned", "name": "KEY_KIND"}, {"type" : "unsigned", "name": "RADIX_BITS"}, {"type" : "unsigned", "name": "GROUP_SIZE"}] )
+ *
+ */
+
+#define RADIX (1 << RADIX_BITS)
+#define SIGN_BIT ((KEY_TYPE)1 << (sizeof(KEY_TYPE) * 8 - 1))
+
+#define AS_KEY0(type, value) as_##type(value)
+#define AS_KEY(type, value) AS_KEY0(type, value)
+
+KEY_TYPE radix_key(TYPE value) {
+  KEY_TYPE bits = AS_KEY(KEY_TYPE, value);
+#if KEY_KIND == 1
+  return bits ^ SIGN_BIT;
+#elif KEY_KIND == 2
+  return bits ^ ((bits & SIGN_BIT) ? ~(KEY_TYPE)0 : SIGN_BIT);
+#else
+  return bits;
+#endif
+}
+
+__kernel void radix_scatter(__global const TYPE *src, __global TYPE *dst, __global const uint *offsets, uint shift,
+                            uint size, uint block_size) {
+  uint lid = get_local_id(0), group = get_group_id(0);
+
+  __local TYPE values[GROUP_SIZE];
+  __local uint digits[GROUP_SIZE], partial[GROUP_SIZE];
+  __local uint base[RADIX], tile_begin[RADIX], tile_end[RADIX];
+
+  if (lid < RADIX) base[lid] = offsets[lid * get_num_groups(0) + group];
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  uint begin = group * block_size;
+  uint end = (size - begin < block_size) ? size : begin + block_size;
+
+  for (uint tile = begin; tile < end; tile += GROUP_SIZE) {
+    uint active = min((uint)GROUP_SIZE, end - tile);
+
+    // Work-items past the end take the largest digit, the stable splits keep them behind all real elements
+    TYPE value = src[tile + min(lid, active - 1)];
+    uint digit = (lid < active) ? (uint)(radix_key(value) >> shift) & (RADIX - 1) : RADIX - 1;
+
+    for (uint bit = 0; bit < RADIX_BITS; ++bit) {
+      uint is_zero = ((digit >> bit) & 1) ^ 1;
+
+      partial[lid] = is_zero;
+      barrier(CLK_LOCAL_MEM_FENCE);
+      for (uint offset = 1; offset < GROUP_SIZE; offset <<= 1) {
+        uint add = (lid >= offset) ? partial[lid - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        partial[lid] += add;
+        barrier(CLK_LOCAL_MEM_FENCE);
+      }
+
+      uint zeros_before = partial[lid] - is_zero, zeros = partial[GROUP_SIZE - 1];
+      uint position = is_zero ? zeros_before : zeros + lid - zeros_before;
+      values[position] = value;
+      digits[position] = digit;
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      value = values[lid];
+      digit = digits[lid];
+      barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // The tile is sorted by digit now, find where every digit starts and ends within it
+    if (lid < RADIX) tile_begin[lid] = tile_end[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (lid < active) {
+      if (lid == 0 || digits[lid - 1] != digit) tile_begin[digit] = lid;
+      if (lid == active - 1 || digits[lid + 1] != digit) tile_end[digit] = lid + 1;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid < active) dst[base[digit] + lid - tile_begin[digit]] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (lid < RADIX) base[lid] += tile_end[lid] - tile_begin[lid];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
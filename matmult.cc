@@ -8,33 +8,30 @@
  * ----------------------------------------------------------------------------
  */
 
+#include "matmult.hpp"
 #include "opencl_include.hpp"
-#include "selector.hpp"
+#include "profiling_report.hpp"
+#include "runtime.hpp"
+#include "tuning_store.hpp"
+#include "type_name.hpp"
 #include "utils.hpp"
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdlib>
-#include <functional>
 #include <iostream>
-#include <iterator>
+#include <limits>
 #include <memory>
-#include <random>
-#include <span>
-#include <sstream>
+#include <optional>
 #include <stdexcept>
 #include <string>
-
 #include <type_traits>
+#include <vector>
 
 #include "popl.hpp"
 
-#include "linmath/contiguous_matrix.hpp"
-
-#include "kernelhpp/matmult_naive_kernel.hpp"
-#include "kernelhpp/matmult_tiled_arb_kernel.hpp"
-#include "kernelhpp/matmult_tiled_kernel.hpp"
-
 #define STRINGIFY0(v) #v
 #define STRINGIFY(v) STRINGIFY0(v)
 
@@ -44,264 +41,229 @@
 
 #ifdef EIGEN_MAT_MULT
 #include <Eigen/Dense>
-using eigen_matrix_type = Eigen::Matrix<TYPE__, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+template <typename T> using eigen_matrix_type = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
 #endif
 
-namespace linmath = throttle::linmath;
-
-using matrix_type = linmath::contiguous_matrix<TYPE__>;
-
-namespace app {
-
-struct matrix_sizes {
-  matrix_type::size_type ax, ay, by;
-};
-
-struct ndrange_query {
-  cl::NDRange global, local;
-};
+using matmult::matrix_type;
 
-using clutils::profiling_info;
-class i_matmult {
-public:
-  virtual matrix_type operator()(const matrix_type &, const matrix_type &, profiling_info *) = 0;
+namespace {
 
-  matrix_type multiply(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) {
-    return operator()(mata, matb, time);
-  }
+#ifdef EIGEN_MAT_MULT
+template <typename T> eigen_matrix_type<T> to_eigen_matrix(const matrix_type<T> &matrix) {
+  eigen_matrix_type<T> e = Eigen::Map<const eigen_matrix_type<T>>(matrix.data(), matrix.rows(), matrix.cols());
+  return e;
+}
+#endif
 
-  virtual ~i_matmult() {}
+// Command line values that don't depend on the element type
+struct matmult_options {
+  std::string kernel_name;
+  std::optional<std::string> lower, upper, report;
+  unsigned lsz, block_rows, block_cols;
+  std::optional<unsigned> batch; // Number of products multiplied by one batched launch
+  matmult::storage_precision precision;
+  matmult::matrix_sizes sizes;
+  bool skip_cpu, print_on_failure, compare_eigen, zero_copy;
+  bool autotune, lsz_set; // The tuned tile size only replaces --lsz when it wasn't given
 };
 
-class gpu_matmult : public i_matmult, protected clutils::platform_selector {
-protected:
-  cl::Context m_ctx;
-  cl::CommandQueue m_queue;
-
-protected:
-  static constexpr clutils::platform_version c_api_version = {2, 2};
-
-  gpu_matmult()
-      : clutils::platform_selector{c_api_version}, m_ctx{m_device}, m_queue{m_ctx, cl::QueueProperties::Profiling} {}
-
-  using func_signature = cl::Event(cl::Buffer, cl::Buffer, cl::Buffer);
-  matrix_type run_boilerplate(const matrix_type &mata, const matrix_type &matb, std::function<func_signature> func,
-                              profiling_info *time) {
-    if (mata.cols() != matb.rows()) throw std::invalid_argument{"Mismatched matrix sizes"};
-
-    const auto mat_size = [](const auto &m) { return std::distance(m.begin(), m.end()); };
-    const auto mat_bin_size = [&mat_size](const auto &m) { return mat_size(m) * sizeof(matrix_type::value_type); };
-
-    auto wall_start = std::chrono::high_resolution_clock::now();
-
-    matrix_type matc = {mata.rows(), matb.cols()};
-
-    cl::Buffer bufa = {m_ctx, CL_MEM_READ_ONLY, mat_bin_size(mata)};
-    cl::Buffer bufb = {m_ctx, CL_MEM_READ_ONLY, mat_bin_size(matb)};
-    cl::Buffer bufc = {m_ctx, CL_MEM_WRITE_ONLY, mat_bin_size(matc)};
-
-    cl::copy(m_queue, mata.begin(), mata.end(), bufa);
-    cl::copy(m_queue, matb.begin(), matb.end(), bufb);
-
-    auto event = func(bufa, bufb, bufc);
-    event.wait();
-    cl::copy(m_queue, bufc, matc.begin(), matc.end());
-    auto wall_end = std::chrono::high_resolution_clock::now();
-
-    std::chrono::nanoseconds pure_start{event.getProfilingInfo<CL_PROFILING_COMMAND_START>()},
-        pure_end{event.getProfilingInfo<CL_PROFILING_COMMAND_END>()};
-
-    auto pure = std::chrono::duration_cast<std::chrono::milliseconds>(pure_end - pure_start);
-    auto wall = std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+float max_abs(const matrix_type<float> &mat) {
+  float result = 0;
+  for (auto v : mat)
+    result = std::max(result, std::abs(v));
+  return result;
+}
 
-    if (time) *time = {pure, wall};
-    return matc;
-  }
-};
+// Sums of products in a different order differ by a few roundings of the largest possible term
+bool roughly_equal(const matrix_type<float> &lhs, const matrix_type<float> &rhs, float tolerance) {
+  if (lhs.rows() != rhs.rows() || lhs.cols() != rhs.cols()) return false;
+  return std::equal(lhs.begin(), lhs.end(), rhs.begin(),
+                    [tolerance](float x, float y) { return std::abs(x - y) <= tolerance; });
+}
 
-class naive_matmult : public gpu_matmult {
-  using kernel = matmult_naive_kernel;
+// Packed batch of random products through multiply_batched, checked against the CPU product of every pair
+template <typename T> int run_batched_matmult(const matmult_options &opts, T lower, T upper) {
+  const auto [ax, ay, by] = opts.sizes;
+  const unsigned count = *opts.batch;
+  const auto layout = matmult::batch_layout::packed(opts.sizes, count);
 
-private:
-  cl::Program m_program;
-  kernel::functor_type m_functor;
+  matmult::naive_matmult<T> mult;
+  if (opts.zero_copy) mult.set_host_memory_mode(clutils::host_memory_mode::zero_copy);
 
-public:
-  naive_matmult()
-      : gpu_matmult{}, m_program{m_ctx, kernel::source(STRINGIFY(TYPE__)), true}, m_functor{m_program,
-                                                                                            kernel::entry()} {}
+  std::cout << "Multiplying " << count << " pairs of A [" << ax << " x " << ay << "] by B [" << ay << " x " << by
+            << "] of " << clutils::type_name<T>::name_str << "\n";
 
-  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
-    const auto func = [&](auto bufa, auto bufb, auto bufc) {
-      cl::EnqueueArgs args = {m_queue, {mata.rows(), matb.cols()}};
-      return m_functor(args, bufa, bufb, bufc, mata.rows(), mata.cols(), matb.cols());
-    };
-    return gpu_matmult::run_boilerplate(mata, matb, func, time);
-  }
-};
-
-class tiled_matmult : public gpu_matmult {
-  using kernel = matmult_tiled_kernel;
+  std::vector<T> a(layout.extent_a()), b(layout.extent_b()), c(layout.extent_c());
+  auto random_filler = clutils::create_random_number_generator<T>(lower, upper);
+  random_filler(a);
+  random_filler(b);
 
-private:
-  cl::Program m_program;
-  kernel::functor_type m_functor;
+  matmult::profiling_info prof_info;
+  mult.multiply_batched(a, b, c, layout, &prof_info);
 
-  unsigned m_tile_size;
+  clutils::profiling_report report;
+  report.field("kernel", "batched").field("type", clutils::type_name<T>::name_str);
+  report.field("ax", ax).field("ay", ay).field("by", by).field("batch", count);
 
-public:
-  tiled_matmult(unsigned tile_size)
-      : gpu_matmult{}, m_program{m_ctx, kernel::source(STRINGIFY(TYPE__), tile_size), true},
-        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size} {}
+  std::size_t mismatches = 0;
+  if (!opts.skip_cpu) {
+    std::chrono::nanoseconds wall_cpu{};
+    matrix_type<T> mata{ax, ay}, matb{ay, by};
+    for (std::size_t i = 0; i < count; ++i) {
+      std::copy_n(a.begin() + i * layout.stride_a, ax * ay, mata.begin());
+      std::copy_n(b.begin() + i * layout.stride_b, ay * by, matb.begin());
 
-  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) {
-    if (mata.rows() % m_tile_size != 0 || mata.cols() % m_tile_size != 0 || matb.cols() % m_tile_size != 0 ||
-        matb.rows() % m_tile_size != 0)
-      throw std::invalid_argument{"Matrix sizes should be divisible by the tile size"};
+      auto wall_start = std::chrono::high_resolution_clock::now();
+      const auto matc = mata * matb;
+      wall_cpu += std::chrono::high_resolution_clock::now() - wall_start;
 
-    const auto func = [&](auto bufa, auto bufb, auto bufc) {
-      cl::EnqueueArgs args = {m_queue, {mata.rows(), matb.cols()}, {m_tile_size, m_tile_size}};
-      return m_functor(args, bufa, bufb, bufc, mata.rows(), mata.cols(), matb.cols());
-    };
+      mismatches += !std::equal(matc.begin(), matc.end(), c.begin() + i * ax * by);
+    }
 
-    return gpu_matmult::run_boilerplate(mata, matb, func, time);
+    std::cout << "CPU wall time: " << clutils::to_milliseconds(wall_cpu) << " ms\n";
+    report.total("cpu", wall_cpu);
   }
-};
-
-class tiled_arbitrary_matmult : public gpu_matmult {
-  using kernel = matmult_tiled_arb_kernel;
-
-private:
-  cl::Program m_program;
-  kernel::functor_type m_functor;
-
-  unsigned m_tile_size;
-
-public:
-  tiled_arbitrary_matmult(unsigned tile_size)
-      : gpu_matmult{}, m_program{m_ctx, kernel::source(STRINGIFY(TYPE__), tile_size), true},
-        m_functor{m_program, kernel::entry()}, m_tile_size{tile_size} {}
 
-  matrix_type operator()(const matrix_type &mata, const matrix_type &matb, profiling_info *time = nullptr) override {
-    const auto func = [&](auto bufa, auto bufb, auto bufc) {
-      const auto tile_sz = m_tile_size;
-      const auto recalc_size = [tile_sz](auto sz) {
-        if (sz % tile_sz == 0) return sz / tile_sz;
-        return (sz / tile_sz + 1);
-      };
+  std::cout << "GPU wall time: " << clutils::to_milliseconds(prof_info.wall) << " ms\n";
+  std::cout << "GPU pure time: " << clutils::to_milliseconds(prof_info.pure) << " ms\n";
+  if (opts.report) report.add(prof_info).save(*opts.report);
 
-      auto recalc_rows = recalc_size(mata.rows()) * tile_sz;
-      auto recalc_cols = recalc_size(matb.cols()) * tile_sz;
-
-      cl::EnqueueArgs args = {m_queue, {recalc_rows, recalc_cols}, {tile_sz, tile_sz}};
-
-      int tile_count = recalc_size(mata.cols());
-      return m_functor(args, bufa, bufb, bufc, mata.rows(), mata.cols(), matb.cols(), tile_count);
-    };
-    return gpu_matmult::run_boilerplate(mata, matb, func, time);
+  if (opts.skip_cpu) return EXIT_SUCCESS;
+  if (!mismatches) {
+    std::cout << "GPU batched matrix multiplication works fine\n";
+    return EXIT_SUCCESS;
   }
-};
 
-} // namespace app
-
-namespace {
-
-#ifdef EIGEN_MAT_MULT
-eigen_matrix_type to_eigen_matrix(const matrix_type &matrix) {
-  eigen_matrix_type e = Eigen::Map<const eigen_matrix_type>(matrix.data(), matrix.rows(), matrix.cols());
-  return e;
+  std::cout << "GPU batched matrix multiplication is borked for " << mismatches << " of " << count
+            << " products\n";
+  return EXIT_FAILURE;
 }
-#endif
-
-} // namespace
-
-int main(int argc, char *argv[]) try {
-  popl::OptionParser op("Avaliable options");
-  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
-  auto print_option = op.add<popl::Switch>("p", "print", "Print on failure");
-  auto eigen_option = op.add<popl::Switch>("e", "eigen", "Compare with Eigen matrix multiplication");
-  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip naive cpu calculation");
-
-  auto lower_option = op.add<popl::Implicit<TYPE__>>("", "lower", "Lower bound", -32);
-  auto upper_option = op.add<popl::Implicit<TYPE__>>("", "upper", "Upper bound", +32);
-
-  auto ax_option = op.add<popl::Implicit<unsigned>>("", "ax", "Number of rows in matrix A", 512);
-  auto ay_option = op.add<popl::Implicit<unsigned>>("", "ay", "Number of cols in matrix A", 512);
-  auto by_option = op.add<popl::Implicit<unsigned>>("", "by", "Number of cols in matrix B", 512);
 
-  auto kernel_option =
-      op.add<popl::Implicit<std::string>>("", "kernel", "Which kernel to use: naive, tiled, tiledarb", "naive");
-  auto lsz_option = op.add<popl::Implicit<unsigned>>("", "lsz", "Local tile size", 256);
-
-  op.parse(argc, argv);
-
-  if (help_option->is_set()) {
-    std::cout << op << "\n ";
-    return EXIT_SUCCESS;
-  }
-
-  const auto lower = lower_option->value(), upper = upper_option->value();
-  const auto kernel_name = kernel_option->value();
-  const auto lsz = lsz_option->value();
-  const auto ax = ax_option->value(), ay = ay_option->value(), by = by_option->value();
+template <typename T> int run_matmult(const matmult_options &opts) {
+  // Unsigned types can't take the default negative lower bound
+  const T lower = (opts.lower ? clutils::from_string<T>(*opts.lower) : T(std::is_signed_v<T> ? -32 : 0)),
+          upper = (opts.upper ? clutils::from_string<T>(*opts.upper) : T(32));
+  const auto &kernel_name = opts.kernel_name;
+  auto lsz = opts.lsz;
+  const auto [ax, ay, by] = opts.sizes;
 
   if (lower >= upper) {
     std::cout << "Error: lower bound can't be greater than the upper bound\n";
     return EXIT_FAILURE;
   }
 
-  const bool skip_cpu = skip_option->is_set();
-  const bool print_on_failure = print_option->is_set();
-  const bool compare_eigen = eigen_option->is_set();
+  if (opts.batch) return run_batched_matmult<T>(opts, lower, upper);
 
-#ifndef EIGEN_MAT_MULT
-  if (compare_eigen) std::cout << "Warning: app wasn't built with Eigen, ignoring --eigen option\n";
-#endif
+  auto precision = opts.precision;
+  if (precision != matmult::storage_precision::fp32) {
+    if (!std::is_same_v<T, float> || (kernel_name != "tiled" && kernel_name != "tiledarb")) {
+      std::cout << "Error: --precision needs float elements and the tiled or tiledarb kernel\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::shared_ptr<clutils::runtime> runtime; // Keeps the runtime shared by the tuner and the multiplier alive
+  if (kernel_name == "tiled" || kernel_name == "tiledarb") {
+    const bool arbitrary = (kernel_name == "tiledarb");
+    runtime = matmult::gpu_matmult<T>::default_runtime();
+    clutils::tuning_store store;
+    const auto key = clutils::tuning_store::key(runtime->device(), matmult::tiled_kernel_name(arbitrary),
+                                                clutils::type_name<T>::name_str);
+    std::optional<unsigned> tile;
+
+    if (opts.autotune) {
+      std::cout << "Autotuning " << matmult::tiled_kernel_name(arbitrary) << " for " << clutils::type_name<T>::name_str
+                << "\n";
+      tile = matmult::autotune_tile<T>(runtime, arbitrary, 1024, 5, &std::cout);
+      store.set(key, clutils::tuning_params{}.set("tile", *tile));
+      store.save();
+      if (store.path()) std::cout << "Info: Tuned tile size saved to " << store.path()->string() << "\n";
+    } else if (auto params = store.find(key)) {
+      tile = params->get("tile");
+    }
+
+    if (tile && !opts.lsz_set) {
+      lsz = *tile;
+      std::cout << "Info: Using tuned tile size " << lsz << "\n";
+    }
+  }
 
-  std::unique_ptr<app::i_matmult> mult;
-  if (kernel_name == "naive") {
-    mult = std::make_unique<app::naive_matmult>();
+  const bool skip_cpu = opts.skip_cpu;
+  const bool print_on_failure = opts.print_on_failure;
+  [[maybe_unused]] const bool compare_eigen = opts.compare_eigen;
+
+  std::unique_ptr<matmult::i_matmult<T>> mult;
+  if (precision != matmult::storage_precision::fp32) {
+    if constexpr (std::is_same_v<T, float>) {
+      auto mixed = std::make_unique<matmult::mixed_matmult>(lsz, precision);
+      if (mixed->precision() != precision)
+        std::cout << "Warning: device doesn't support " << matmult::precision_name(precision)
+                  << " storage, falling back to fp32\n";
+      precision = mixed->precision();
+      mult = std::move(mixed);
+    }
+  } else if (kernel_name == "naive") {
+    mult = std::make_unique<matmult::naive_matmult<T>>();
   } else if (kernel_name == "tiled") {
-    mult = std::make_unique<app::tiled_matmult>(lsz);
+    mult = std::make_unique<matmult::tiled_matmult<T>>(lsz);
   } else if (kernel_name == "tiledarb") {
-    mult = std::make_unique<app::tiled_arbitrary_matmult>(lsz);
+    mult = std::make_unique<matmult::tiled_arbitrary_matmult<T>>(lsz);
+  } else if (kernel_name == "blocked") {
+    mult = std::make_unique<matmult::blocked_matmult<T>>(lsz, opts.block_rows, opts.block_cols);
   } else {
     std::cout << "Unknown type of kernel: " << kernel_name << "\n";
     return EXIT_FAILURE;
   }
 
-  if (kernel_name == "naive" && lsz_option->is_set()) {
-    std::cout << "Warning: local size provided but kernel used is \"naive\", ignoring --lsz option\n";
+  if (opts.zero_copy) {
+    static_cast<matmult::gpu_matmult<T> &>(*mult).set_host_memory_mode(clutils::host_memory_mode::zero_copy);
   }
 
   const auto print_sep = []() { std::cout << " -------- \n"; };
-  std::cout << "Multiplying A [" << ax << " x " << ay << "] by B [" << ay << " x " << by << "]\n";
+  std::cout << "Multiplying A [" << ax << " x " << ay << "] by B [" << ay << " x " << by << "] of "
+            << clutils::type_name<T>::name_str << "\n";
   print_sep();
 
-  matrix_type a{ax, ay}, b{ay, by};
+  matrix_type<T> a{ax, ay}, b{ay, by};
 
-  auto random_filler = clutils::create_random_number_generator<matrix_type::value_type>(lower, upper);
+  auto random_filler = clutils::create_random_number_generator<T>(lower, upper);
   random_filler(a);
   random_filler(b);
 
-  std::chrono::milliseconds wall_cpu_naive;
+  std::chrono::nanoseconds wall_cpu_naive{};
 
   const auto measure_cpu_time = [](auto func) {
     auto wall_start = std::chrono::high_resolution_clock::now();
     func();
     auto wall_end = std::chrono::high_resolution_clock::now();
-    return std::chrono::duration_cast<std::chrono::milliseconds>(wall_end - wall_start);
+    return std::chrono::nanoseconds{wall_end - wall_start};
   };
 
-  matrix_type c;
-  if (!skip_cpu) {
+  // Reduced precision products are compared with the product of the inputs rounded the same way
+  const bool reduced = (precision != matmult::storage_precision::fp32);
+  float tolerance = 0;
+
+  matrix_type<T> c;
+  if constexpr (std::is_same_v<T, float>) {
+    if (!skip_cpu && reduced) {
+      auto rounded_a = a, rounded_b = b;
+      for (auto *mat : {&rounded_a, &rounded_b})
+        for (auto &v : *mat)
+          v = matmult::round_to_precision(v, precision);
+
+      wall_cpu_naive = measure_cpu_time([&rounded_a, &rounded_b, &c]() { c = rounded_a * rounded_b; });
+      tolerance = 4 * std::numeric_limits<float>::epsilon() * ay * max_abs(rounded_a) * max_abs(rounded_b);
+    }
+  }
+
+  if (!skip_cpu && !reduced) {
     wall_cpu_naive = measure_cpu_time([&a, &b, &c]() { c = a * b; });
   }
 
 #ifdef EIGEN_MAT_MULT
-  std::chrono::milliseconds wall_cpu_eigen;
+  std::chrono::nanoseconds wall_cpu_eigen{};
   if (compare_eigen) {
-    eigen_matrix_type a_e = to_eigen_matrix(a), b_e = to_eigen_matrix(b), c_e;
+    eigen_matrix_type<T> a_e = to_eigen_matrix(a), b_e = to_eigen_matrix(b), c_e;
     wall_cpu_eigen = measure_cpu_time([&a_e, &b_e, &c_e]() { c_e = a_e * b_e; });
   }
 #endif
@@ -316,22 +278,45 @@ int main(int argc, char *argv[]) try {
     }
   };
 
-  app::profiling_info prof_info;
+  matmult::profiling_info prof_info;
 
   auto res = mult->multiply(a, b, &prof_info);
-  if (!skip_cpu) std::cout << "CPU wall time: " << wall_cpu_naive.count() << " ms\n";
+  clutils::profiling_report report;
+  report.field("kernel", kernel_name).field("type", clutils::type_name<T>::name_str);
+  report.field("ax", ax).field("ay", ay).field("by", by);
+  if (kernel_name != "naive") report.field("lsz", lsz);
+  if (kernel_name == "blocked") report.field("block_rows", opts.block_rows).field("block_cols", opts.block_cols);
+  report.field("precision", matmult::precision_name(precision));
+
+  if (!skip_cpu) {
+    std::cout << "CPU wall time: " << clutils::to_milliseconds(wall_cpu_naive) << " ms\n";
+    report.total("cpu", wall_cpu_naive);
+  }
 
 #ifdef EIGEN_MAT_MULT
-  if (compare_eigen) std::cout << "Eigen wall time: " << wall_cpu_eigen.count() << " ms\n";
+  if (compare_eigen) {
+    std::cout << "Eigen wall time: " << clutils::to_milliseconds(wall_cpu_eigen) << " ms\n";
+    report.total("eigen", wall_cpu_eigen);
+  }
 #endif
 
-  std::cout << "GPU wall time: " << prof_info.wall.count() << " ms\n";
-  std::cout << "GPU pure time: " << prof_info.pure.count() << " ms\n";
+  std::cout << "GPU wall time: " << clutils::to_milliseconds(prof_info.wall) << " ms\n";
+  std::cout << "GPU pure time: " << clutils::to_milliseconds(prof_info.pure) << " ms\n";
+  std::cout << "upload: " << clutils::to_milliseconds(prof_info.total(clutils::command_kind::upload))
+            << " ms, download: " << clutils::to_milliseconds(prof_info.total(clutils::command_kind::download))
+            << " ms, gaps: " << clutils::to_milliseconds(prof_info.gaps()) << " ms\n";
 
   print_sep();
 
-  const auto validate_results = [&c, &res, &a, &b, print_on_failure]() {
-    if (c == res) {
+  if (opts.report) report.add(prof_info).save(*opts.report);
+
+  const auto validate_results = [&c, &res, &a, &b, print_on_failure, reduced, tolerance]() {
+    bool matches = (c == res);
+    if constexpr (std::is_same_v<T, float>) {
+      if (reduced) matches = roughly_equal(c, res, tolerance);
+    }
+
+    if (matches) {
       std::cout << "GPU matrix multiplication works fine\n";
       return EXIT_SUCCESS;
     }
@@ -350,6 +335,89 @@ int main(int argc, char *argv[]) try {
 
   if (skip_cpu) return EXIT_SUCCESS;
   return validate_results();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) try {
+  popl::OptionParser op("Avaliable options");
+  auto help_option = op.add<popl::Switch>("h", "help", "Print this help message");
+  auto print_option = op.add<popl::Switch>("p", "print", "Print on failure");
+  auto eigen_option = op.add<popl::Switch>("e", "eigen", "Compare with Eigen matrix multiplication");
+  auto skip_option = op.add<popl::Switch>("s", "skip", "Skip naive cpu calculation");
+  auto zero_copy_option = op.add<popl::Switch>("z", "zero-copy", "Let the device access host matrices in place");
+  auto autotune_option =
+      op.add<popl::Switch>("", "autotune", "Benchmark tile sizes and store the fastest one as the default");
+
+  auto type_option = op.add<popl::Implicit<std::string>>(
+      "t", "type", std::string{"Element type: "} + clutils::supported_type_names, STRINGIFY(TYPE__));
+  auto lower_option =
+      op.add<popl::Value<std::string>>("", "lower", "Lower bound, -32 (0 for unsigned types) by default");
+  auto upper_option = op.add<popl::Value<std::string>>("", "upper", "Upper bound, 32 by default");
+  auto report_option = op.add<popl::Value<std::string>>(
+      "", "report", "Write timings of every device command to a JSON file, CSV if the name ends with .csv");
+  auto batch_option =
+      op.add<popl::Value<unsigned>>("b", "batch", "Multiply this many pairs of matrices with one batched launch");
+
+  auto ax_option = op.add<popl::Implicit<unsigned>>("", "ax", "Number of rows in matrix A", 512);
+  auto ay_option = op.add<popl::Implicit<unsigned>>("", "ay", "Number of cols in matrix A", 512);
+  auto by_option = op.add<popl::Implicit<unsigned>>("", "by", "Number of cols in matrix B", 512);
+
+  auto kernel_option = op.add<popl::Implicit<std::string>>(
+      "", "kernel", "Which kernel to use: naive, tiled, tiledarb, blocked", "naive");
+  auto lsz_option = op.add<popl::Implicit<unsigned>>("", "lsz", "Local tile size (64 for blocked)", 256);
+  auto block_rows_option =
+      op.add<popl::Implicit<unsigned>>("", "block-rows", "Rows of C computed by every work-item of blocked", 4);
+  auto block_cols_option = op.add<popl::Implicit<unsigned>>(
+      "", "block-cols", "Columns of C computed by every work-item of blocked, a multiple of 4", 4);
+  auto precision_option = op.add<popl::Implicit<std::string>>(
+      "", "precision", "Storage of float A and B for tiled kernels: fp32, fp16 or bf16, summed in fp32", "fp32");
+
+  op.parse(argc, argv);
+
+  if (help_option->is_set()) {
+    std::cout << op << "\n ";
+    return EXIT_SUCCESS;
+  }
+
+  matmult_options opts;
+  if (lower_option->is_set()) opts.lower = lower_option->value();
+  if (upper_option->is_set()) opts.upper = upper_option->value();
+  if (report_option->is_set()) opts.report = report_option->value();
+  opts.kernel_name = kernel_option->value();
+  opts.lsz = lsz_option->value();
+  opts.block_rows = block_rows_option->value();
+  opts.block_cols = block_cols_option->value();
+  if (batch_option->is_set()) opts.batch = batch_option->value();
+  opts.precision = matmult::precision_from_string(precision_option->value());
+  opts.sizes = {ax_option->value(), ay_option->value(), by_option->value()};
+  opts.skip_cpu = skip_option->is_set();
+  opts.print_on_failure = print_option->is_set();
+  opts.compare_eigen = eigen_option->is_set();
+  opts.zero_copy = zero_copy_option->is_set();
+  opts.autotune = autotune_option->is_set();
+  opts.lsz_set = lsz_option->is_set();
+  if (opts.kernel_name == "blocked" && !opts.lsz_set) opts.lsz = 64; // 16 x 16 work-items with the default blocks
+
+#ifndef EIGEN_MAT_MULT
+  if (opts.compare_eigen) std::cout << "Warning: app wasn't built with Eigen, ignoring --eigen option\n";
+#endif
+
+  if (opts.kernel_name == "naive" && lsz_option->is_set()) {
+    std::cout << "Warning: local size provided but kernel used is \"naive\", ignoring --lsz option\n";
+  }
+
+  if (opts.batch && (kernel_option->is_set() || lsz_option->is_set() || opts.autotune)) {
+    std::cout << "Warning: batched products have their own kernel, ignoring --kernel, --lsz and --autotune options\n";
+  }
+
+  if ((opts.kernel_name == "naive" || opts.kernel_name == "blocked") && opts.autotune) {
+    std::cout << "Warning: kernel used has no tuned parameters, ignoring --autotune option\n";
+  }
+
+  // Kernels are built for the chosen type at runtime, the TYPE build option only sets the default
+  return clutils::dispatch_type(type_option->value(),
+                                [&opts](auto type) { return run_matmult<typename decltype(type)::type>(opts); });
 } catch (cl::BuildError &e) {
   std::cerr << "Compilation failed:\n";
   for (const auto &v : e.getBuildLog()) {
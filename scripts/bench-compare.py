@@ -0,0 +1,68 @@
+#!/usr/bin/python
+
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+# retain this notice you can do whatever you want with this stuff. If we meet
+# some day, and you think this stuff is worth it, you can buy us a beer in
+# return.
+# ----------------------------------------------------------------------------
+
+from argparse import ArgumentParser
+import json
+import sys
+
+
+def parse_cmd_args():
+    parser = ArgumentParser(
+        prog="bench-compare",
+        description="Compare median times of two bench --benchmark_out JSON files and report regressions")
+
+    parser.add_argument("baseline", help="JSON output of the reference run")
+    parser.add_argument("current", help="JSON output of the run to check")
+
+    parser.add_argument("--threshold", dest="threshold", type=float, default=5.0,
+                        help="Slowdown in percent counted as a regression", metavar="")
+
+    return parser.parse_args()
+
+
+def load_medians(path: str) -> dict:
+    with open(path) as json_file:
+        report = json.load(json_file)
+
+    medians = {}
+    for bench in report["benchmarks"]:
+        if bench.get("error_occurred"):
+            continue
+        # Repetitions leave a median aggregate, single runs only have the iteration entry
+        if bench.get("run_type") == "aggregate" and bench.get("aggregate_name") != "median":
+            continue
+        medians.setdefault(bench["run_name"], bench["real_time"])
+        if bench.get("aggregate_name") == "median":
+            medians[bench["run_name"]] = bench["real_time"]
+    return medians
+
+
+def main():
+    args = parse_cmd_args()
+    baseline, current = load_medians(args.baseline), load_medians(args.current)
+
+    regressions = 0
+    print("{:<64} {:>12} {:>12} {:>8}".format("benchmark", "baseline", "current", "change"))
+    for name in sorted(baseline.keys() & current.keys()):
+        change = (current[name] / baseline[name] - 1) * 100 if baseline[name] else 0
+        regressed = change > args.threshold
+        regressions += regressed
+        print("{:<64} {:>12.4f} {:>12.4f} {:>+7.1f}%{}".format(
+            name, baseline[name], current[name], change, "  REGRESSION" if regressed else ""))
+
+    for name in sorted(baseline.keys() - current.keys()):
+        print("{:<64} missing in the current run".format(name))
+
+    print("{} regression(s) over {}%".format(regressions, args.threshold))
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
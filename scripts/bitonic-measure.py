@@ -9,9 +9,10 @@
 # ----------------------------------------------------------------------------
 
 from argparse import ArgumentParser
-import re
 import json
+import os
 import subprocess
+import tempfile
 import matplotlib.pyplot as plt
 
 
@@ -37,28 +38,32 @@ def parse_cmd_args():
     return parser.parse_args()
 
 
-def execute_test(binname: str, kernel: str, n: int, lsz: int) -> str:
-    args = (binname, "--kernel={}".format(kernel),
-            "--num={}".format(n), "--lsz={}".format(lsz))
-    popen = subprocess.Popen(args, stdout=subprocess.PIPE)
-    popen.wait()
-    output = popen.stdout.read().decode("utf-8")
-    return output
+def execute_test(binname: str, kernel: str, n: int, lsz: int) -> dict:
+    # Timings are taken from the JSON report (nanoseconds) instead of the human readable output
+    with tempfile.TemporaryDirectory() as tmpdir:
+        report_path = os.path.join(tmpdir, "report.json")
+        args = (binname, "--kernel={}".format(kernel), "--num={}".format(n),
+                "--lsz={}".format(lsz), "--report={}".format(report_path))
+        subprocess.run(args, stdout=subprocess.DEVNULL, check=True)
+        with open(report_path) as report_file:
+            return json.load(report_file)
 
 
 def run_test_json_text(binname: str, kernel: str, n: int, lsz: int) -> str:
-    output_text = execute_test(binname, kernel, n, lsz)
-    output_numbers = list(map(int, re.findall(r'\d+', output_text)))[-4:]
-    json_source = f'''{{
-\"test\" : {{
-        \"lsz\" : {lsz},
-        \"len\" : {output_numbers[0]},
-        \"std_time\" : {output_numbers[1]},
-        \"gpu_wall\" : {output_numbers[2]},
-        \"gpu_pure\" : {output_numbers[3]}
-}}
-}}'''
-    return json_source
+    report = execute_test(binname, kernel, n, lsz)
+    totals = report["totals_ns"]
+    test = {
+        "lsz": lsz,
+        "len": report["length"],
+        "std_time": totals.get("cpu_sort", 0),
+        "gpu_wall": totals["wall"],
+        "gpu_pure": totals["pure"],
+        "upload": totals.get("upload", 0),
+        "kernels": totals.get("kernels", 0),
+        "download": totals.get("download", 0),
+        "gaps": totals.get("gaps", 0),
+    }
+    return json.dumps({"test": test}, indent=4)
 
 
 def run_all_tests_for_kernel(binname: str, kernel: str, min_n: int, max_n: int, lsz: int) -> str:
@@ -95,9 +100,9 @@ def plot_measurements_of_kernel(lsz: int, kernel_list: list, data) -> None:
         lens.clear()
         for test in data[kernel + 's']:
             lens.append(test["test"]["len"])
-            gpu_times.append(test["test"]["gpu_wall"] / 1000)
+            gpu_times.append(test["test"]["gpu_wall"] / 1e9)
             if (first):
-                cpu_times.append(test["test"]["std_time"] / 1000)
+                cpu_times.append(test["test"]["std_time"] / 1e9)
         plt.plot(lens, gpu_times, marker='o', label=f"{kernel} bitonic sort")
         first = False
 
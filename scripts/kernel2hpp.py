@@ -45,6 +45,12 @@ def main():
     entry = pragmap["kernel"]["entry"]
     output_path = Path(args.output if args.output is not None else "./")
     macros = {} if "macros" not in pragmap else pragmap["macros"]
+    # Code shared by several kernels, looked up next to the kernel and placed after the macro definitions
+    preambles = []
+    for preamble in pragmap.get("preamble", []):
+        with open(Path(args.input).parent / preamble) as input:
+            preambles.append(input.read() + "\n")
+    kernel_source = "".join(preambles) + kernel_source
     functor_args = ", ".join(pragmap["signature"])
 
     if output_path.is_dir():
@@ -56,13 +62,16 @@ def main():
     output_file.parent.mkdir(exist_ok=True, parents=True)
     output_file = str(output_file)
 
-    header_text = "#include <CL/opencl.hpp>\n#include <string>\n#include <utils.hpp>\n\n"
+    header_text = "#include <CL/opencl.hpp>\n#include <string>\n#include <program_cache.hpp>\n#include <utils.hpp>\n\n"
     header_text += "struct {} {{ \n".format(kernel_class_name)
     header_text += "\tusing functor_type = cl::KernelFunctor<{}>;\n\n".format(
         functor_args)
     source_args = ["{} {}_param".format(i["type"], i["name"]) for i in macros]
+    # Macros with a default are optional trailing arguments, a JSON string or number is also a valid C++ literal
+    default_args = [arg if "default" not in i else "{} = {}".format(arg, json.dumps(i["default"]))
+                    for arg, i in zip(source_args, macros)]
 
-    header_text += "\tstatic std::string source({}) {{\n\t\tstatic const std::string {}_source = R\"(\n{})\";\n\n".format(", ".join(source_args), kernel_class_name,
+    header_text += "\tstatic std::string source({}) {{\n\t\tstatic const std::string {}_source = R\"(\n{})\";\n\n".format(", ".join(default_args), kernel_class_name,
                                                                                                                           kernel_source)
     for i in macros:
         macro_name = i["name"]
@@ -80,6 +89,13 @@ def main():
     header_text += "\tstatic std::string entry() {{ return \"{}\"; }}\n".format(
         entry)
 
+    # Built program for the given macro values, taken from the in-memory or on-disk cache when possible
+    param_names = ["{}_param".format(i["name"]) for i in macros]
+    header_text += "\n\tstatic cl::Program program({}) {{\n".format(
+        ", ".join(["clutils::program_cache &cache"] + default_args))
+    header_text += "\t\treturn cache.get(source({}));\n\t}}\n".format(
+        ", ".join(param_names))
+
     header_text += "};\n"
 
     with open(output_file, "w") as oput:
@@ -0,0 +1,103 @@
+#!/usr/bin/python
+
+# ----------------------------------------------------------------------------
+# "THE BEER-WARE LICENSE" (Revision 42):
+# <tsimmerman.ss@phystech.edu>, <alex.rom23@mail.ru> wrote this file.  As long as you
+# retain this notice you can do whatever you want with this stuff. If we meet
+# some day, and you think this stuff is worth it, you can buy us a beer in
+# return.
+# ----------------------------------------------------------------------------
+
+from argparse import ArgumentParser
+import re
+import json
+import subprocess
+import matplotlib.pyplot as plt
+
+
+def parse_cmd_args():
+    parser = ArgumentParser(
+        prog="multi-gpu-scaling",
+        description="Measure how the multi-device bitonic sort scales from 1 to N GPUs")
+
+    parser.add_argument("-i", "--input", dest="input",
+                        required=True, help="input binary file", metavar="")
+
+    parser.add_argument("-o", "--output", dest="output",
+                        help="Raw data output file", metavar="")
+
+    parser.add_argument("--devices", dest="devices",
+                        help="Maximum number of devices to use", required=True, metavar="")
+
+    parser.add_argument("--num", dest="n",
+                        help="Test sequence length (in powers of 2)", default=26, metavar="")
+
+    parser.add_argument("--lsz", dest="lsz",
+                        help="Local memory size to use", default=256, metavar="")
+
+    parser.add_argument("--runs", dest="runs",
+                        help="Number of runs per device count, the fastest one is kept", default=3, metavar="")
+
+    return parser.parse_args()
+
+
+def execute_test(binname: str, devices: int, n: int, lsz: int) -> str:
+    args = (binname, "--kernel=multi", "--skip", "--devices={}".format(devices),
+            "--num={}".format(n), "--lsz={}".format(lsz))
+    popen = subprocess.Popen(args, stdout=subprocess.PIPE)
+    popen.wait()
+    output = popen.stdout.read().decode("utf-8")
+    return output
+
+
+def run_test(binname: str, devices: int, n: int, lsz: int, runs: int) -> dict:
+    walls, pures = [], []
+    for _ in range(runs):
+        output_text = execute_test(binname, devices, n, lsz)
+        walls.append(float(re.search(r"bitonic wall time: ([\d.e+-]+)", output_text).group(1)))
+        pures.append(float(re.search(r"bitonic pure time: ([\d.e+-]+)", output_text).group(1)))
+    return {"devices": devices, "len": 2 ** n, "gpu_wall": min(walls), "gpu_pure": min(pures)}
+
+
+def run_all_tests(binname: str, max_devices: int, n: int, lsz: int, runs: int) -> list:
+    return [run_test(binname, devices, n, lsz, runs) for devices in range(1, max_devices + 1)]
+
+
+def print_table(results: list) -> None:
+    base = results[0]["gpu_wall"]
+    print("devices  wall, ms  pure, ms  speedup  efficiency")
+    for test in results:
+        speedup = base / test["gpu_wall"] if test["gpu_wall"] else float("inf")
+        print("{:7}  {:8}  {:8}  {:7.2f}  {:10.2f}".format(
+            test["devices"], test["gpu_wall"], test["gpu_pure"], speedup, speedup / test["devices"]))
+
+
+def plot_scaling(results: list, n: int) -> None:
+    fig, ax = plt.subplots()
+    ax.grid()
+
+    devices = [test["devices"] for test in results]
+    base = results[0]["gpu_wall"]
+    plt.plot(devices, [base / test["gpu_wall"] for test in results], marker='o', label="multi bitonic sort")
+    plt.plot(devices, devices, linestyle='--', label="linear scaling")
+
+    plt.xlabel("Number of devices")
+    plt.ylabel("Speedup over one device (wall time)")
+    plt.title("Length = 2^{}".format(n))
+
+    ax.legend()
+    plt.show()
+
+
+def main():
+    args = parse_cmd_args()
+    results = run_all_tests(args.input, int(args.devices), int(args.n), int(args.lsz), int(args.runs))
+    if args.output:
+        with open(args.output, "w") as output:
+            json.dump({"multis": results}, output, indent=2)
+    print_table(results)
+    plot_scaling(results, int(args.n))
+
+
+if (__name__ == "__main__"):
+    main()